@@ -24,6 +24,11 @@
 
 -- check out https://github.com/premake/premake-core/wiki/Tokens
 
+newoption {
+    trigger     = "heap-sampling",
+    description = "Linux: interpose malloc/calloc/realloc/free (and the aligned ones) in qcstudio for recorder_t::start_heap_sampling"
+}
+
 workspace "tutorial-callstack-tracker"
 	language "C++"
 	cppdialect "C++17"
@@ -40,7 +45,8 @@ workspace "tutorial-callstack-tracker"
     filter { "platforms:*86"                 } architecture "x86"
     filter { "system:macosx", "action:gmake" } toolset "clang"
     filter { "system:windows", "action:vs*"  } buildoptions { "/W3", "/EHsc" }
-    filter { "system:linux"                  } links "pthread"
+    filter { "system:linux"                  } links { "pthread", "dl", "rt" } linkoptions { "-Wl,-rpath,'$$ORIGIN'" }
+    filter { "system:linux"                  } buildoptions { "-fno-omit-frame-pointer" }  -- the recorder walks the frame pointer chain
     filter { "toolset:clang or toolset:gcc"  } buildoptions { "-Wall", "-Wextra", "-fno-exceptions", "-msse4.2" }
 
     startproject "host"
@@ -52,12 +58,19 @@ project "qcstudio"
     targetdir ".out/%{cfg.platform}/%{cfg.buildcfg}"
     objdir ".tmp/%{prj.name}"
     defines { "BUILDING_QCSTUDIO" }
-    links {
-        "dbghelp"
-    }
 
     files { "src/qcstudio/*" }
 
+    filter { "system:windows" }
+        links { "dbghelp" }
+        removefiles { "src/qcstudio/*-linux.cpp" }
+
+    filter { "system:not windows" }
+        removefiles { "src/qcstudio/*-windows.cpp", "src/qcstudio/dll-notification-structs.h" }
+
+    filter { "system:linux", "options:heap-sampling" }
+        defines { "QCS_HEAP_SAMPLING" }  -- every allocation of the host goes through the recorder
+
 -- Test shared libraries
 
 project "foo"
@@ -68,9 +81,10 @@ project "foo"
     dependson { "qcstudio" }
 
     libdirs { "%{cfg.buildtarget.directory}" }
-    links { 
-        "qcstudio.lib"
-    }
+
+    filter { "system:windows"     } links { "qcstudio.lib" }
+    filter { "system:not windows" } links { "qcstudio" }
+    filter {}
 
     files { "src/foo/*" }
 
@@ -82,9 +96,10 @@ project "bar"
     dependson { "qcstudio" }
 
     libdirs { "%{cfg.buildtarget.directory}" }
-    links { 
-        "qcstudio.lib" 
-    }
+
+    filter { "system:windows"     } links { "qcstudio.lib" }
+    filter { "system:not windows" } links { "qcstudio" }
+    filter {}
 
     files { "src/bar/*" }
 
@@ -99,13 +114,14 @@ project "host"
     objdir ".tmp/%{prj.name}"
 
     libdirs { "%{cfg.buildtarget.directory}" }
-    links { 
-        "foo.lib", 
-        "qcstudio.lib" 
-    }
+    filter { "system:windows"     } links { "foo.lib", "qcstudio.lib" }
+    filter { "system:not windows" } links { "foo", "qcstudio" }
+    filter {}
 
     files { "src/host/*" }
 
+-- Viewer that interprets the data (symbols through DbgHelp on Windows, our own ELF/DWARF reader elsewhere)
+
 project "viewer"
     kind "ConsoleApp"
     dependson { "qcstudio" }
@@ -115,13 +131,46 @@ project "viewer"
     objdir ".tmp/%{prj.name}"
 
     libdirs { "%{cfg.buildtarget.directory}" }
-    links { 
-        "qcstudio.lib",
-        "dbghelp"
-    }
+    filter { "system:windows"     } links { "qcstudio.lib", "dbghelp" }
+    filter { "system:not windows" } links { "qcstudio" }
+    filter {}
 
     files { "src/viewer/*" }
 
+-- Collector of a host in shared mode, in a process of its own (see src/collector/collector.cpp)
+
+project "collector"
+    kind "ConsoleApp"
+    dependson { "qcstudio" }
+    includedirs { "src" }
+
+    targetdir ".out/%{cfg.platform}/%{cfg.buildcfg}"
+    objdir ".tmp/%{prj.name}"
+
+    libdirs { "%{cfg.buildtarget.directory}" }
+    filter { "system:windows"     } links { "qcstudio.lib" }
+    filter { "system:not windows" } links { "qcstudio" }
+    filter {}
+
+    files { "src/collector/*" }
+
+-- Benchmarks of the recorder and the player (JSON lines on stdout, see src/bench/bench.cpp)
+
+project "bench"
+    kind "ConsoleApp"
+    dependson { "qcstudio" }
+    includedirs { "src" }
+
+    targetdir ".out/%{cfg.platform}/%{cfg.buildcfg}"
+    objdir ".tmp/%{prj.name}"
+
+    libdirs { "%{cfg.buildtarget.directory}" }
+    filter { "system:windows"     } links { "qcstudio.lib" }
+    filter { "system:not windows" } links { "qcstudio" }
+    filter {}
+
+    files { "src/bench/*" }
+
 -- Handle Dropbox annoying sync of temporary folders
 
 print("[] Excluding .build, .tmp and .out from Dropbox sync...");
@@ -25,7 +25,7 @@
 #include "bar.h"
 #include "qcstudio/callstack-recorder.h"
 
-void bar_func_3(const int& _i) {
+void bar_func_3(const int&) {
     g_callstack_recorder.capture();
 }
 
@@ -0,0 +1,621 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#undef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+
+// Own
+
+#include "qcstudio/callstack-collector.h"
+#include "qcstudio/callstack-format.h"
+#include "qcstudio/callstack-player.h"
+#include "qcstudio/callstack-reader.h"
+#include "qcstudio/callstack-recorder.h"
+
+// C++
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Platform
+
+#if defined(_WIN32)
+#    define WIN32_LEAN_AND_MEAN
+#    define NOMINMAX
+#    include <windows.h>
+#elif defined(__linux__)
+#    include <pthread.h>
+#    include <sched.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+using namespace qcstudio::callstack;
+
+/*
+    Usage: bench [--tsc] [--shared]
+    - --tsc: timestamps from the CPU ticks instead of the wall clock (see recorder_t::set_time_source)
+    - --shared: the captures in shared mode instead (see recorder_t::start_sharing), drained by a collector in a
+      thread of its own, and then what it collected. No dump, parse nor replay (there are no dumps in shared mode)
+
+    Measures the recorder and the player and prints one JSON object per line (the first one describes the build
+    and the machine), so that the results of two builds can be compared line by line:
+    - dump: writing out the recording, plain and compressed (bytes/s, events/s and size), and how long
+      'dump_async' keeps the caller waiting instead
+    - parse: reading the events back (bytes/s and events/s)
+    - replay: resolving every capture (ns per capture, and per unique address after subtracting the parsing:
+      the symbols of the modules are loaded on demand, so this includes loading them), through the tuple flavoured
+      callback and through the view one (see player_t::view_callback_t)
+    - capture: ns per capture by stack depth and number of threads, of a stack captured over and over (so
+      interned) and of a different stack every time. It runs in streaming mode to the null device, blocking
+      when out of segments, as the default buffers would fill up (and start dropping) within milliseconds.
+      Then ns per capture of a stack 32 frames deeper than the limit, by depth limit (8, 32 and 200) known at
+      compile time (the template flavour) and at run time, net of the calls that build the stack. The calls alone and both
+      flavours take turns, DEPTH_REPETITIONS times, on a thread pinned to its CPU (Windows and Linux), as a
+      difference of a few hundred ns is easily lost in the noise of a single run
+    - interning: a check rather than a measurement, of threads capturing the same new stacks at once while
+      another one dumps over and over: every 'callstack_ref' in every dump has to come after its 'stack_def' (the
+      player drops the ones that do not). The bench fails if any does not
+    - restating: another check, of two streams and a dump one after the other capturing the same stack: all of
+      them have to replay every capture with the modules resolved (streamed events are gone from the recorder,
+      the stacks defined and the module snapshot included). The bench fails if any does not
+*/
+
+namespace {
+
+#if defined(_MSC_VER)
+#    define NOINLINE __declspec(noinline)
+#else
+#    define NOINLINE __attribute__((noinline))
+#endif
+
+    // Stacks of any depth: every level calls one of NUM_STEPS distinct functions (so call sites) chosen by the
+    // digits of the path, in base NUM_STEPS, and the last one captures
+
+    constexpr auto NUM_STEPS   = size_t{64};
+    constexpr auto REPETITIONS       = 5;   // of every measurement (the best one is kept)
+    constexpr auto DEPTH_REPETITIONS = 25;  // of the depth limit ones (ditto)
+
+    using step_t = void (*)(unsigned _depth, uint64_t _path);
+
+    volatile auto sink = size_t{0};  // keeps the calls out of tail position (and the steps from being folded)
+
+    auto capturing    = true;  // whether the last step captures at all
+    auto max_depth    = 0u;    // of its captures (0 for the plain 'capture')
+    auto compile_time = true;  // whether it is known at compile time (8, 32 or 200) or at run time
+
+    template<size_t I>
+    void step(unsigned _depth, uint64_t _path);
+
+    template<size_t... I>
+    constexpr auto make_steps(index_sequence<I...>) -> array<step_t, sizeof...(I)> {
+        return {&step<I>...};
+    }
+
+    constexpr auto steps = make_steps(make_index_sequence<NUM_STEPS>{});
+
+    template<size_t I>
+    NOINLINE void step(unsigned _depth, uint64_t _path) {
+        if (_depth) {
+            steps[_path % NUM_STEPS](_depth - 1, _path / NUM_STEPS);
+        } else if (!capturing) {
+        } else if (!max_depth) {
+            g_callstack_recorder.capture();
+        } else if (!compile_time) {
+            g_callstack_recorder.capture((uint16_t)max_depth);
+        } else if (max_depth == 8) {
+            g_callstack_recorder.capture<8>();
+        } else if (max_depth == 32) {
+            g_callstack_recorder.capture<32>();
+        } else {
+            g_callstack_recorder.capture<200>();
+        }
+        sink = sink + I + 1;
+    }
+
+    // Runs '_body(thread index)' in '_num_threads' threads started at once and returns the mean ns they took. They
+    // capture once beforehand to get a buffer of their own (otherwise a late one might adopt the full buffer of
+    // one already done)
+
+    template<typename BODY>
+    auto run_threads(unsigned _num_threads, const BODY& _body) -> double {
+        auto go      = atomic<bool>{false};
+        auto ready   = atomic<unsigned>{0};
+        auto elapsed = vector<double>(_num_threads);
+        auto threads = vector<thread>{};
+        for (auto i = 0u; i < _num_threads; ++i) {
+            threads.emplace_back([&, i] {
+                g_callstack_recorder.capture();
+                ready.fetch_add(1);
+                while (!go.load(memory_order_acquire)) {
+                    this_thread::yield();
+                }
+                const auto start = steady_clock::now();
+                _body(i);
+                elapsed[i] = (double)duration_cast<nanoseconds>(steady_clock::now() - start).count();
+            });
+        }
+        while (ready.load() != _num_threads) {
+            this_thread::yield();
+        }
+        go.store(true, memory_order_release);
+        for (auto& t : threads) {
+            t.join();
+        }
+        auto total = 0.0;
+        for (auto ns : elapsed) {
+            total += ns;
+        }
+        return total / _num_threads;
+    }
+
+    // Best of REPETITIONS runs of '_body', in ns
+
+    template<typename BODY>
+    auto best_of(const BODY& _body) -> double {
+        auto best = numeric_limits<double>::max();
+        for (auto i = 0; i < REPETITIONS; ++i) {
+            const auto start = steady_clock::now();
+            _body();
+            best = min(best, (double)duration_cast<nanoseconds>(steady_clock::now() - start).count());
+        }
+        return best;
+    }
+
+    // Keeps the calling thread on the CPU it is running on, while in scope
+
+    class pinned_t {
+    public:
+        pinned_t() {
+#if defined(_WIN32)
+            previous_ = SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR{1} << GetCurrentProcessorNumber());
+#elif defined(__linux__)
+            if (const auto cpu = sched_getcpu(); cpu >= 0 && !pthread_getaffinity_np(pthread_self(), sizeof(previous_), &previous_)) {
+                auto mask = cpu_set_t{};
+                CPU_ZERO(&mask);
+                CPU_SET(cpu, &mask);
+                pinned_ = !pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+            }
+#endif
+        }
+
+        ~pinned_t() {
+#if defined(_WIN32)
+            if (previous_) {
+                SetThreadAffinityMask(GetCurrentThread(), previous_);
+            }
+#elif defined(__linux__)
+            if (pinned_) {
+                pthread_setaffinity_np(pthread_self(), sizeof(previous_), &previous_);
+            }
+#endif
+        }
+
+    private:
+#if defined(_WIN32)
+        DWORD_PTR previous_ = 0;
+#elif defined(__linux__)
+        cpu_set_t previous_ = {};
+        bool      pinned_   = false;
+#endif
+    };
+
+    // JSON output, one object per line
+
+    class result_t {
+    public:
+        explicit result_t(const char* _benchmark) {
+            line_ << "{\"benchmark\":\"" << _benchmark << '"';
+        }
+
+        ~result_t() {
+            cout << line_.str() << '}' << endl;
+        }
+
+        template<typename T>
+        auto operator()(const char* _key, const T& _value) -> result_t& {
+            line_ << ",\"" << _key << "\":";
+            if constexpr (is_convertible_v<T, const char*>) {
+                line_ << '"' << _value << '"';
+            } else if constexpr (is_floating_point_v<T>) {
+                line_ << fixed << setprecision(3) << _value;
+            } else {
+                line_ << _value;
+            }
+            return *this;
+        }
+
+    private:
+        ostringstream line_;
+    };
+
+    // Events of a recording
+
+    auto count_events(const wchar_t* _filename) -> uint64_t {
+        auto reader = reader_t{};
+        auto event  = event_t{};
+        auto ret    = uint64_t{0};
+        if (reader.open(_filename)) {
+            while (reader.next(event)) {
+                ++ret;
+            }
+        }
+        return ret;
+    }
+
+    void bench_dump(const wchar_t* _filename, bool _compressed) {
+        g_callstack_recorder.set_compression(_compressed);
+        const auto ns     = best_of([&] { g_callstack_recorder.dump(_filename); });
+        const auto bytes  = filesystem::file_size(_filename);
+        const auto events = count_events(_filename);
+        result_t("dump")("compressed", _compressed)("bytes", bytes)("events", events)("mb_per_s", bytes * 1e3 / ns)("mevents_per_s", events * 1e3 / ns);
+
+        // What the caller waits for when the file is written in the background
+
+        auto       pending  = vector<future<bool>>{};
+        const auto snapshot = best_of([&] { pending.push_back(g_callstack_recorder.dump_async(_filename)); });
+        for (auto& dump : pending) {
+            dump.get();
+        }
+        result_t("dump_async")("compressed", _compressed)("events", events)("us_to_return", snapshot / 1e3)("us_to_write", ns / 1e3);
+    }
+
+    auto bench_parse(const wchar_t* _filename, bool _compressed) -> double {
+        auto       events = uint64_t{0};
+        auto       frames = uint64_t{0};
+        auto       bytes  = size_t{0};
+        const auto ns     = best_of([&] {
+            auto reader = reader_t{};
+            auto event  = event_t{};
+            events = frames = 0;
+            if (reader.open(_filename)) {
+                bytes = reader.size();
+                while (reader.next(event)) {
+                    ++events;
+                    frames += event.frames.size();
+                }
+            }
+        });
+        result_t("parse")("compressed", _compressed)("events", events)("frames", frames)("gb_per_s", bytes / ns)("mevents_per_s", events * 1e3 / ns);
+        return ns;
+    }
+
+    void bench_replay(const wchar_t* _filename, double _parse_ns, unsigned _num_workers, bool _views) {
+        auto       captures = uint64_t{0};
+        auto       stats    = player_t::cache_stats_t{};
+        const auto ns       = best_of([&] {
+            auto player = player_t{};
+            captures    = 0;
+            if (_views) {
+                player.start(_filename, [&](uint64_t, player_t::resolved_frames_t) { ++captures; }, _num_workers);
+            } else {
+                player.start(_filename, [&](uint64_t, const player_t::frames_t&) { ++captures; }, _num_workers);
+            }
+            player.end();
+            stats = player.cache_stats();
+        });
+        const auto per_address = stats.misses ? max(ns - _parse_ns, 0.0) / stats.misses : 0.0;
+        result_t("replay")("callback", _views ? "views" : "tuples")("workers", _num_workers)("captures", captures)("unique_addresses", stats.misses)("cache_hits", stats.hits)("ms", ns / 1e6)("ns_per_capture", ns / max<uint64_t>(captures, 1))("ns_per_unique_address", per_address);
+    }
+
+    void bench_capture(const char* _stacks, unsigned _depth, unsigned _num_threads, uint64_t _captures) {
+        const auto distinct = !strcmp(_stacks, "distinct");
+        const auto ns       = run_threads(_num_threads, [&](unsigned _thread) {
+            const auto base = ((uint64_t)_thread + 1) << 40;
+            for (auto i = uint64_t{0}; i < _captures; ++i) {
+                step<0>(_depth, distinct ? base + i : 0);
+            }
+        });
+        result_t("capture")("stacks", _stacks)("depth", _depth)("threads", _num_threads)("captures", _captures * _num_threads)("ns_per_capture", ns / _captures);
+    }
+
+    void bench_capture_depth(unsigned _max_depth, uint64_t _captures) {
+        const auto depth  = _max_depth + 32;  // beyond the limit, but not by so much that the calls hide the captures
+        const auto pinned = pinned_t{};
+        const auto run    = [&](bool _capturing, bool _compile_time) {
+            capturing        = _capturing;
+            compile_time     = _compile_time;
+            const auto start = steady_clock::now();
+            for (auto i = uint64_t{0}; i < _captures; ++i) {
+                step<0>(depth, 0);
+            }
+            return (double)duration_cast<nanoseconds>(steady_clock::now() - start).count();
+        };
+
+        // The best of every one, taking turns so that they all see the same conditions
+
+        auto calls = numeric_limits<double>::max();
+        auto ns    = array<double, 2>{numeric_limits<double>::max(), numeric_limits<double>::max()};  // run time, compile time
+        max_depth  = _max_depth;
+        for (auto i = 0; i < DEPTH_REPETITIONS; ++i) {
+            calls = min(calls, run(false, false));
+            for (auto known : {false, true}) {
+                ns[known] = min(ns[known], run(true, known));
+            }
+        }
+        max_depth = 0;
+        capturing = true;
+
+        for (auto known : {true, false}) {
+            result_t("capture")("stacks", "repeated")("depth", depth)("max_depth", _max_depth)("depth_known_at", known ? "compile time" : "run time")("threads", 1)("captures", _captures)("ns_per_capture", max(ns[known] - calls, 0.0) / _captures);
+        }
+    }
+
+    // Every thread captures the same stacks in the same order, so that the first captures of every stack race,
+    // and so do the dumps taken meanwhile (and one more once they are done)
+
+    auto bench_interning(const wchar_t* _filename) -> bool {
+        constexpr auto num_threads = 16u;
+        constexpr auto num_stacks  = uint64_t{512};
+        constexpr auto num_rounds  = uint64_t{8};  // of 'num_stacks' new stacks, each one after one more dump began
+        auto           dumping     = atomic<uint64_t>{0};
+        auto           done        = atomic<bool>{false};
+        auto           dumps       = vector<wstring>{};
+        auto           dumper      = thread([&] {
+            while (!done.load(memory_order_acquire)) {
+                dumps.push_back(wstring(_filename) + L"." + to_wstring(dumps.size()));
+                dumping.fetch_add(1, memory_order_release);
+                g_callstack_recorder.dump(dumps.back().c_str());
+            }
+        });
+        run_threads(num_threads, [&](unsigned) {
+            for (auto round = uint64_t{0}; round < num_rounds; ++round) {
+                while (dumping.load(memory_order_acquire) <= round) {
+                    this_thread::yield();
+                }
+                for (auto i = uint64_t{0}; i < num_stacks; ++i) {
+                    step<0>(8, (uint64_t{1} << 20) + round * num_stacks + i);  // none of them captured before
+                }
+            }
+        });
+        done.store(true, memory_order_release);
+        dumper.join();
+        g_callstack_recorder.dump(_filename);
+        dumps.push_back(_filename);
+
+        auto refs       = uint64_t{0};
+        auto unresolved = uint64_t{0};
+        for (auto& dump : dumps) {
+            auto reader  = reader_t{};
+            auto event   = event_t{};
+            auto defined = vector<bool>{};
+            if (reader.open(dump.c_str())) {
+                while (reader.next(event)) {
+                    if (event.type == recorder_t::event::stack_def) {
+                        defined.resize(max<size_t>(defined.size(), event.id + 1));
+                        defined[event.id] = true;
+                    } else if (event.type == recorder_t::event::callstack_ref) {
+                        ++refs;
+                        unresolved += event.id >= defined.size() || !defined[event.id];
+                    }
+                }
+            }
+            if (dump != _filename) {
+                reader.close();
+                filesystem::remove(dump);
+            }
+        }
+        result_t("interning")("threads", num_threads)("stacks", num_stacks)("rounds", num_rounds)("dumps", dumps.size())("refs", refs)("unresolved_refs", unresolved);
+        return !unresolved;
+    }
+
+    // Stream, stream again and dump, capturing the same stack every time
+
+    auto bench_restating(const wchar_t* _filename) -> bool {
+        constexpr auto num_captures = 10u;
+        auto           ok           = true;
+        for (auto recording : {"stream", "stream", "dump"}) {
+            const auto streaming = !strcmp(recording, "stream");
+            if (streaming && !g_callstack_recorder.start_streaming(_filename)) {
+                return false;
+            }
+            for (auto i = 0u; i < num_captures; ++i) {
+                step<0>(8, uint64_t{1} << 30);
+            }
+            if (streaming) {
+                g_callstack_recorder.stop_streaming();
+            } else {
+                g_callstack_recorder.dump(_filename);
+            }
+
+            auto reader   = reader_t{};
+            auto event    = event_t{};
+            auto captures = uint64_t{0};
+            auto modules  = uint64_t{0};
+            if (reader.open(_filename)) {
+                while (reader.next(event)) {
+                    captures += event.type == recorder_t::event::callstack || event.type == recorder_t::event::stack_def || event.type == recorder_t::event::callstack_ref;
+                    modules += event.type == recorder_t::event::add_module;
+                }
+            }
+            auto player   = player_t{};
+            auto replayed = uint64_t{0};
+            auto resolved = uint64_t{0};
+            player.start(_filename, [&](uint64_t, player_t::resolved_frames_t _frames) {
+                ++replayed;
+                resolved += !_frames.empty() && !_frames[0].module.empty();
+            });
+            player.end();
+
+            result_t("restating")("recording", recording)("captures", captures)("replayed", replayed)("resolved", resolved)("modules", modules);
+            ok = ok && captures >= num_captures && replayed == captures && resolved == captures;
+        }
+        return ok;
+    }
+
+    void bench_captures(unsigned _hardware) {
+        for (auto depth : {1u, 8u, 32u, 128u}) {
+            for (auto threads = 1u;; threads = min(threads * 2, _hardware)) {
+                bench_capture("repeated", depth, threads, 200'000);
+                if (depth == 32) {
+                    bench_capture("distinct", depth, threads, 20'000);
+                }
+                if (threads == _hardware) {
+                    break;
+                }
+            }
+        }
+        for (auto depth : {8u, 32u, 200u}) {
+            bench_capture_depth(depth, 50'000);
+        }
+    }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    auto tsc    = false;
+    auto shared = false;
+    for (auto i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--tsc")) {
+            tsc = true;
+        } else if (!strcmp(argv[i], "--shared")) {
+            shared = true;
+        } else {
+            cerr << "usage: bench [--tsc] [--shared]" << endl;
+            return 1;
+        }
+    }
+    if (tsc && !g_callstack_recorder.set_time_source(recorder_t::time_source::tsc)) {
+        cerr << "no invariant TSC" << endl;
+        return 1;
+    }
+
+    const auto hardware = max(thread::hardware_concurrency(), 1u);
+
+#if defined(NDEBUG)
+    const auto config = "release";
+#else
+    const auto config = "debug";
+#endif
+#if defined(_MSC_VER)
+    const auto compiler = "msvc " + to_string(_MSC_VER);
+#elif defined(__clang__)
+    const auto compiler = "clang " + to_string(__clang_major__) + "." + to_string(__clang_minor__);
+#else
+    const auto compiler = "gcc " + to_string(__GNUC__) + "." + to_string(__GNUC_MINOR__);
+#endif
+    result_t("environment")("config", config)("compiler", compiler.c_str())("pointer_size", sizeof(void*))("hardware_threads", hardware)("format_version", format::version)("time_source", tsc ? "tsc" : "system")("mode", shared ? "shared" : "streaming");
+
+    if (shared) {
+        // Rings large enough for the collector to keep up, for the threads of 'run_threads' plus this one
+
+        if (!g_callstack_recorder.start_sharing(L"bench", 16 * 1024 * 1024, hardware + 1)) {
+            cerr << "cannot share" << endl;
+            return 1;
+        }
+        auto collector = collector_t{};
+        if (!collector.open(L"bench")) {
+            cerr << "cannot collect" << endl;
+            return 1;
+        }
+        auto events  = uint64_t{0};
+        auto drainer = thread([&] {
+            while (collector.next([&](event_t&) {
+                ++events;
+                return true;
+            })) {
+            }
+        });
+
+        bench_captures(hardware);
+
+        g_callstack_recorder.stop_sharing();
+        drainer.join();
+        const auto stats = collector.stats();
+        result_t("collect")("events", events)("bytes", stats.collected)("dropped", stats.dropped)("max_backlog_bytes", stats.max_backlog)("threads", stats.threads);
+        return 0;
+    }
+
+    // A recording of 16 threads, each one capturing some two thousand distinct stacks 16 deep, most of them twice
+    // (within the default per-thread buffers and the interning table)
+
+    const auto plain      = L"bench.bin";
+    const auto compressed = L"bench-lz.bin";
+    run_threads(16, [](unsigned _thread) {
+        for (auto i = uint64_t{0}; i < 4000; ++i) {
+            step<0>(16, ((i * 0x9e3779b97f4a7c15ull) >> 53) + ((uint64_t)_thread << 11));
+        }
+    });
+
+    bench_dump(plain, false);
+    bench_dump(compressed, true);
+    g_callstack_recorder.set_compression(false);
+
+    const auto parse_ns = bench_parse(plain, false);
+    bench_parse(compressed, true);
+    for (auto views : {false, true}) {
+        bench_replay(plain, parse_ns, 0, views);
+        bench_replay(plain, parse_ns, hardware, views);
+    }
+
+    filesystem::remove(plain);
+    filesystem::remove(compressed);
+
+    const auto interning = L"bench-interning.bin";
+    const auto resolved  = bench_interning(interning);
+    filesystem::remove(interning);
+    if (!resolved) {
+        cerr << "references to stacks never defined" << endl;
+        return 1;
+    }
+
+    const auto restating = L"bench-restating.bin";
+    const auto restated  = bench_restating(restating);
+    filesystem::remove(restating);
+    if (!restated) {
+        cerr << "captures lost from a recording after streaming" << endl;
+        return 1;
+    }
+
+    // Captures
+
+#if defined(_WIN32)
+    const auto null_device = L"NUL";
+#else
+    const auto null_device = L"/dev/null";
+#endif
+    if (!g_callstack_recorder.start_streaming(null_device, recorder_t::backpressure::block)) {
+        cerr << "cannot stream to the null device" << endl;
+        return 1;
+    }
+    bench_captures(hardware);
+    g_callstack_recorder.stop_streaming();
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Own
+
+#include "qcstudio/callstack-collector.h"
+
+// C++
+
+#include <iostream>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+/*
+    Usage: collector NAME FILE [--lz]
+    Collects what a host sharing as NAME (host --shared NAME) records, from another process, into the recording
+    FILE (optionally compressed) until the host stops sharing or exits. Then reports the counters of the shared memory
+*/
+
+auto main(int argc, char** argv) -> int {
+    if (argc < 3) {
+        cerr << "usage: collector NAME FILE [--lz]" << endl;
+        return 1;
+    }
+    const auto name     = wstring(argv[1], argv[1] + strlen(argv[1]));
+    const auto filename = wstring(argv[2], argv[2] + strlen(argv[2]));
+    const auto compress = argc > 3 && !strcmp(argv[3], "--lz");
+
+    auto collector = qcstudio::callstack::collector_t{};
+    if (!collector.open(name.c_str())) {
+        cerr << "no host sharing as " << argv[1] << endl;
+        return 1;
+    }
+    const auto ok    = collector.drain(filename.c_str(), compress);
+    const auto stats = collector.stats();
+    cout << stats.collected << " bytes collected from " << stats.threads << " threads, " << stats.dropped << " events dropped, backlog of up to " << stats.max_backlog << " bytes" << endl;
+    return ok ? 0 : 1;
+}
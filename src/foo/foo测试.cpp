@@ -34,21 +34,34 @@
 
 #include <iostream>
 
-// Windows includes
+// Platform includes
 
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
-#include <libloaderapi.h>
+#if defined(_WIN32)
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#    include <libloaderapi.h>
+#else
+#    include <dlfcn.h>
+#endif
 
 // Test functions that call to ech other in a sequence
 
 void foo_func_3() {
+#if defined(_WIN32)
     if (auto bar_module = LoadLibrary(L"bar.dll")) {
         if (auto bar_function = (void (*)())GetProcAddress(bar_module, "bar")) {
             bar_function();  // There is another 'capture' call inside this so we can test multiple modules in the callstack
         }
         FreeLibrary(bar_module);
     }
+#else
+    if (auto bar_module = dlopen("libbar.so", RTLD_NOW)) {
+        if (auto bar_function = (void (*)())dlsym(bar_module, "bar")) {
+            bar_function();  // There is another 'capture' call inside this so we can test multiple modules in the callstack
+        }
+        dlclose(bar_module);
+    }
+#endif
 }
 
 void foo_func_2() {
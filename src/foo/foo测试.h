@@ -23,4 +23,8 @@
 */
 #pragma once
 
-extern "C" __declspec(dllexport) void foo();
\ No newline at end of file
+#if defined(_WIN32)
+extern "C" __declspec(dllexport) void foo();
+#else
+extern "C" __attribute__((visibility("default"))) void foo();
+#endif
\ No newline at end of file
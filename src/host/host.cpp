@@ -25,11 +25,17 @@
 // C++ includes
 
 #include <iostream>
+#include <cstring>
+#include <string>
 
-// Windows includes
+// Platform includes
 
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
+#if defined(_WIN32)
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#else
+#    include <dlfcn.h>
+#endif
 
 // Our includes
 
@@ -38,7 +44,22 @@
 
 using namespace std;
 
-auto main() -> int {
+auto main(int argc, char** argv) -> int {
+    // 'host --live NAME' streams the recording to a viewer waiting for it ('viewer --live NAME') instead of dumping it,
+    // and 'host --shared NAME' leaves it in shared memory for a collector ('collector NAME FILE' or 'viewer --shared NAME')
+
+    const auto live   = argc > 2 && !strcmp(argv[1], "--live");
+    const auto shared = argc > 2 && !strcmp(argv[1], "--shared");
+    const auto name   = argc > 2 ? wstring(argv[2], argv[2] + strlen(argv[2])) : wstring{};
+    if (live && !g_callstack_recorder.start_live_streaming(name.c_str())) {
+        cerr << "no viewer waiting at " << argv[2] << endl;
+        return 1;
+    }
+    if (shared && !g_callstack_recorder.start_sharing(name.c_str())) {
+        cerr << "cannot share as " << argv[2] << endl;
+        return 1;
+    }
+
     // capture some call stacks: some inside modules calling other modules and some directly from main
 
     foo();
@@ -46,16 +67,31 @@ auto main() -> int {
 
     // load and invoke bar module functions
 
+#if defined(_WIN32)
     if (auto bar_module = LoadLibrary(L"bar.dll")) {
         if (auto bar_function = (void (*)())GetProcAddress(bar_module, "bar")) {
             bar_function();
         }
         FreeLibrary(bar_module);
     }
+#else
+    if (auto bar_module = dlopen("libbar.so", RTLD_NOW)) {
+        if (auto bar_function = (void (*)())dlsym(bar_module, "bar")) {
+            bar_function();
+        }
+        dlclose(bar_module);
+    }
+#endif
 
-    // dump the manager buffer
+    // dump the manager buffer (or end the stream, or let the collector finish)
 
-    g_callstack_recorder.dump(L"callstack_data★.json");
+    if (live) {
+        g_callstack_recorder.stop_streaming();
+    } else if (shared) {
+        g_callstack_recorder.stop_sharing();
+    } else {
+        g_callstack_recorder.dump(L"callstack_data★.json");
+    }
 
     cout << "Done!" << endl;
 
@@ -0,0 +1,249 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Own
+
+#include "callstack-collector.h"
+#include "callstack-shared.h"
+#include "callstack-writer.h"
+#include "unicode.h"
+
+// C++
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Time stamp counter
+
+#if defined(_MSC_VER)
+#    include <intrin.h>
+#else
+#    include <x86intrin.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+    static constexpr auto POLL_PERIOD = milliseconds{10};  // between passes that found nothing to collect
+
+    // The clock of the recorder (see recorder_t::time_source): the TSC is shared by every process of the machine
+
+    auto recorder_now(uint8_t _time_source) -> int64_t {
+        if (_time_source == (uint8_t)qcstudio::callstack::recorder_t::time_source::tsc) {
+            return (int64_t)__rdtsc();
+        }
+        return duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+    }
+
+    // A ring within a pass: from its tail up to the head seen when the pass began
+
+    struct cursor_t {
+        qcstudio::callstack::shared::ring_t* ring;
+        uint64_t                             position;
+        uint64_t                             head;
+    };
+}  // namespace
+
+qcstudio::callstack::collector_t::~collector_t() {
+    close();
+}
+
+auto qcstudio::callstack::collector_t::open(const wchar_t* _name) -> bool {
+    close();
+
+    const auto memory = memory_.open(_name);
+    if (!memory || memory_.size() < sizeof(shared::header_t)) {
+        close();
+        return false;
+    }
+
+    // The magic goes last, and the rest has to be consistent with the size of the memory
+
+    auto header = (shared::header_t*)memory;
+    if (header->magic.load(memory_order_acquire) != shared::magic_number()) {
+        close();
+        return false;
+    }
+    const auto ring_size = header->ring_size;
+    if (!ring_size || (ring_size & (ring_size - 1)) || header->ring_stride < sizeof(shared::ring_t) + ring_size ||
+        header->header_size + (uint64_t)header->max_rings * header->ring_stride > memory_.size()) {
+        close();
+        return false;
+    }
+
+    header_ = header;
+    name_   = _name;
+    done_   = false;
+    header_->attached.fetch_add(1, memory_order_relaxed);
+    return true;
+}
+
+void qcstudio::callstack::collector_t::close() {
+    if (header_ && done_) {
+        misc::shared_memory_t::remove(name_.c_str());  // all of it collected, nobody needs the name anymore
+    }
+    memory_.close();
+    header_ = nullptr;
+    name_.clear();
+    done_ = false;
+}
+
+auto qcstudio::callstack::collector_t::next(const function<bool(event_t&)>& _callback) -> bool {
+    if (!header_ || done_) {
+        return false;
+    }
+
+    // Wait for events, or for the recorder to be done. As in streaming, events stamped after the pass began are
+    // left for the next one, and so are those the sampler has not drained yet; once the recorder is done
+    // everything goes
+
+    const auto mask    = header_->ring_size - 1;
+    auto       cursors = vector<cursor_t>{};
+    auto       closed  = false;
+    auto       until   = int64_t{};
+    auto       backlog = uint64_t{0};
+    for (;;) {
+        closed             = header_->closed.load(memory_order_acquire) || !misc::process_alive(header_->owner);
+        const auto sampled = header_->sampled_until.load(memory_order_acquire);
+        const auto now     = recorder_now(header_->time_source.load(memory_order_acquire));
+        until              = closed ? numeric_limits<int64_t>::max() : sampled ? min(now, sampled) : now;
+
+        cursors.clear();
+        backlog          = 0;
+        const auto rings = min(header_->rings.load(memory_order_acquire), header_->max_rings);
+        for (auto i = 0u; i < rings; ++i) {
+            const auto ring = shared::ring(header_, i);
+            const auto tail = ring->tail.load(memory_order_relaxed);
+            const auto head = ring->head.load(memory_order_acquire);
+            if (head != tail) {
+                cursors.push_back({ring, tail, head});
+                backlog += head - tail;
+            }
+        }
+        if (!cursors.empty() || closed) {
+            break;
+        }
+        this_thread::sleep_for(POLL_PERIOD);
+    }
+
+    // K-way merge by timestamp (events are already sorted within every ring)
+
+    const auto peek = [&](cursor_t& _cursor) -> const uint8_t* {
+        if (_cursor.position < _cursor.head && _cursor.ring->data()[_cursor.position & mask] == shared::wrap) {
+            _cursor.position = (_cursor.position | mask) + 1;
+        }
+        return _cursor.position < _cursor.head ? _cursor.ring->data() + (_cursor.position & mask) : nullptr;
+    };
+
+    using head_t    = pair<int64_t, size_t>;  // timestamp, cursor index
+    auto       heads = priority_queue<head_t, vector<head_t>, greater<head_t>>{};
+    const auto push  = [&](size_t _index) {
+        if (const auto event = peek(cursors[_index])) {
+            auto timestamp = int64_t{};
+            memcpy(&timestamp, event + 1, sizeof(timestamp));
+            if (timestamp < until) {
+                heads.push({timestamp, _index});
+            }
+        }
+    };
+    for (auto i = 0u; i < cursors.size(); ++i) {
+        push(i);
+    }
+
+    auto ok    = true;
+    auto event = event_t{};
+    while (ok && !heads.empty()) {
+        const auto index  = heads.top().second;
+        auto&      cursor = cursors[index];
+        heads.pop();
+
+        const auto offset = cursor.position & mask;
+        const auto pos    = cursor.ring->data() + offset;
+        if (!reader_t::decode(pos, pos + min(mask + 1 - offset, cursor.head - cursor.position), event)) {
+            cursor.position = cursor.head;  // corrupt: the rest of what the ring has is lost
+            continue;
+        }
+        ok = _callback(event);
+        cursor.position += event.raw_size;
+        push(index);
+    }
+
+    // Give the space back to the recorder, and report
+
+    auto collected = uint64_t{0};
+    for (auto& cursor : cursors) {
+        collected += cursor.position - cursor.ring->tail.load(memory_order_relaxed);
+        cursor.ring->tail.store(cursor.position, memory_order_release);
+    }
+    header_->collected.fetch_add(collected, memory_order_relaxed);
+    header_->backlog.store(backlog, memory_order_relaxed);
+    if (backlog > header_->max_backlog.load(memory_order_relaxed)) {
+        header_->max_backlog.store(backlog, memory_order_relaxed);
+    }
+    header_->last_pass.store(duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count(), memory_order_relaxed);
+
+    done_ = closed;
+    if (!closed && !collected) {
+        this_thread::sleep_for(POLL_PERIOD);  // nothing old enough yet
+    }
+    return ok && !closed;
+}
+
+auto qcstudio::callstack::collector_t::drain(const wchar_t* _filename, bool _compress) -> bool {
+    if (!header_) {
+        return false;
+    }
+    auto file = std::ofstream(unicode::native_path(_filename), ios_base::binary | ios_base::out);
+    if (!file) {
+        return false;
+    }
+    auto writer = writer_t{file, _compress ? format::codec::lz : format::codec::none};
+    while (next([&](event_t& _event) {
+        writer.write(_event.raw);
+        return true;
+    })) {
+    }
+    writer.finish();
+    file.close();
+    return done_ && !file.fail();
+}
+
+auto qcstudio::callstack::collector_t::stats() const -> stats_t {
+    auto ret = stats_t{};
+    if (header_) {
+        ret.collected   = header_->collected.load(memory_order_relaxed);
+        ret.backlog     = header_->backlog.load(memory_order_relaxed);
+        ret.max_backlog = header_->max_backlog.load(memory_order_relaxed);
+        ret.dropped     = header_->dropped.load(memory_order_relaxed);
+        ret.threads     = header_->rings.load(memory_order_relaxed);
+    }
+    return ret;
+}
@@ -0,0 +1,107 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+// QCStudio
+
+#include "callstack-reader.h"
+#include "shared-memory.h"
+
+// C++
+
+#include <cstdint>
+#include <functional>
+
+#if defined(_MSC_VER)
+#    pragma warning(disable : 4251)
+#endif
+#pragma push_macro("QCS_API")
+#undef QCS_API
+#if !defined(_WIN32)
+#    define QCS_API __attribute__((visibility("default")))
+#elif defined(BUILDING_QCSTUDIO)
+#    define QCS_API __declspec(dllexport)
+#else
+#    define QCS_API __declspec(dllimport)
+#endif
+
+/*
+    Collector of a recorder in shared mode (see recorder_t::start_sharing), from another process.
+    Every pass takes what the threads of the recorder committed to their rings, merged by timestamp as streaming
+    does, and leaves the most recent events for the next pass (a thread may still be about to commit older ones).
+    Passes poll: the recorder never signals anything. The collector is done once the recorder stops sharing, or
+    its process is gone, and whatever is left has been collected
+*/
+
+namespace qcstudio::callstack {
+
+    using namespace std;
+
+    namespace shared {
+        struct header_t;
+    }
+
+    class QCS_API collector_t {
+    public:
+        collector_t() = default;
+        collector_t(const collector_t&) = delete;
+        auto operator=(const collector_t&) -> collector_t& = delete;
+        ~collector_t();
+
+        auto open(const wchar_t* _name) -> bool;  // false if there is no recorder sharing as '_name'
+        void close();
+
+        // Waits for the next events and calls '_callback' for every one of them (until it returns false), in the
+        // layout of the recorder (see reader_t::decode) and pointing into the rings, hence, only valid during the
+        // call. Returns false once it is done (the last events included) or the callback failed
+
+        auto next(const function<bool(event_t&)>& _callback) -> bool;
+
+        // All of it into a recording (see callstack-format.h), as streaming would have written it
+
+        auto drain(const wchar_t* _filename, bool _compress = false) -> bool;
+
+        // the counters of the shared header (see callstack-shared.h)
+
+        struct stats_t {
+            uint64_t collected   = 0;  // bytes of events
+            uint64_t backlog     = 0;  // bytes waiting in the rings when the last pass began
+            uint64_t max_backlog = 0;
+            uint64_t dropped     = 0;  // events lost by the recorder, their ring being full
+            uint32_t threads     = 0;  // that recorded (those beyond the rings of the recorder lose everything)
+        };
+
+        auto stats() const -> stats_t;
+
+    private:
+        misc::shared_memory_t memory_;
+        shared::header_t*     header_ = nullptr;
+        wstring               name_;
+        bool                  done_ = false;
+    };
+
+}  // namespace qcstudio::callstack
+
+#pragma pop_macro("QCS_API")
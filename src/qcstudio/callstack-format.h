@@ -0,0 +1,151 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+
+/*
+    Recording format.
+    v1 (no header): the events as the recorder stores them in memory (see recorder_t::event)
+    v2: |header|chunk|...|chunk|index|trailer|, the header being |magic(4 bytes)|version(2 bytes)|pointer size(1 byte)|
+        endianness(1 byte)| where:
+        - every chunk is |size(4 bytes)|codec(1 byte)|events size(4 bytes)|data(size bytes)|, the data being either
+          the events as they are or the events compressed (see lz.h and 'codec')
+        - every event is |tag(1 byte)|timestamp delta(varint, only if flagged in the tag)|payload|, the tag being
+          |low 4 bits of the timestamp delta|more delta bits follow(1 bit)|event(3 bits)| and the delta the zigzag
+          encoded difference with the timestamp of the previous event. Events from 'heap_free' on are tagged as
+          'extended_event' and their actual event follows the timestamp delta in a byte of its own
+        - the payload is the one of v1 with counts, ids, base addresses, sizes, calibration values, heap event
+          fields and telemetry counters as varints ('telemetry' ends with |numbuckets(varint)|buckets(n varints)|)
+        - stack ids are renumbered in order of definition (so they stay small)
+        - frames are |offset << 1 | new module(varint)|module(varint, only for a new module)|: module n is the n-th
+          'add_module' of the chunk (1 based) and 0 means that the offset is the absolute address (no module was
+          covering it). The module is only written when it differs from the one of the previous frame
+        - the decoding state restarts at every chunk (timestamp deltas from 0, module numbering from 1). Chunks are
+          self-contained: they begin with the last calibration and the modules loaded at the time (stamped when
+          they were recorded) and define every stack they reference
+        - the index is |offset(8 bytes)|first timestamp(8 bytes)|last timestamp(8 bytes)| per chunk, the offset
+          being the one of its size within the file and the timestamps nanoseconds of the wall clock (calibrated
+          for tick based recordings) of its own events (restated ones not included)
+        - the trailer is |index offset(8 bytes)|number of chunks(4 bytes)|index magic(4 bytes)|
+        Files without trailer (e.g. a process that died while streaming) are read by walking the chunk sizes
+    Mapped files (see recorder_t::start_mapping) keep the in-memory layout too. Live streams (see
+    recorder_t::start_live_streaming) are |header|chunk|...|chunk| without index nor trailer
+*/
+
+namespace qcstudio::callstack::format {
+
+    static constexpr char     magic[4]       = {'Q', 'C', 'S', 'R'};
+    static constexpr uint16_t version        = 2;
+    static constexpr uint16_t min_version    = 2;  // oldest one with a header that we still read
+    static constexpr uint8_t  little_endian  = 1;
+    static constexpr uint8_t  big_endian     = 2;
+    static constexpr size_t   header_size    = sizeof(magic) + sizeof(version) + 2;
+    static constexpr size_t   max_varint     = 10;  // bytes of a 64 bits varint
+    static constexpr uint8_t  event_mask     = 0x07;
+    static constexpr uint8_t  delta_follows  = 0x08;
+    static constexpr uint8_t  delta_shift    = 4;
+    static constexpr uint8_t  extended_event = 0x07;  // the event follows in a byte of its own
+
+    // v2 container
+
+    static constexpr char   index_magic[4] = {'Q', 'C', 'S', 'I'};
+    static constexpr size_t chunk_size     = 1 << 20;  // default bytes of events per chunk
+    static constexpr size_t max_chunk_size = 64 << 20;  // bytes of a chunk (stored and of events) readers accept
+    static constexpr size_t chunk_header   = sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t);
+    static constexpr size_t index_entry    = 3 * sizeof(uint64_t);
+    static constexpr size_t trailer_size   = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(index_magic);
+
+    inline auto native_endianness() -> uint8_t {
+        const auto probe = uint16_t{1};
+        return *(const uint8_t*)&probe ? little_endian : big_endian;
+    }
+
+    // LEB128
+
+    inline void put_varint(uint8_t*& _cursor, uint64_t _value) {
+        while (_value >= 0x80) {
+            *_cursor++ = (uint8_t)(_value | 0x80);
+            _value >>= 7;
+        }
+        *_cursor++ = (uint8_t)_value;
+    }
+
+    inline auto get_varint(const uint8_t*& _cursor, const uint8_t* _end, uint64_t& _value) -> bool {
+        _value = 0;
+        for (auto shift = 0u; _cursor < _end && shift < 64; shift += 7) {
+            const auto byte = *_cursor++;
+            _value |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Signed values (timestamps may go slightly backwards) interleaved so that small magnitudes stay small
+
+    inline auto zigzag(int64_t _value) -> uint64_t {
+        return ((uint64_t)_value << 1) ^ (uint64_t)(_value >> 63);
+    }
+
+    inline auto unzigzag(uint64_t _value) -> int64_t {
+        return (int64_t)(_value >> 1) ^ -(int64_t)(_value & 1);
+    }
+
+    // Chunk data
+
+    enum class codec : uint8_t {
+        none = 0,
+        lz   = 1,
+    };
+
+    // Recording timestamps to nanoseconds of the wall clock. Tick based recordings (see recorder_t::time_source)
+    // carry calibration events: the ticks that follow one are converted from its wall clock reading and frequency.
+    // Before any calibration timestamps are taken as nanoseconds already
+
+    struct timebase_t {
+        bool    calibrated   = false;
+        int64_t anchor_ticks = 0;
+        int64_t anchor_ns    = 0;
+        double  ns_per_tick  = 1.0;
+
+        void calibrate(int64_t _ticks, int64_t _wall_time, uint64_t _frequency) {
+            if (_frequency) {
+                calibrated   = true;
+                anchor_ticks = _ticks;
+                anchor_ns    = _wall_time;
+                ns_per_tick  = 1e9 / (double)_frequency;
+            }
+        }
+
+        auto to_ns(int64_t _timestamp) const -> int64_t {
+            return calibrated ? anchor_ns + llround((double)(_timestamp - anchor_ticks) * ns_per_tick) : _timestamp;
+        }
+    };
+
+}  // namespace qcstudio::callstack::format
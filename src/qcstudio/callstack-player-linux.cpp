@@ -0,0 +1,117 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Us
+
+#include "callstack-player.h"
+#include "symbol-index.h"
+#include "unicode.h"
+
+// C++
+
+#include <map>
+#include <memory>
+#include <cstdlib>
+#include <string>
+
+// Linux
+
+#include <cxxabi.h>
+
+using namespace std;
+using namespace qcstudio;
+
+/*
+    Linux specific parts of the player: symbols come from our own ELF/DWARF index (see symbol-index.h). The
+    indices are read-only once built so, unlike DbgHelp, symbolizing needs no lock. The handle of a module is
+    the address of its index
+*/
+
+struct qcstudio::callstack::player_t::symbolizer_t {
+    map<wstring, unique_ptr<symbols::module_index_t>> modules;    // by path (a module loaded twice is indexed once)
+    wstring                                           cache_dir;  // symbol index cache (empty: disabled)
+};
+
+qcstudio::callstack::player_t::player_t() = default;
+
+qcstudio::callstack::player_t::~player_t() = default;
+
+auto qcstudio::callstack::player_t::init() -> bool {
+    symbolizer_ = make_unique<symbolizer_t>();
+
+    // The indices are cached in $QCSTUDIO_SYMBOL_CACHE (an empty value disables the cache), by default in the
+    // user's cache directory
+
+    auto dir = string{};
+    if (auto env = getenv("QCSTUDIO_SYMBOL_CACHE")) {
+        dir = env;
+    } else if (auto xdg = getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+        dir = string(xdg) + "/qcstudio/symbols";
+    } else if (auto home = getenv("HOME"); home && *home) {
+        dir = string(home) + "/.cache/qcstudio/symbols";
+    }
+    symbolizer_->cache_dir = unicode::to_wide(dir.c_str());
+    return true;
+}
+
+auto qcstudio::callstack::player_t::load_module(const std::wstring& _filepath, size_t) -> optional<uint64_t> {
+    // A module we cannot read (gone since the recording, no permissions...) still gets a handle: its frames
+    // just stay unresolved instead of stopping the replay
+
+    auto& index = symbolizer_->modules[_filepath];
+    if (!index) {
+        index = make_unique<symbols::module_index_t>();
+        index->load(_filepath.c_str(), symbolizer_->cache_dir.c_str());
+    }
+    return (uint64_t)(uintptr_t)index.get();
+}
+
+auto qcstudio::callstack::player_t::end() -> bool {
+    symbolizer_.reset();
+    return true;
+}
+
+auto qcstudio::callstack::player_t::symbolize(uint64_t _baseaddr, uint64_t _addroffset)
+    -> tuple<wstring, int, wstring> {
+    // Frames are return addresses: look up the call instruction instead, which may be the last one of its
+    // line (or even of its function)
+
+    const auto index               = (const symbols::module_index_t*)(uintptr_t)_baseaddr;
+    const auto [file, line, name] = index->lookup(_addroffset ? _addroffset - 1 : 0);
+    if (!name && !file) {
+        return {};
+    }
+
+    auto symbol = wstring{};
+    if (name) {
+        auto status    = 0;
+        auto demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+        symbol         = unicode::to_wide(status == 0 && demangled ? demangled : name);
+        free(demangled);
+    }
+    if (file) {
+        return {unicode::to_wide(file), (int)line, symbol};
+    }
+    return {L"", -1, symbol};
+}
@@ -0,0 +1,127 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Us
+
+#include "callstack-player.h"
+#include "uuid.h"
+#include "crc32.h"
+
+// Windows
+
+#undef WIN32_LEAN_AND_MEAN
+#undef NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <Psapi.h>
+#include <intrin.h>
+#include <dbghelp.h>
+
+using namespace std;
+using namespace qcstudio;
+
+#pragma warning(disable : 26812)
+
+/*
+    Windows specific parts of the player: symbols come from the DbgHelp library
+*/
+
+struct qcstudio::callstack::player_t::symbolizer_t {
+    uint64_t   id             = 0xffFFffFF'ffFFffFF;  // the DbgHelp "process" of this player
+    uint64_t   last_base_addr = 0x1'00000000u;        // where the next module goes (see load_module)
+    std::mutex lock;                                  // DbgHelp is single threaded
+
+    static auto generate_id() -> uint64_t {
+        const auto high_id = (uint32_t)crc32::from_string(misc::uuid().str().c_str());
+        const auto low_id  = (uint32_t)crc32::from_string(misc::uuid().str().c_str());
+        return ((uint64_t)high_id << 32) | low_id;
+    }
+};
+
+qcstudio::callstack::player_t::player_t() = default;
+
+qcstudio::callstack::player_t::~player_t() = default;
+
+auto qcstudio::callstack::player_t::init() -> bool {
+    /*
+        == DebgHelp setup ==========
+        Init the library
+        Generate a random id to be used on evary Sym* call
+    */
+    auto old_opt = SymGetOptions();
+    auto opt =
+        (old_opt & ~SYMOPT_DEFERRED_LOADS)  // Load symbols as we load the module
+        | SYMOPT_LOAD_LINES                 // We will be needing the source lines
+        | SYMOPT_IGNORE_NT_SYMPATH          // Ignore _NT_SYMBOL_PATH
+        | SYMOPT_UNDNAME                    // Human readable non-decorated names
+        /* | SYMOPT_DEBUG */
+        ;
+    SymSetOptions(opt);
+
+    symbolizer_     = make_unique<symbolizer_t>();
+    symbolizer_->id = symbolizer_t::generate_id();
+    if (!SymInitialize((HANDLE)symbolizer_->id, NULL, FALSE)) {
+        return false;
+    }
+
+    return true;
+}
+
+auto qcstudio::callstack::player_t::load_module(const std::wstring& _filepath, size_t _size) -> optional<uint64_t> {
+    auto guard = std::lock_guard(symbolizer_->lock);
+    if (auto ret = SymLoadModuleExW((HANDLE)symbolizer_->id, NULL, _filepath.c_str(), NULL, symbolizer_->last_base_addr, (DWORD)_size, NULL, 0); ret) {
+        symbolizer_->last_base_addr += _size;
+        return (uint64_t)ret;
+    }
+    return {};
+}
+
+auto qcstudio::callstack::player_t::end() -> bool {
+    return SymCleanup((HANDLE)symbolizer_->id);
+}
+
+auto qcstudio::callstack::player_t::symbolize(uint64_t _baseaddr, uint64_t _addroffset)
+    -> tuple<wstring, int, wstring> {
+    auto guard = std::lock_guard(symbolizer_->lock);
+    auto index = DWORD64{};
+    struct {
+        SYMBOL_INFOW  sym;
+        unsigned char name[256];
+    } user_symbol;
+    user_symbol.sym.SizeOfStruct = sizeof(user_symbol.sym);
+    user_symbol.sym.MaxNameLen   = sizeof(user_symbol.name);
+    auto addr                    = (DWORD64)(_baseaddr + _addroffset);
+    if (SymFromAddrW((HANDLE)symbolizer_->id, addr, &index, &user_symbol.sym)) {
+        auto line         = IMAGEHLP_LINEW64{};
+        auto offset       = DWORD{0};
+        line.SizeOfStruct = sizeof(line);
+        if (SymGetLineFromAddrW64((HANDLE)symbolizer_->id, addr, &offset, &line)) {
+            return {line.FileName, line.LineNumber, wstring(user_symbol.sym.Name)};
+        } else {
+            return {L"", -1, wstring(user_symbol.sym.Name)};
+        }
+    }
+    return {};
+}
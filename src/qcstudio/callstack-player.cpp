@@ -22,242 +22,704 @@
     SOFTWARE.
 */
 
-#pragma once
-
 // Us
 
 #include "callstack-player.h"
-#include "uuid.h"
-#include "crc32.h"
+#include "callstack-profile.h"
+#include "callstack-reader.h"
+#include "callstack-collector.h"
+#include "module-timeline.h"
+#include "callstack-format.h"
 
 // C++
 
 #include <array>
 #include <vector>
 #include <iostream>
-#include <fstream>
 #include <chrono>
 #include <map>
-#include <set>
+#include <unordered_map>
 #include <iomanip>
 #include <filesystem>
-
-// Windows
-
-#undef WIN32_LEAN_AND_MEAN
-#undef NOMINMAX
-#define WIN32_LEAN_AND_MEAN
-#define NOMINMAX
-#include <Windows.h>
-#include <Psapi.h>
-#include <intrin.h>
-#include <dbghelp.h>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <condition_variable>
+#include <limits>
+#include <cmath>
 
 using namespace std;
 using namespace qcstudio;
 
-#pragma warning(disable : 26812)
+/*
+    Platform independent part of the player: the replay pipeline and the resolution cache. Loading modules and
+    symbolizing addresses is done in callstack-player-<platform>.cpp
+*/
+
+namespace {
+    constexpr auto BATCH_SIZE             = size_t{256};  // events per batch of the replay pipeline
+    constexpr auto MAX_BATCHES_PER_WORKER = 4u;
+
+    // The frames of the tuple flavoured callback, copied out of the resolved ones (the module names are interned
+    // by the player, hence, null-terminated)
+
+    auto to_frames(callstack::player_t::resolved_frames_t _frames) -> callstack::player_t::frames_t {
+        auto ret = callstack::player_t::frames_t{};
+        ret.reserve(_frames.size());
+        for (auto& frame : _frames) {
+            ret.emplace_back(frame.module.data(), wstring(frame.file), frame.line, wstring(frame.symbol), frame.addr);
+        }
+        return ret;
+    }
+
+    auto to_view_callback(const callstack::player_t::callback_t& _cb) -> callstack::player_t::view_callback_t {
+        if (!_cb) {
+            return {};
+        }
+        return [&_cb](uint64_t _timestamp, callstack::player_t::resolved_frames_t _frames) { _cb(_timestamp, to_frames(_frames)); };
+    }
+
+    // The distinct stacks of a replay: the interned ones told apart by id, the rest by their addresses
+
+    struct stack_set_t {
+        vector<callstack::player_t::frames_t> frames;
+        unordered_map<uint32_t, size_t>       interned;
+        map<vector<uintptr_t>, size_t>        plain;
+        vector<uintptr_t>                     addrs;
+
+        auto index_of(callstack::player_t::resolved_frames_t _frames, optional<uint32_t> _id) -> size_t {
+            auto index = frames.size();
+            if (_id) {
+                index = interned.try_emplace(*_id, frames.size()).first->second;
+            } else {
+                addrs.clear();
+                for (auto& frame : _frames) {
+                    addrs.push_back(frame.addr);
+                }
+                index = plain.try_emplace(addrs, frames.size()).first->second;
+            }
+            if (index == frames.size()) {
+                frames.push_back(to_frames(_frames));
+            }
+            return index;
+        }
+    };
+
+    // Adds the distinct stacks to a calling-context tree with their counts, by '_num_workers' threads each one
+    // building a subtree of its own, merged at the end (or by the calling thread if 0)
+
+    void build_profile(callstack::profile_t& _profile, const stack_set_t& _stacks, const vector<uint64_t>& _counts, unsigned _num_workers) {
+        const auto build = [&](callstack::profile_t& _subtree, size_t _first, size_t _step) {
+            for (auto i = _first; i < _counts.size(); i += _step) {
+                if (_counts[i]) {
+                    _subtree.add(_stacks.frames[i], _counts[i]);
+                }
+            }
+        };
+        if (!_num_workers) {
+            build(_profile, 0, 1);
+            return;
+        }
+        auto subtrees = vector<callstack::profile_t>(_num_workers);
+        auto workers  = vector<thread>{};
+        for (auto i = 0u; i < _num_workers; ++i) {
+            workers.emplace_back([&, i] { build(subtrees[i], i, _num_workers); });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        for (auto& subtree : subtrees) {
+            _profile.merge(subtree);
+        }
+    }
+}
+
+auto qcstudio::callstack::player_t::start(const wchar_t* _filename, const callback_t& _cb, unsigned _num_workers) -> bool {
+    return start(_filename, 0, numeric_limits<uint64_t>::max(), to_view_callback(_cb), _num_workers);
+}
+
+auto qcstudio::callstack::player_t::start(const wchar_t* _filename, const view_callback_t& _cb, unsigned _num_workers) -> bool {
+    return start(_filename, 0, numeric_limits<uint64_t>::max(), _cb, _num_workers);
+}
 
-auto qcstudio::callstack::player_t::start(const wchar_t* _filename, const callback_t& _cb) -> bool {
-    // Check parameters
+auto qcstudio::callstack::player_t::start(const wchar_t* _filename, uint64_t _from, uint64_t _to, const callback_t& _cb, unsigned _num_workers) -> bool {
+    return start(_filename, _from, _to, to_view_callback(_cb), _num_workers);
+}
 
-    auto file = ifstream(_filename, ios_base::binary | ios_base::in);
-    if (!file || !_cb) {
+auto qcstudio::callstack::player_t::start(const wchar_t* _filename, uint64_t _from, uint64_t _to, const view_callback_t& _cb, unsigned _num_workers) -> bool {
+    if (!_cb) {
         return false;
     }
+    const auto deliver = [&](const delivered_t& _event, resolved_frames_t _frames) {
+        if (_event.type != recorder_t::event::heap_alloc && _event.type != recorder_t::event::heap_free) {
+            _cb(_event.timestamp, _frames);
+        }
+    };
+    return replay(_filename, origin::file, _from, _to, deliver, _num_workers);
+}
 
-    // Init the DbgHelp library
+auto qcstudio::callstack::player_t::start_live(const wchar_t* _address, const callback_t& _cb, unsigned _num_workers) -> bool {
+    return start_live(_address, to_view_callback(_cb), _num_workers);
+}
 
-    /*
-        == DebgHelp setup ==========
-        Init the library
-        Generate a random id to be used on evary Sym* call
-    */
-    auto old_opt = SymGetOptions();
-    auto opt =
-        (old_opt & ~SYMOPT_DEFERRED_LOADS)  // Load symbols as we load the module
-        | SYMOPT_LOAD_LINES                 // We will be needing the source lines
-        | SYMOPT_IGNORE_NT_SYMPATH          // Ignore _NT_SYMBOL_PATH
-        | SYMOPT_UNDNAME                    // Human readable non-decorated names
-        /* | SYMOPT_DEBUG */
-        ;
-    SymSetOptions(opt);
-
-    id_ = generate_id();
-    if (!SymInitialize((HANDLE)id_, NULL, FALSE)) {
+auto qcstudio::callstack::player_t::start_live(const wchar_t* _address, const view_callback_t& _cb, unsigned _num_workers) -> bool {
+    if (!_cb) {
         return false;
     }
+    const auto deliver = [&](const delivered_t& _event, resolved_frames_t _frames) {
+        if (_event.type != recorder_t::event::heap_alloc && _event.type != recorder_t::event::heap_free) {
+            _cb(_event.timestamp, _frames);
+        }
+    };
+    return replay(_address, origin::live, 0, numeric_limits<uint64_t>::max(), deliver, _num_workers);
+}
+
+auto qcstudio::callstack::player_t::start_shared(const wchar_t* _name, const callback_t& _cb, unsigned _num_workers) -> bool {
+    return start_shared(_name, to_view_callback(_cb), _num_workers);
+}
+
+auto qcstudio::callstack::player_t::start_shared(const wchar_t* _name, const view_callback_t& _cb, unsigned _num_workers) -> bool {
+    if (!_cb) {
+        return false;
+    }
+    const auto deliver = [&](const delivered_t& _event, resolved_frames_t _frames) {
+        if (_event.type != recorder_t::event::heap_alloc && _event.type != recorder_t::event::heap_free) {
+            _cb(_event.timestamp, _frames);
+        }
+    };
+    return replay(_name, origin::shared, 0, numeric_limits<uint64_t>::max(), deliver, _num_workers);
+}
+
+auto qcstudio::callstack::player_t::aggregate(const wchar_t* _filename, profile_t& _profile, unsigned _num_workers, uint64_t _from, uint64_t _to) -> bool {
+    // Count the captures of every distinct stack
+
+    auto       stacks = stack_set_t{};
+    auto       counts = vector<uint64_t>{};
+    const auto count  = [&](const delivered_t& _event, resolved_frames_t _frames) {
+        if (_event.type != recorder_t::event::heap_alloc && _event.type != recorder_t::event::heap_free) {
+            const auto index = stacks.index_of(_frames, _event.id != not_interned ? optional(_event.id) : nullopt);
+            counts.resize(stacks.frames.size());
+            ++counts[index];
+        }
+    };
+    if (!replay(_filename, origin::file, _from, _to, count, _num_workers)) {
+        return false;
+    }
+
+    build_profile(_profile, stacks, counts, _num_workers);
+    return true;
+}
+
+auto qcstudio::callstack::player_t::heap_profile(const wchar_t* _filename, heap_profile_t& _profile, unsigned _num_workers) -> bool {
+    // A sampled allocation stands for bytes / p bytes, p being the probability of sampling it: 1 - e^(-bytes / period)
+
+    auto       stacks    = stack_set_t{};
+    auto       allocated = vector<uint64_t>{};
+    auto       live      = unordered_map<uintptr_t, pair<size_t, uint64_t>>{};  // address -> stack, bytes
+    auto       first     = numeric_limits<uint64_t>::max();
+    auto       last      = uint64_t{0};
+    const auto account   = [&](const delivered_t& _event, resolved_frames_t _frames) {
+        first = min(first, _event.timestamp);
+        last  = max(last, _event.timestamp);
+        if (_event.type == recorder_t::event::heap_alloc) {
+            const auto index    = stacks.index_of(_frames, nullopt);
+            const auto bytes    = (double)_event.bytes;
+            const auto estimate = _event.period ? (uint64_t)llround(bytes / -expm1(-bytes / (double)_event.period)) : _event.bytes;
+            allocated.resize(stacks.frames.size());
+            allocated[index] += estimate;
+            live[_event.address] = {index, estimate};
+        } else if (_event.type == recorder_t::event::heap_free) {
+            live.erase(_event.address);
+        }
+    };
+    if (!replay(_filename, origin::file, 0, numeric_limits<uint64_t>::max(), account, _num_workers)) {
+        return false;
+    }
+
+    auto in_use = vector<uint64_t>(stacks.frames.size());
+    for (auto& [address, allocation] : live) {
+        in_use[allocation.first] += allocation.second;
+    }
+    build_profile(_profile.allocated, stacks, allocated, _num_workers);
+    build_profile(_profile.live, stacks, in_use, _num_workers);
+    _profile.duration = last > first ? last - first : 0;
+    return true;
+}
+
+auto qcstudio::callstack::player_t::replay(const wchar_t* _source, origin _origin, uint64_t _from, uint64_t _to, const delivery_t& _deliver, unsigned _num_workers) -> bool {
+    // Check parameters (a live stream is there once a recorder connects)
+
+    auto reader    = reader_t{};
+    auto live      = live_reader_t{};
+    auto collector = collector_t{};
+    switch (_origin) {
+        case origin::file: {
+            if (!reader.open(_source)) {
+                return false;
+            }
+            break;
+        }
+        case origin::live: {
+            if (!live.accept(_source)) {
+                return false;
+            }
+            break;
+        }
+        case origin::shared: {
+            if (!collector.open(_source)) {
+                return false;
+            }
+            break;
+        }
+    }
+
+    // Init the symbol engine
+
+    if (!init()) {
+        return false;
+    }
+
+    for (auto& shard : cache_) {
+        shard.entries.clear();
+        shard.stats = {};
+    }
 
     /*
         == Module storage ==========
-        We store a map with:
-        - key: a memory range
-        - value: the module information
+        Every load of a module gets an entry in 'modules' and an interval in the timeline, which tells which
+        module owned an address at the time of a capture (so module unloads/reloads never mix up)
 
         note: the recording base addr is the addr of the module when it was recorder whereas the actual one
-              is the one the DbgHelp library requires in order to load the symbols. We store both in this
-              data structure
+              is the handle returned by 'load_module' (on Windows the base address the DbgHelp library requires
+              in order to load the symbols). We store both in this data structure
     */
 
     struct module_info_t {
-        wstring   path;
-        uintptr_t recording_base_addr, actual_base_addr;
-        size_t    size;
+        uintptr_t      recording_base_addr, actual_base_addr;
+        size_t         size;
+        wstring_view   name;  // interned (see 'intern'), as handed to the callback
+    };
+
+    auto modules        = vector<module_info_t>{};
+    auto timeline       = module_timeline_t{};
+    auto loaded_modules = unordered_map<wstring, uint32_t>{};  // path -> module currently loaded from it
+
+    /*
+        == Replay pipeline ==========
+        - decode (this thread): reads the events, keeps the modules up to date and binds every frame to its
+          module, so that the batches of events it produces are self-contained
+        - resolve (workers): symbolizes the frames of a batch (through the resolution cache)
+        - deliver (this thread): calls the callback in recording order as the batches complete
+        Every batch resolves its frames into a buffer of its own that the callback gets a view of, and batches are
+        recycled once delivered, so that a replay allocates nothing per capture once warmed up. Interned stacks ('stack_def') are resolved once and kept by id so that every later 'callstack_ref' is
+        just a lookup at delivery time (those stamped before the requested range too, without calling back).
+        Without workers every batch is resolved right away by this thread. With them, the chunks of chunked
+        recordings are also decoded ahead by the workers, leaving this thread just the module bookkeeping
+    */
+
+    struct frame_t {
+        wstring_view module;     // empty if the address is not inside any module
+        uint64_t     base_addr;  // module handle (see 'load_module')
+        uint64_t     offset;
+        uintptr_t    addr;
     };
 
-    using range_t = pair<uintptr_t, uintptr_t>;
-    auto cmp      = [](const range_t& _left, const range_t& _right) {
-        return _left.second < _right.first;
+    struct job_t {
+        delivered_t event;
+        size_t      first_frame, num_frames;
+        bool        in_range;  // to be delivered
     };
-    auto loaded_modules = map<range_t, module_info_t, decltype(cmp)>(cmp);
-    auto ok             = true;
-    while (ok) {
-        if (auto [event_ok, event, timestamp] = read_event(file); event_ok) {
-            switch (event) {
-                case recorder_t::event::add_module: {
-                    if (auto [ok, path, org_base_addr, size] = read_add_module(file); ok) {
-                        if (auto opt_actual_base_addr = load_module(path, size)) {
-                            const auto addr_range      = range_t{org_base_addr, org_base_addr + size - 1};
-                            loaded_modules[addr_range] = module_info_t{
-                                path,
-                                org_base_addr,
-                                *opt_actual_base_addr,
-                                size,
-                            };
-                        } else {
-                            ok = false;
-                        }
-                    } else {
-                        ok = false;
+
+    struct batch_t {
+        vector<job_t>            jobs;
+        vector<frame_t>          frames;
+        vector<resolved_frame_t> resolved;  // one per frame
+
+        void clear() {
+            jobs.clear();
+            frames.clear();
+            resolved.clear();
+        }
+    };
+
+    const auto resolve_batch = [&](batch_t& _batch) {
+        _batch.resolved.resize(_batch.frames.size());
+        for (auto f = 0u; f < _batch.frames.size(); ++f) {
+            auto& frame = _batch.frames[f];
+            if (!frame.module.empty()) {
+                auto& resolution   = resolve(frame.base_addr, frame.offset);
+                _batch.resolved[f] = {frame.module, resolution.file, resolution.line, resolution.symbol, frame.addr};
+            } else {
+                _batch.resolved[f] = {L"", L"", -1, L"", frame.addr};
+            }
+        }
+    };
+
+    auto       interned_stacks = map<uint32_t, vector<resolved_frame_t>>{};
+    const auto deliver_batch   = [&](batch_t& _batch) {
+        for (auto& job : _batch.jobs) {
+            const auto frames = resolved_frames_t{_batch.resolved.data() + job.first_frame, job.num_frames};
+            switch (job.event.type) {
+                case recorder_t::event::stack_def: {
+                    auto& resolved = interned_stacks[job.event.id];
+                    resolved.assign(frames.begin(), frames.end());
+                    if (job.in_range) {
+                        _deliver(job.event, {resolved.data(), resolved.size()});
                     }
                     break;
                 }
-                case recorder_t::event::del_module: {
-                    if (auto [ok, path] = read_del_module(file); ok) {
-                        for (auto& [k, v] : loaded_modules) {
-                            if (v.path == path) {
-                                loaded_modules.erase(k);
-                                break;
-                            }
-                        }
-                    } else {
-                        ok = false;
+                case recorder_t::event::callstack_ref: {
+                    if (auto it = interned_stacks.find(job.event.id); it != interned_stacks.end()) {
+                        _deliver(job.event, {it->second.data(), it->second.size()});
                     }
                     break;
                 }
-                case recorder_t::event::callstack: {
-                    auto resolved_callstack = vector<tuple<const wchar_t*, wstring, int, wstring, uintptr_t>>{};
-                    for (auto abs_addr : read_callstack(file)) {
-                        const auto endit = loaded_modules.end();
-                        if (auto it_module = loaded_modules.find({abs_addr, abs_addr}); it_module != endit) {
-                            auto offset               = abs_addr - it_module->second.recording_base_addr;
-                            auto [file, line, symbol] = resolve(it_module->second.actual_base_addr, offset);
-                            resolved_callstack.emplace_back(it_module->second.path.c_str(), file, line, symbol, (uintptr_t)abs_addr);
-                        } else {
-                            resolved_callstack.emplace_back(L"", nullptr, -1, wstring{}, (uintptr_t)abs_addr);
-                        }
-                    }
-                    if (ok) {
-                        _cb(timestamp, resolved_callstack);
-                    }
+                default: {
+                    _deliver(job.event, frames);
                     break;
                 }
             }
-        } else {
-            break;
         }
     };
 
-    return true;
-}
+    // Chunks decoded ahead: their events with the frames copied out of the reader
 
-auto qcstudio::callstack::player_t::read_event(ifstream& _file) -> tuple<bool, qcstudio::callstack::recorder_t::event, uint64_t> {
-    auto op = read<recorder_t::event>(_file);
-    auto t  = read<uint64_t>(_file);
-    if (op && t) {
-        return {true, *op, *t};
-    }
-    return {};
-}
+    struct decoded_t {
+        vector<event_t>   events;
+        vector<uintptr_t> frames;  // of all the events, one after the other
+        vector<uint8_t>   buffer;  // decompressed chunk (the paths point here)
+        bool              valid;   // false if the chunk is corrupt or truncated (the events before that are kept)
+    };
 
-auto qcstudio::callstack::player_t::read_add_module(ifstream& _file)
-    -> tuple<bool, wstring, uint64_t, uint32_t> {
-    auto buffer = array<wchar_t, 1024>{};
-    if (auto opt_len = read<uint16_t>(_file)) {
-        if (_file.read((char*)buffer.data(), *opt_len * sizeof(wchar_t))) {
-            auto opt_base_ptr = read<uintptr_t>(_file);
-            auto opt_size     = read<uint32_t>(_file);
-            if (opt_base_ptr && opt_size) {
-                return {
-                    true, wstring(buffer.data(), *opt_len),
-                    *opt_base_ptr,
-                    *opt_size};
+    const auto decode_chunk = [&](size_t _chunk, decoded_t& _decoded) {
+        _decoded.valid = reader.read_chunk(_chunk, _decoded.buffer, [&](event_t& _event) {
+            _decoded.events.push_back(_event);
+            for (auto addr : _event.frames) {
+                _decoded.frames.push_back(addr);
             }
+            return true;
+        });
+        auto offset = size_t{0};
+        for (auto& event : _decoded.events) {
+            const auto count = (uint16_t)event.frames.size();
+            event.frames     = {(const uint8_t*)(_decoded.frames.data() + offset), count};
+            offset += count;
         }
+    };
+
+    // Workers take batches in order from 'pending' and leave them in 'completed' under their sequence number.
+    // When there are none they decode the chunks in 'to_decode' into 'decoded' (by chunk index). Delivered
+    // batches wait in 'spare' to be filled again
+
+    auto lock          = std::mutex{};
+    auto work_ready    = condition_variable{};
+    auto batch_ready   = condition_variable{};
+    auto chunk_ready   = condition_variable{};
+    auto pending       = deque<pair<uint64_t, unique_ptr<batch_t>>>{};
+    auto completed     = map<uint64_t, unique_ptr<batch_t>>{};
+    auto spare         = vector<unique_ptr<batch_t>>{};
+    auto to_decode     = deque<size_t>{};
+    auto decoded       = map<size_t, unique_ptr<decoded_t>>{};
+    auto finished      = false;
+    auto num_batches   = uint64_t{0};
+    auto num_delivered = uint64_t{0};
+    auto workers       = vector<thread>{};
+    for (auto i = 0u; i < _num_workers; ++i) {
+        workers.emplace_back([&] {
+            auto guard = unique_lock(lock);
+            for (;;) {
+                work_ready.wait(guard, [&] { return finished || !pending.empty() || !to_decode.empty(); });
+                if (!pending.empty()) {
+                    auto [seq, batch] = move(pending.front());
+                    pending.pop_front();
+                    guard.unlock();
+
+                    resolve_batch(*batch);
+
+                    guard.lock();
+                    completed.emplace(seq, move(batch));
+                    batch_ready.notify_one();
+                } else if (!to_decode.empty()) {
+                    const auto chunk = to_decode.front();
+                    to_decode.pop_front();
+                    guard.unlock();
+
+                    auto result = make_unique<decoded_t>();
+                    decode_chunk(chunk, *result);
+
+                    guard.lock();
+                    decoded.emplace(chunk, move(result));
+                    chunk_ready.notify_one();
+                } else {
+                    return;
+                }
+            }
+        });
     }
-    return {};
-}
 
-auto qcstudio::callstack::player_t::read_del_module(ifstream& _file)
-    -> tuple<bool, wstring> {
-    auto buffer = array<wchar_t, 1024>{};
-    if (auto opt_len = read<uint16_t>(_file)) {
-        if (_file.read((char*)buffer.data(), *opt_len * sizeof(wchar_t))) {
-            return {true, wstring(buffer.data(), *opt_len)};
+    // Deliver the completed batches that are next in order, waiting for as many as needed to leave no more
+    // than '_max_in_flight' batches in the pipeline
+
+    const auto deliver = [&](uint64_t _max_in_flight) {
+        auto guard = unique_lock(lock);
+        for (;;) {
+            if (auto it = completed.find(num_delivered); it != completed.end()) {
+                auto ready = move(it->second);
+                completed.erase(it);
+                guard.unlock();
+
+                deliver_batch(*ready);
+                ready->clear();
+
+                guard.lock();
+                spare.push_back(move(ready));
+                ++num_delivered;
+            } else if (num_batches - num_delivered > _max_in_flight) {
+                batch_ready.wait(guard);
+            } else {
+                return;
+            }
         }
-    }
-    return {};
-}
+    };
+
+    auto       batch  = make_unique<batch_t>();
+    const auto submit = [&] {
+        if (batch->jobs.empty()) {
+            return;
+        }
+        if (workers.empty()) {
+            resolve_batch(*batch);
+            deliver_batch(*batch);
+            batch->clear();
+            return;
+        }
+        {
+            auto guard = std::lock_guard(lock);
+            pending.emplace_back(num_batches++, move(batch));
+            if (!spare.empty()) {
+                batch = move(spare.back());
+                spare.pop_back();
+            }
+        }
+        work_ready.notify_one();
+        if (!batch) {
+            batch = make_unique<batch_t>();
+        }
+
+        // Bound the batches in flight (and the memory) by the number of workers
 
-auto qcstudio::callstack::player_t::read_callstack(ifstream& _file)
-    -> vector<uintptr_t> {
-    auto ret = vector<uintptr_t>{};
-    if (auto num = read<uint16_t>(_file)) {
-        ret.resize(*num);
-        if (_file.read((char*)ret.data(), *num * sizeof(uintptr_t))) {
-            return ret;
+        deliver(MAX_BATCHES_PER_WORKER * workers.size());
+    };
+
+    // Decode
+
+    auto       addrs   = vector<uint64_t>{};
+    auto       owners  = vector<uint32_t>{};
+    const auto add_job = [&](const event_t& _event) {
+        const auto in_range = _event.timestamp >= _from && _event.timestamp < _to;
+        if (!in_range && _event.type != recorder_t::event::stack_def) {
+            return;
+        }
+        const auto interned = _event.type == recorder_t::event::stack_def || _event.type == recorder_t::event::callstack_ref;
+        const auto job      = job_t{{_event.type, _event.timestamp, interned ? _event.id : not_interned, _event.address, _event.bytes, _event.period}, batch->frames.size(), _event.frames.size(), in_range};
+        addrs.clear();
+        for (auto abs_addr : _event.frames) {
+            addrs.push_back(abs_addr);
+        }
+        owners.resize(addrs.size());
+        timeline.find(addrs.data(), addrs.size(), _event.timestamp, owners.data());
+        for (auto i = 0u; i < addrs.size(); ++i) {
+            if (owners[i] != module_timeline_t::none) {
+                const auto& module = modules[owners[i]];
+                batch->frames.push_back({module.name, module.actual_base_addr, addrs[i] - module.recording_base_addr, (uintptr_t)addrs[i]});
+            } else {
+                batch->frames.push_back({{}, 0, 0, (uintptr_t)addrs[i]});
+            }
+        }
+        batch->jobs.push_back(job);
+        if (batch->jobs.size() == BATCH_SIZE) {
+            submit();
+        }
+    };
+
+    // Recordings stamped with CPU ticks carry calibration events (see recorder_t::time_source) to turn them
+    // into nanoseconds
+
+    auto       timebase = format::timebase_t{};
+    const auto process  = [&](event_t& _event) -> bool {
+        if (_event.type == recorder_t::event::calibration) {
+            timebase.calibrate((int64_t)_event.timestamp, _event.wall_time, _event.frequency);
+        }
+        _event.timestamp = (uint64_t)timebase.to_ns((int64_t)_event.timestamp);
+
+        auto ok = true;
+        switch (_event.type) {
+            case recorder_t::event::add_module: {
+                // Every chunk of a chunked recording restates the modules loaded at the time
+
+                const auto path = _event.path.str();
+                if (auto it = loaded_modules.find(path); it != loaded_modules.end() && modules[it->second].recording_base_addr == _event.base_addr && modules[it->second].size == _event.size) {
+                    break;
+                }
+                if (auto opt_actual_base_addr = load_module(path, _event.size)) {
+                    const auto id = (uint32_t)modules.size();
+                    modules.push_back({_event.base_addr, *opt_actual_base_addr, _event.size, intern(wstring(path))});
+                    timeline.add(_event.base_addr, _event.size, _event.timestamp, id);
+                    loaded_modules[path] = id;
+                } else {
+                    ok = false;
+                }
+                break;
+            }
+            case recorder_t::event::del_module: {
+                if (auto it = loaded_modules.find(_event.path.str()); it != loaded_modules.end()) {
+                    timeline.remove(modules[it->second].recording_base_addr, it->second, _event.timestamp);
+                    loaded_modules.erase(it);
+                }
+                break;
+            }
+            case recorder_t::event::callstack:
+            case recorder_t::event::stack_def:
+            case recorder_t::event::callstack_ref:
+            case recorder_t::event::heap_alloc:
+            case recorder_t::event::heap_free: {
+                add_job(_event);
+                break;
+            }
+            case recorder_t::event::calibration:
+            case recorder_t::event::telemetry: {
+                break;
+            }
+        }
+        return ok;
+    };
+
+    // Decode the live stream or the collected events as they come, or the whole recording, or just the chunks
+    // overlapping the range (self-contained, so starting from any of them is fine). A module that cannot be
+    // loaded or a corrupt chunk stops it: what was decoded until then is still delivered, but the replay fails
+
+    auto        ok     = true;
+    const auto& chunks = reader.chunks();
+    if (_origin == origin::live) {
+        // Every chunk is delivered as soon as it is resolved, rather than waiting for more events
+
+        while (ok && live.read_chunk([&](event_t& _event) { return ok = process(_event); })) {
+            submit();
+            deliver(0);
+        }
+    } else if (_origin == origin::shared) {
+        // Ditto for every pass of the collector
+
+        while (ok && collector.next([&](event_t& _event) { return ok = process(_event); })) {
+            submit();
+            deliver(0);
+        }
+    } else if (chunks.empty()) {
+        for (auto event = event_t{}; ok && reader.next(event);) {
+            ok = process(event);
+        }
+    } else {
+        const auto from  = (int64_t)min<uint64_t>(_from, numeric_limits<int64_t>::max());
+        const auto to    = (int64_t)min<uint64_t>(_to, numeric_limits<int64_t>::max());
+        auto       first = chunks.size(), last = size_t{0};
+        for (auto i = 0u; i < chunks.size(); ++i) {
+            if (chunks[i].last >= from && chunks[i].first < to) {
+                first = min<size_t>(first, i);
+                last  = i + 1;
+            }
+        }
+
+        if (workers.empty()) {
+            auto buffer = vector<uint8_t>{};
+            for (auto i = first; ok && i < last; ++i) {
+                ok = reader.read_chunk(i, buffer, [&](event_t& _event) { return ok = process(_event); }) && ok;
+            }
+        } else {
+            // A few chunks ahead of the one being processed
+
+            const auto lookahead = 2 * workers.size();
+            auto       next      = first;
+            for (auto i = first; ok && i < last; ++i) {
+                auto chunk = unique_ptr<decoded_t>{};
+                {
+                    auto guard = unique_lock(lock);
+                    for (; next < last && next < i + lookahead; ++next) {
+                        to_decode.push_back(next);
+                    }
+                    work_ready.notify_all();
+                    chunk_ready.wait(guard, [&] { return decoded.count(i) != 0; });
+                    chunk = move(decoded[i]);
+                    decoded.erase(i);
+                }
+                for (auto& event : chunk->events) {
+                    if (!(ok = process(event))) {
+                        break;
+                    }
+                }
+                ok = ok && chunk->valid;
+            }
         }
     }
-    return {};
-}
 
-auto qcstudio::callstack::player_t::load_module(const std::wstring& _filepath, size_t _size) -> optional<uint64_t> {
-    if (auto ret = SymLoadModuleExW((HANDLE)id_, NULL, _filepath.c_str(), NULL, last_base_addr_, (DWORD)_size, NULL, 0); ret) {
-        last_base_addr_ += _size;
-        return (uint64_t)ret;
+    // Drain the pipeline
+
+    submit();
+    deliver(0);
+    {
+        auto guard = std::lock_guard(lock);
+        finished   = true;
+        to_decode.clear();
+    }
+    work_ready.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
     }
-    return {};
+
+    return ok;
 }
 
-auto qcstudio::callstack::player_t::end() -> bool {
-    return SymCleanup((HANDLE)id_);
+auto qcstudio::callstack::player_t::cache_stats() const -> cache_stats_t {
+    auto ret = cache_stats_t{};
+    for (auto& shard : cache_) {
+        ret.hits += shard.stats.hits;
+        ret.misses += shard.stats.misses;
+    }
+    return ret;
 }
 
-auto qcstudio::callstack::player_t::resolve(uint64_t _baseaddr, uint64_t _addroffset)
-    -> tuple<wstring, int, wstring> {
-    auto index = DWORD64{};
-    struct {
-        SYMBOL_INFOW  sym;
-        unsigned char name[256];
-    } user_symbol;
-    user_symbol.sym.SizeOfStruct = sizeof(user_symbol.sym);
-    user_symbol.sym.MaxNameLen   = sizeof(user_symbol.name);
-    auto addr                    = (DWORD64)(_baseaddr + _addroffset);
-    if (SymFromAddrW((HANDLE)id_, addr, &index, &user_symbol.sym)) {
-        auto line         = IMAGEHLP_LINEW64{};
-        auto offset       = DWORD{0};
-        line.SizeOfStruct = sizeof(line);
-        if (SymGetLineFromAddrW64((HANDLE)id_, addr, &offset, &line)) {
-            return {line.FileName, line.LineNumber, wstring(user_symbol.sym.Name)};
-        } else {
-            return {L"", -1, wstring(user_symbol.sym.Name)};
+auto qcstudio::callstack::player_t::resolve(uint64_t _baseaddr, uint64_t _addroffset) -> const resolution_t& {
+    // Shared by the replay workers (entries and strings are never moved once inserted). The shard is taken from
+    // the top bits of the key scrambled once more, as the bottom ones of its hash pick the bucket in the shard
+
+    const auto key   = pair{_baseaddr, _addroffset};
+    auto&      shard = cache_[((uint64_t)cache_key_hash_t{}(key) * 0x9e3779b97f4a7c15ull) >> 58];  // 6 bits, 64 shards
+    static_assert(cache_shards == 64);
+    {
+        auto guard = std::lock_guard(shard.lock);
+        if (auto it = shard.entries.find(key); it != shard.entries.end()) {
+            ++shard.stats.hits;
+            return it->second;
         }
     }
-    return {};
+
+    auto [file, line, symbol] = symbolize(_baseaddr, _addroffset);
+    const auto file_view      = intern(move(file));
+    const auto symbol_view    = intern(move(symbol));
+
+    auto guard          = std::lock_guard(shard.lock);
+    auto [it, inserted] = shard.entries.try_emplace(key);
+    if (inserted) {
+        ++shard.stats.misses;
+        it->second = {file_view, line, symbol_view};
+    } else {
+        ++shard.stats.hits;  // another worker got there first
+    }
+    return it->second;
 }
 
-auto qcstudio::callstack::player_t::generate_id() const -> uint64_t {
-    const auto high_id = (uint32_t)crc32::from_string(misc::uuid().str().c_str());
-    const auto low_id  = (uint32_t)crc32::from_string(misc::uuid().str().c_str());
-    return ((uint64_t)high_id << 32) | low_id;
+auto qcstudio::callstack::player_t::intern(wstring&& _string) -> wstring_view {
+    // Nodes never move, hence, the views stay valid as the table grows
+
+    auto guard = std::lock_guard(strings_lock_);
+    return *strings_.insert(move(_string)).first;
 }
@@ -21,7 +21,6 @@
     OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
     SOFTWARE.
 */
-
 #pragma once
 
 // QCStudio
@@ -32,14 +31,24 @@
 
 #include <functional>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <mutex>
 #include <optional>
-
-#pragma warning(disable : 4251)
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+
+#if defined(_MSC_VER)
+#    pragma warning(disable : 4251)
+#endif
 #pragma push_macro("QCS_API")
 #undef QCS_API
-#if defined(BUILDING_QCSTUDIO)
+#if !defined(_WIN32)
+#    define QCS_API __attribute__((visibility("default")))
+#elif defined(BUILDING_QCSTUDIO)
 #    define QCS_API __declspec(dllexport)
 #else
 #    define QCS_API __declspec(dllimport)
@@ -53,51 +62,186 @@ namespace qcstudio::callstack {
 
     using namespace std;
 
+    class profile_t;
+    struct heap_profile_t;
+
     // Manager designed to be at global scope and initialize
 
     class QCS_API player_t {
     public:
-        // callback with a vector of tuples (module_name, file_name, line, symbol, addr)
-        using callback_t = function<void(uint64_t, vector<tuple<const wchar_t*, wstring, int, wstring, uintptr_t>>)>;
+        player_t();
+        ~player_t();
 
-        auto start(const wchar_t* _filename, const callback_t& _cb) -> bool;
+        // callback with a vector of tuples (module_name, file_name, line, symbol, addr)
+        using frames_t   = vector<tuple<const wchar_t*, wstring, int, wstring, uintptr_t>>;
+        using callback_t = function<void(uint64_t, frames_t)>;
+
+        // Alternative callback that allocates nothing per capture: the frames are a view over the player's own
+        // buffers, only valid during the call, and the strings are views into its interned string table, valid (and
+        // null-terminated) for the lifetime of the player. Empty strings for frames outside any module
+
+        struct resolved_frame_t {
+            wstring_view module;
+            wstring_view file;
+            int          line;  // -1 if unknown
+            wstring_view symbol;
+            uintptr_t    addr;
+        };
+
+        class resolved_frames_t {
+        public:
+            resolved_frames_t() = default;
+            resolved_frames_t(const resolved_frame_t* _data, size_t _size) : data_(_data), size_(_size) {}
+
+            auto size() const -> size_t {
+                return size_;
+            }
+            auto empty() const -> bool {
+                return !size_;
+            }
+            auto operator[](size_t _index) const -> const resolved_frame_t& {
+                return data_[_index];
+            }
+            auto begin() const -> const resolved_frame_t* {
+                return data_;
+            }
+            auto end() const -> const resolved_frame_t* {
+                return data_ + size_;
+            }
+
+        private:
+            const resolved_frame_t* data_ = nullptr;
+            size_t                  size_ = 0;
+        };
+
+        using view_callback_t = function<void(uint64_t, resolved_frames_t)>;
+
+        // '_num_workers' threads resolve the call stacks while the events are being read (0: all in the calling
+        // thread). Either way the callback is only called from the calling thread and in recording order. False if
+        // the recording cannot be opened, a module cannot be loaded or a chunk is corrupt (the captures before that
+        // are delivered anyway)
+
+        auto start(const wchar_t* _filename, const callback_t& _cb, unsigned _num_workers = 0) -> bool;
+        auto start(const wchar_t* _filename, const view_callback_t& _cb, unsigned _num_workers = 0) -> bool;
+
+        // Same, only for the captures stamped within [_from, _to) (nanoseconds). Only the chunks of the recording
+        // overlapping that range are decoded (chunked recordings, see callstack-format.h), by the workers if any
+
+        auto start(const wchar_t* _filename, uint64_t _from, uint64_t _to, const callback_t& _cb, unsigned _num_workers = 0) -> bool;
+        auto start(const wchar_t* _filename, uint64_t _from, uint64_t _to, const view_callback_t& _cb, unsigned _num_workers = 0) -> bool;
+
+        // Same, for a live stream (see recorder_t::start_live_streaming): waits for a recorder to connect to
+        // '_address' and calls back for its captures as they arrive, every chunk as soon as it is resolved, until
+        // the recorder stops streaming
+
+        auto start_live(const wchar_t* _address, const callback_t& _cb, unsigned _num_workers = 0) -> bool;
+        auto start_live(const wchar_t* _address, const view_callback_t& _cb, unsigned _num_workers = 0) -> bool;
+
+        // Same, for a recorder in shared mode (see recorder_t::start_sharing) through a collector (see collector_t):
+        // calls back for its captures pass after pass until the recorder stops sharing. False if no recorder is
+        // sharing as '_name'
+
+        auto start_shared(const wchar_t* _name, const callback_t& _cb, unsigned _num_workers = 0) -> bool;
+        auto start_shared(const wchar_t* _name, const view_callback_t& _cb, unsigned _num_workers = 0) -> bool;
         auto end() -> bool;
 
+        // Adds the captures within [_from, _to) to a calling-context tree instead of calling back for each one.
+        // Every distinct stack is resolved once; the tree is built from them by '_num_workers' threads (each one
+        // a subtree of its own, merged at the end), or by the calling thread if 0
+
+        auto aggregate(const wchar_t* _filename, profile_t& _profile, unsigned _num_workers = 0, uint64_t _from = 0, uint64_t _to = ~0ull) -> bool;
+
+        // Heap profile of a recording with heap sampling (see recorder_t::start_heap_sampling): the bytes allocated
+        // and the ones still allocated at the end of the recording by call path, estimated from the samples
+
+        auto heap_profile(const wchar_t* _filename, heap_profile_t& _profile, unsigned _num_workers = 0) -> bool;
+
+        // address resolution cache statistics (of the last 'start')
+
+        struct cache_stats_t {
+            uint64_t hits   = 0;
+            uint64_t misses = 0;  // i.e. unique addresses
+        };
+
+        auto cache_stats() const -> cache_stats_t;
+
     private:
 
-        uint8_t*   buffer_         = nullptr;
-        uint64_t   id_             = 0xffFFffFF'ffFFffFF;
-        uint64_t   last_base_addr_ = 0x1'00000000u;
-        size_t     cursor_         = -1;
-        std::mutex lock_;
+        // Replay shared by 'start', 'aggregate' and 'heap_profile': the captures and the heap events with their
+        // resolved frames (none for 'heap_free')
+
+        static constexpr auto not_interned = ~uint32_t{0};
+
+        struct delivered_t {
+            recorder_t::event type;  // callstack, stack_def, callstack_ref, heap_alloc or heap_free
+            uint64_t          timestamp;
+            uint32_t          id;       // of interned stacks, 'not_interned' otherwise
+            uintptr_t         address;  // heap events
+            uint64_t          bytes;    // heap_alloc
+            uint64_t          period;   // heap_alloc
+        };
 
-        template<typename T>
-        auto read(ifstream& _file) -> optional<T>;
+        using delivery_t = function<void(const delivered_t&, resolved_frames_t)>;
 
-        auto read_event(ifstream& _file) -> tuple<bool, qcstudio::callstack::recorder_t::event, uint64_t>;
-        auto read_add_module(ifstream& _file) -> tuple<bool, wstring, uint64_t, uint32_t>;
-        auto read_del_module(ifstream& _file) -> tuple<bool, wstring>;
-        auto read_callstack(ifstream& _file) -> vector<uintptr_t>;
+        enum class origin : uint8_t {
+            file,
+            live,    // '_source' is an address (see start_live)
+            shared,  // '_source' is the name of the shared memory (see start_shared)
+        };
 
-        // module related
+        auto replay(const wchar_t* _source, origin _origin, uint64_t _from, uint64_t _to, const delivery_t& _deliver, unsigned _num_workers) -> bool;
 
+        std::mutex strings_lock_;  // interned strings
+
+        // module related (platform specific, see callstack-player-<platform>.cpp). On Windows symbols come from
+        // DbgHelp, elsewhere from our own ELF/DWARF index (see symbol-index.h)
+
+        struct symbolizer_t;
+
+        unique_ptr<symbolizer_t> symbolizer_;
+
+        auto init() -> bool;
         auto load_module(const std::wstring& _filepath, size_t _size) -> optional<uint64_t>;
-        auto resolve(uint64_t _baseaddr, uint64_t _addroffset) ->
+        auto symbolize(uint64_t _baseaddr, uint64_t _addroffset) ->
             /* file path, line, symbol*/
             tuple<wstring, int, wstring>;
 
-        // utils
-
-        auto generate_id() const -> uint64_t;
+        // resolution cache
+        //
+        // Keyed by (module handle, offset). Handles (the base addresses handed to DbgHelp, the module indices
+        // elsewhere) are never reused while playing, hence, entries never go stale. Strings are interned so that an entry is just a couple of views.
+        // Unlike the cache, which starts over with every replay, the interned strings (module paths too) stay until
+        // the player goes away: the views handed to a 'view_callback_t' point there. The replay workers hit the
+        // cache for almost every frame, hence, it is split in shards by key, each one with its own lock (and cache
+        // line), so that they seldom wait for each other
+
+        struct resolution_t {
+            wstring_view file;
+            int          line;
+            wstring_view symbol;
+        };
+
+        struct cache_key_hash_t {
+            auto operator()(const pair<uint64_t, uint64_t>& _key) const -> size_t {
+                return hash<uint64_t>{}(_key.first * 0x9e3779b97f4a7c15ull ^ _key.second);
+            }
+        };
+
+        static constexpr auto cache_shards = size_t{64};
+
+        struct alignas(64) cache_shard_t {
+            std::mutex                                                                lock;
+            unordered_map<pair<uint64_t, uint64_t>, resolution_t, cache_key_hash_t> entries;
+            cache_stats_t                                                             stats;
+        };
+
+        array<cache_shard_t, cache_shards> cache_;
+        unordered_set<wstring>             strings_;
+
+        auto resolve(uint64_t _baseaddr, uint64_t _addroffset) -> const resolution_t&;
+        auto intern(wstring&& _string) -> wstring_view;
     };
 
 }  // namespace qcstudio::callstack
 
-template<typename T>
-inline auto qcstudio::callstack::player_t::read(ifstream& _file) -> optional<T> {
-    T ret;
-    if (_file.read((char*)&ret, sizeof(ret))) {
-        return ret;
-    }
-    return {};
-}
\ No newline at end of file
+#pragma pop_macro("QCS_API")
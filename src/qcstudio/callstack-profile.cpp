@@ -0,0 +1,151 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Us
+
+#include "callstack-profile.h"
+
+// C++
+
+#include <algorithm>
+#include <filesystem>
+#include <ostream>
+#include <cwchar>
+
+using namespace std;
+
+namespace {
+    // Symbol of a frame, or "module!0xaddress" when it could not be resolved
+
+    auto name_of(const tuple<const wchar_t*, wstring, int, wstring, uintptr_t>& _frame) -> wstring {
+        const auto& [module, file, line, symbol, addr] = _frame;
+        if (!symbol.empty()) {
+            return symbol;
+        }
+        wchar_t hex[32];
+        swprintf(hex, 32, L"0x%llx", (unsigned long long)addr);
+        return module && *module ? filesystem::path(module).filename().wstring() + L"!" + hex : wstring(hex);
+    }
+}  // namespace
+
+qcstudio::callstack::profile_t::profile_t() {
+    clear();
+}
+
+void qcstudio::callstack::profile_t::clear() {
+    nodes_.assign(1, node_t{nullptr, 0, 0, 0, {}});
+    names_.clear();
+}
+
+auto qcstudio::callstack::profile_t::total() const -> uint64_t {
+    return nodes_[0].inclusive;
+}
+
+auto qcstudio::callstack::profile_t::child(uint32_t _parent, const wstring& _name) -> uint32_t {
+    const auto name = &*names_.insert(_name).first;
+    if (auto it = nodes_[_parent].children.find(name); it != nodes_[_parent].children.end()) {
+        return it->second;
+    }
+    const auto id = (uint32_t)nodes_.size();
+    nodes_.push_back({name, _parent, 0, 0, {}});  // (invalidates references to the nodes)
+    nodes_[_parent].children.emplace(name, id);
+    return id;
+}
+
+void qcstudio::callstack::profile_t::add(const player_t::frames_t& _frames, uint64_t _count) {
+    auto node = uint32_t{0};
+    nodes_[node].inclusive += _count;
+    for (auto it = _frames.rbegin(); it != _frames.rend(); ++it) {
+        node = child(node, name_of(*it));
+        nodes_[node].inclusive += _count;
+    }
+    nodes_[node].exclusive += _count;
+}
+
+void qcstudio::callstack::profile_t::merge(const profile_t& _other) {
+    merge(_other, 0, 0);
+}
+
+void qcstudio::callstack::profile_t::merge(const profile_t& _other, uint32_t _from, uint32_t _to) {
+    nodes_[_to].inclusive += _other.nodes_[_from].inclusive;
+    nodes_[_to].exclusive += _other.nodes_[_from].exclusive;
+    for (auto [name, other_child] : _other.nodes_[_from].children) {
+        merge(_other, other_child, child(_to, *name));
+    }
+}
+
+auto qcstudio::callstack::profile_t::path_of(uint32_t _node) const -> vector<wstring> {
+    auto path = vector<wstring>{};
+    for (; _node; _node = nodes_[_node].parent) {
+        path.push_back(*nodes_[_node].name);
+    }
+    reverse(path.begin(), path.end());
+    return path;
+}
+
+void qcstudio::callstack::profile_t::write_folded(wostream& _out) const {
+    // Depth first, children in name order so that the output does not depend on the order of the captures
+
+    auto       path  = wstring{};
+    const auto visit = [&](const auto& _self, uint32_t _node) -> void {
+        const auto& node   = nodes_[_node];
+        const auto  length = path.size();
+        if (_node) {
+            if (!path.empty()) {
+                path += L';';
+            }
+            path += *node.name;
+            if (node.exclusive) {
+                _out << path << L' ' << node.exclusive << L'\n';
+            }
+        }
+
+        auto children = vector<pair<const wstring*, uint32_t>>(node.children.begin(), node.children.end());
+        sort(children.begin(), children.end(), [](const auto& _a, const auto& _b) { return *_a.first < *_b.first; });
+        for (auto& [name, child] : children) {
+            _self(_self, child);
+        }
+        path.resize(length);
+    };
+    visit(visit, 0);
+}
+
+auto qcstudio::callstack::profile_t::hottest(size_t _count) const -> vector<path_t> {
+    auto candidates = vector<uint32_t>{};
+    for (auto i = 1u; i < nodes_.size(); ++i) {
+        if (nodes_[i].exclusive) {
+            candidates.push_back(i);
+        }
+    }
+    _count = min(_count, candidates.size());
+    partial_sort(candidates.begin(), candidates.begin() + _count, candidates.end(), [&](uint32_t _a, uint32_t _b) {
+        return nodes_[_a].exclusive != nodes_[_b].exclusive ? nodes_[_a].exclusive > nodes_[_b].exclusive : _a < _b;
+    });
+
+    auto paths = vector<path_t>{};
+    for (auto i = 0u; i < _count; ++i) {
+        paths.push_back({path_of(candidates[i]), nodes_[candidates[i]].inclusive, nodes_[candidates[i]].exclusive});
+    }
+    return paths;
+}
@@ -0,0 +1,114 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+// QCStudio
+
+#include "callstack-player.h"
+
+// C++
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(_MSC_VER)
+#    pragma warning(disable : 4251)
+#endif
+#pragma push_macro("QCS_API")
+#undef QCS_API
+#if !defined(_WIN32)
+#    define QCS_API __attribute__((visibility("default")))
+#elif defined(BUILDING_QCSTUDIO)
+#    define QCS_API __declspec(dllexport)
+#else
+#    define QCS_API __declspec(dllimport)
+#endif
+
+/*
+    Calling-context tree.
+    The captures of a recording aggregated by call path: every node is a function reached through a given
+    sequence of callers, with the captures that went through it (inclusive) and those that stopped at it
+    (exclusive). Functions are told apart by their symbol, or by module and address when there is none. Trees
+    built separately (e.g. by different threads) merge into one
+*/
+
+namespace qcstudio::callstack {
+
+    using namespace std;
+
+    class QCS_API profile_t {
+    public:
+        profile_t();
+
+        void add(const player_t::frames_t& _frames, uint64_t _count = 1);  // leaf first, as delivered by player_t
+        void merge(const profile_t& _other);
+        void clear();
+
+        auto total() const -> uint64_t;
+
+        // Folded stacks (flamegraph.pl input): one line per call path with exclusive captures, "root;...;leaf count"
+
+        void write_folded(wostream& _out) const;
+
+        // The '_count' call paths with the most exclusive captures, hottest first
+
+        struct path_t {
+            vector<wstring> frames;  // root first
+            uint64_t        inclusive, exclusive;
+        };
+
+        auto hottest(size_t _count) const -> vector<path_t>;
+
+    private:
+        struct node_t {
+            const wstring*                           name;  // nullptr for the root
+            uint32_t                                 parent;
+            uint64_t                                 inclusive, exclusive;
+            unordered_map<const wstring*, uint32_t> children;
+        };
+
+        vector<node_t>         nodes_;  // the root first
+        unordered_set<wstring> names_;  // interned frame names
+
+        auto child(uint32_t _parent, const wstring& _name) -> uint32_t;
+        void merge(const profile_t& _other, uint32_t _from, uint32_t _to);
+        auto path_of(uint32_t _node) const -> vector<wstring>;
+    };
+
+    // Heap profile (see player_t::heap_profile), in bytes
+
+    struct heap_profile_t {
+        profile_t allocated;     // by call path over the recording (over 'duration': allocation rates)
+        profile_t live;          // by call path, still allocated at the end of the recording
+        uint64_t  duration = 0;  // ns from the first to the last event
+    };
+
+}  // namespace qcstudio::callstack
+
+#pragma pop_macro("QCS_API")
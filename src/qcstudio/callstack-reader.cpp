@@ -0,0 +1,555 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Own
+
+#include "callstack-reader.h"
+#include "callstack-format.h"
+#include "lz.h"
+
+// C++
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <limits>
+#include <type_traits>
+#include <tuple>
+
+using namespace std;
+
+auto qcstudio::callstack::reader_t::open(const wchar_t* _filename) -> bool {
+    close();
+    if (!file_.open(_filename)) {
+        return false;
+    }
+
+    const auto data = file_.data();
+    const auto size = file_.size();
+
+    // Mapped mode: |magic|segment header size(4 bytes)|reserved(4 bytes)| and the segments, each one starting
+    // with |committed(8 bytes)|capacity(8 bytes)| (see callstack-recorder.cpp)
+
+    const auto header = sizeof(recorder_t::mapped_magic) + 2 * sizeof(uint32_t);
+    if (size >= header && !memcmp(data, recorder_t::mapped_magic, sizeof(recorder_t::mapped_magic))) {
+        auto segment_header = uint32_t{};
+        memcpy(&segment_header, data + sizeof(recorder_t::mapped_magic), sizeof(segment_header));
+        if (segment_header < 2 * sizeof(uint64_t)) {
+            close();
+            return false;
+        }
+        for (auto offset = header; offset + segment_header <= size;) {
+            auto committed = uint64_t{}, capacity = uint64_t{};
+            memcpy(&committed, data + offset, sizeof(committed));
+            memcpy(&capacity, data + offset + sizeof(committed), sizeof(capacity));
+            if (!capacity || capacity > size - offset - segment_header) {
+                break;
+            }
+            const auto begin = data + offset + segment_header;
+            ranges_.push_back({begin, begin + min(committed, capacity)});
+            offset += segment_header + capacity;
+        }
+        mapped_ = true;
+    } else if (size >= format::header_size && !memcmp(data, format::magic, sizeof(format::magic))) {
+        // v2: only recordings made with the same pointer size and byte order
+
+        memcpy(&version_, data + sizeof(format::magic), sizeof(version_));
+        const auto pointer_size = data[sizeof(format::magic) + sizeof(version_)];
+        const auto endianness   = data[sizeof(format::magic) + sizeof(version_) + 1];
+        if (version_ < format::min_version || version_ > format::version || pointer_size != sizeof(uintptr_t) || endianness != format::native_endianness()) {
+            close();
+            return false;
+        }
+        open_chunks(data, size);
+        return true;
+    } else {
+        ranges_.push_back({data, data + size});
+    }
+
+    for (auto i = 0u; i < ranges_.size(); ++i) {
+        push_head(i);
+    }
+    return true;
+}
+
+void qcstudio::callstack::reader_t::open_chunks(const uint8_t* _data, size_t _size) {
+    // The index, if the trailer is there and it is consistent
+
+    auto end        = _size;
+    auto index      = (const uint8_t*)nullptr;
+    auto num_chunks = uint32_t{0};
+    if (_size >= format::header_size + format::trailer_size && !memcmp(_data + _size - sizeof(format::index_magic), format::index_magic, sizeof(format::index_magic))) {
+        auto index_offset = uint64_t{};
+        memcpy(&index_offset, _data + _size - format::trailer_size, sizeof(index_offset));
+        memcpy(&num_chunks, _data + _size - format::trailer_size + sizeof(index_offset), sizeof(num_chunks));
+        if (index_offset >= format::header_size && index_offset <= _size - format::trailer_size && _size - format::trailer_size - index_offset == num_chunks * format::index_entry) {
+            end   = index_offset;
+            index = _data + index_offset;
+        }
+    }
+
+    // Walk the chunks, |size|codec|events size|data|. A truncated one ends the recording, and so does one larger
+    // than any writer makes (see format::max_chunk_size)
+
+    for (auto offset = format::header_size; end - offset >= format::chunk_header;) {
+        auto size   = uint32_t{};
+        auto events = uint32_t{};
+        memcpy(&size, _data + offset, sizeof(size));
+        const auto codec = _data[offset + sizeof(size)];
+        memcpy(&events, _data + offset + sizeof(size) + sizeof(codec), sizeof(events));
+        offset += format::chunk_header;
+        if (size > end - offset || size > format::max_chunk_size || events > format::max_chunk_size || codec > (uint8_t)format::codec::lz) {
+            break;
+        }
+        chunks_.push_back({offset, size, events, codec, numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max()});
+        ranges_.push_back({_data + offset, _data + offset + size});
+        offset += size;
+    }
+
+    // Time ranges of the chunks
+
+    if (index && num_chunks == chunks_.size()) {
+        for (auto& chunk : chunks_) {
+            auto offset = uint64_t{};
+            memcpy(&offset, index, sizeof(offset));
+            if (offset + format::chunk_header == chunk.offset) {
+                memcpy(&chunk.first, index + sizeof(offset), sizeof(chunk.first));
+                memcpy(&chunk.last, index + sizeof(offset) + sizeof(chunk.first), sizeof(chunk.last));
+            }
+            index += format::index_entry;
+        }
+    }
+}
+
+void qcstudio::callstack::reader_t::close() {
+    file_.close();
+    ranges_.clear();
+    heads_.clear();
+    chunks_.clear();
+    current_ = 0;
+    cursor_  = nullptr;
+    end_     = nullptr;
+    decoder_ = {};
+    mapped_  = false;
+    version_ = 1;
+}
+
+auto qcstudio::callstack::reader_t::next(event_t& _event) -> bool {
+    // v2: the ranges (chunks) one after the other, every one with a fresh decoding state
+
+    if (version_ >= 2) {
+        for (;;) {
+            if (cursor_ < end_ && decode_v2(decoder_, cursor_, end_, _event)) {
+                cursor_ += _event.raw_size;
+                return true;
+            }
+            if (current_ == ranges_.size()) {
+                return false;
+            }
+            decoder_.timestamp = 0;
+            decoder_.modules.clear();
+            tie(cursor_, end_) = events(current_++, buffer_);
+        }
+    }
+
+    // A single range left (always the case for regular recordings) needs no merging
+
+    if (heads_.size() == 1) {
+        auto& [pos, end] = ranges_[heads_.front().second];
+        if (decode(pos, end, _event)) {
+            pos += _event.raw_size;
+            if (pos == end) {
+                heads_.clear();
+            }
+            return true;
+        }
+        heads_.clear();
+        return false;
+    }
+
+    while (!heads_.empty()) {
+        pop_heap(heads_.begin(), heads_.end(), greater<head_t>{});
+        const auto index = heads_.back().second;
+        heads_.pop_back();
+
+        auto& [pos, end] = ranges_[index];
+        if (decode(pos, end, _event)) {
+            pos += _event.raw_size;
+            push_head(index);
+            return true;
+        }
+        pos = end;  // corrupt or truncated, give up on this range
+    }
+    return false;
+}
+
+auto qcstudio::callstack::reader_t::mapped() const -> bool {
+    return mapped_;
+}
+
+auto qcstudio::callstack::reader_t::size() const -> size_t {
+    return file_.size();
+}
+
+auto qcstudio::callstack::reader_t::version() const -> uint16_t {
+    return version_;
+}
+
+auto qcstudio::callstack::reader_t::chunks() const -> const vector<chunk_t>& {
+    return chunks_;
+}
+
+auto qcstudio::callstack::reader_t::read_chunk(size_t _index, vector<uint8_t>& _buffer, const function<bool(event_t&)>& _callback) const -> bool {
+    if (_index >= chunks_.size()) {
+        return false;
+    }
+    auto [pos, end] = events(_index, _buffer);
+    return pos && decode_chunk(pos, end, _callback);
+}
+
+auto qcstudio::callstack::reader_t::decode_chunk(const uint8_t* _pos, const uint8_t* _end, const function<bool(event_t&)>& _callback) -> bool {
+    auto decoder = decoder_t{};
+    auto event   = event_t{};
+    while (_pos < _end) {
+        if (!decode_v2(decoder, _pos, _end, event)) {
+            return false;
+        }
+        _pos += event.raw_size;
+        if (!_callback(event)) {
+            break;
+        }
+    }
+    return true;
+}
+
+auto qcstudio::callstack::reader_t::events(size_t _index, vector<uint8_t>& _buffer) const -> pair<const uint8_t*, const uint8_t*> {
+    // Stored as they are unless the chunk is compressed
+
+    if (_index >= chunks_.size() || chunks_[_index].codec == (uint8_t)format::codec::none) {
+        return ranges_[_index];
+    }
+    const auto& chunk = chunks_[_index];
+    _buffer.resize(chunk.events_size);
+    if (!lz::decompress(file_.data() + chunk.offset, chunk.size, _buffer.data(), _buffer.size())) {
+        return {};
+    }
+    return {_buffer.data(), _buffer.data() + _buffer.size()};
+}
+
+void qcstudio::callstack::reader_t::push_head(size_t _index) {
+    const auto [pos, end] = ranges_[_index];
+    if (end - pos > (ptrdiff_t)sizeof(uint64_t)) {
+        auto timestamp = uint64_t{};
+        memcpy(&timestamp, pos + 1, sizeof(timestamp));
+        heads_.push_back({timestamp, _index});
+        push_heap(heads_.begin(), heads_.end(), greater<head_t>{});
+    }
+}
+
+auto qcstudio::callstack::reader_t::decode(const uint8_t* _pos, const uint8_t* _end, event_t& _event) -> bool {
+    // |event(1 byte)|timestamp(8 bytes)|payload (see recorder_t::event)
+
+    auto cursor    = _pos;
+    const auto get = [&](auto& _value) {
+        if ((size_t)(_end - cursor) < sizeof(_value)) {
+            return false;
+        }
+        memcpy(&_value, cursor, sizeof(_value));
+        cursor += sizeof(_value);
+        return true;
+    };
+    const auto skip = [&](size_t _size) {
+        if ((size_t)(_end - cursor) < _size) {
+            return false;
+        }
+        cursor += _size;
+        return true;
+    };
+
+    _event.path   = {};
+    _event.frames = {};
+    _event.stats  = nullptr;
+
+    auto type = uint8_t{};
+    if (!get(type) || !get(_event.timestamp)) {
+        return false;
+    }
+    _event.type = (recorder_t::event)type;
+
+    auto ok    = false;
+    auto count = uint16_t{};
+    switch (_event.type) {
+        case recorder_t::event::add_module: {
+            if (get(count)) {
+                _event.path = {cursor, count};
+                ok          = skip(count * sizeof(wchar_t)) && get(_event.base_addr) && get(_event.size);
+            }
+            break;
+        }
+        case recorder_t::event::del_module: {
+            if (get(count)) {
+                _event.path = {cursor, count};
+                ok          = skip(count * sizeof(wchar_t));
+            }
+            break;
+        }
+        case recorder_t::event::callstack: {
+            if (get(count)) {
+                _event.frames = {cursor, count};
+                ok            = skip(count * sizeof(uintptr_t));
+            }
+            break;
+        }
+        case recorder_t::event::stack_def: {
+            if (get(_event.id) && get(count)) {
+                _event.frames = {cursor, count};
+                ok            = skip(count * sizeof(uintptr_t));
+            }
+            break;
+        }
+        case recorder_t::event::callstack_ref: {
+            ok = get(_event.id);
+            break;
+        }
+        case recorder_t::event::calibration: {
+            ok = get(_event.wall_time) && get(_event.frequency);
+            break;
+        }
+        case recorder_t::event::heap_alloc: {
+            if (get(_event.address) && get(_event.bytes) && get(_event.period) && get(count)) {
+                _event.frames = {cursor, count};
+                ok            = skip(count * sizeof(uintptr_t));
+            }
+            break;
+        }
+        case recorder_t::event::heap_free: {
+            ok = get(_event.address);
+            break;
+        }
+        case recorder_t::event::telemetry: {
+            // Only the rings of shared mode keep it in memory, and only for it to be written out: the counters are
+            // skipped ('stats' stays null)
+
+            ok = skip(5 * sizeof(uint64_t) + sizeof(uint32_t)) && get(count) && skip(count * sizeof(uint64_t));
+            break;
+        }
+    }
+
+    _event.raw      = _pos;
+    _event.raw_size = cursor - _pos;
+    return ok;
+}
+
+auto qcstudio::callstack::reader_t::decode_v2(decoder_t& _decoder, const uint8_t* _pos, const uint8_t* _end, event_t& _event) -> bool {
+    // |tag(1 byte)|timestamp delta(varint)|payload (see callstack-format.h)
+
+    auto       cursor = _pos;
+    auto       value  = uint64_t{};
+    const auto get    = [&](auto& _value) {
+        if (!format::get_varint(cursor, _end, value) || value > numeric_limits<decay_t<decltype(_value)>>::max()) {
+            return false;
+        }
+        _value = (decay_t<decltype(_value)>)value;
+        return true;
+    };
+    const auto get_path = [&] {
+        auto count = uint16_t{};
+        if (!get(count) || (size_t)(_end - cursor) < count * sizeof(wchar_t)) {
+            return false;
+        }
+        _event.path = {cursor, count};
+        cursor += count * sizeof(wchar_t);
+        return true;
+    };
+    const auto get_frames = [&] {
+        auto count = uint16_t{};
+        if (!get(count)) {
+            return false;
+        }
+        _decoder.frames.resize(count);
+        auto module = uint64_t{0};
+        for (auto& frame : _decoder.frames) {
+            auto offset = uint64_t{};
+            if (!get(offset) || ((offset & 1) && !get(module)) || module > _decoder.modules.size()) {
+                return false;
+            }
+            offset >>= 1;
+            frame = (uintptr_t)(module ? _decoder.modules[module - 1] + offset : offset);
+        }
+        _event.frames = {(const uint8_t*)_decoder.frames.data(), count};
+        return true;
+    };
+
+    _event.path   = {};
+    _event.frames = {};
+    _event.stats  = nullptr;
+
+    if (cursor == _end) {
+        return false;
+    }
+    const auto tag = *cursor++;
+    _event.type    = (recorder_t::event)(tag & format::event_mask);
+    if ((tag & format::delta_follows) && !format::get_varint(cursor, _end, value)) {
+        return false;
+    }
+    value      = (tag & format::delta_follows ? value << format::delta_shift : 0) | (tag >> format::delta_shift);
+    _decoder.timestamp += (uint64_t)format::unzigzag(value);
+    _event.timestamp = _decoder.timestamp;
+    if ((tag & format::event_mask) == format::extended_event) {
+        if (cursor == _end) {
+            return false;
+        }
+        _event.type = (recorder_t::event)*cursor++;
+    }
+
+    auto ok = false;
+    switch (_event.type) {
+        case recorder_t::event::add_module: {
+            ok = get_path() && get(_event.base_addr) && get(_event.size);
+            if (ok) {
+                _decoder.modules.push_back(_event.base_addr);
+            }
+            break;
+        }
+        case recorder_t::event::del_module: {
+            ok = get_path();
+            break;
+        }
+        case recorder_t::event::callstack: {
+            ok = get_frames();
+            break;
+        }
+        case recorder_t::event::stack_def: {
+            ok = get(_event.id) && get_frames();
+            break;
+        }
+        case recorder_t::event::callstack_ref: {
+            ok = get(_event.id);
+            break;
+        }
+        case recorder_t::event::calibration: {
+            auto wall        = uint64_t{};
+            ok               = get(wall) && get(_event.frequency);
+            _event.wall_time = format::unzigzag(wall);
+            break;
+        }
+        case recorder_t::event::heap_alloc: {
+            ok = get(_event.address) && get(_event.bytes) && get(_event.period) && get_frames();
+            break;
+        }
+        case recorder_t::event::heap_free: {
+            ok = get(_event.address);
+            break;
+        }
+        case recorder_t::event::telemetry: {
+            auto& stats   = _decoder.stats;
+            auto  count   = uint16_t{};
+            stats.latency = {};
+            ok            = get(stats.captures) && get(stats.dropped) && get(stats.bytes) && get(stats.lock_wait) && get(stats.uninterned) && get(stats.threads) && get(count);
+            for (auto i = 0u; ok && i < count; ++i) {
+                auto bucket = uint64_t{};
+                ok          = get(bucket);
+                if (i < stats.latency.size()) {
+                    stats.latency[i] = bucket;
+                }
+            }
+            _event.stats = &stats;
+            break;
+        }
+    }
+
+    _event.raw      = _pos;
+    _event.raw_size = cursor - _pos;
+    return ok;
+}
+
+/*
+    Live streams
+*/
+
+auto qcstudio::callstack::live_reader_t::accept(const wchar_t* _address) -> bool {
+    close();
+    if (!socket_.accept(_address)) {
+        return false;
+    }
+
+    // The header of a recording (see callstack-format.h)
+
+    auto header = array<uint8_t, format::header_size>{};
+    if (!socket_.read(header.data(), header.size()) || memcmp(header.data(), format::magic, sizeof(format::magic))) {
+        close();
+        return false;
+    }
+    memcpy(&version_, header.data() + sizeof(format::magic), sizeof(version_));
+    const auto pointer_size = header[sizeof(format::magic) + sizeof(version_)];
+    const auto endianness   = header[sizeof(format::magic) + sizeof(version_) + 1];
+    if (version_ < format::min_version || version_ > format::version || pointer_size != sizeof(uintptr_t) || endianness != format::native_endianness()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void qcstudio::callstack::live_reader_t::close() {
+    socket_.close();
+    data_.clear();
+    buffer_.clear();
+    version_ = 0;
+}
+
+auto qcstudio::callstack::live_reader_t::read_chunk(const function<bool(event_t&)>& _callback) -> bool {
+    // |size|codec|events size|data|, both sizes from the peer, hence, bounded before allocating anything
+
+    auto header = array<uint8_t, format::chunk_header>{};
+    if (!version_ || !socket_.read(header.data(), header.size())) {
+        return false;
+    }
+    auto size   = uint32_t{};
+    auto events = uint32_t{};
+    memcpy(&size, header.data(), sizeof(size));
+    const auto codec = header[sizeof(size)];
+    memcpy(&events, header.data() + sizeof(size) + sizeof(codec), sizeof(events));
+    if (codec > (uint8_t)format::codec::lz || size > format::max_chunk_size || events > format::max_chunk_size) {
+        return false;
+    }
+    data_.resize(size);
+    if (!socket_.read(data_.data(), data_.size())) {
+        return false;
+    }
+
+    auto pos = data_.data(), end = data_.data() + data_.size();
+    if (codec == (uint8_t)format::codec::lz) {
+        buffer_.resize(events);
+        if (!lz::decompress(data_.data(), data_.size(), buffer_.data(), buffer_.size())) {
+            return false;
+        }
+        pos = buffer_.data();
+        end = buffer_.data() + buffer_.size();
+    }
+    return reader_t::decode_chunk(pos, end, _callback);
+}
+
+auto qcstudio::callstack::live_reader_t::version() const -> uint16_t {
+    return version_;
+}
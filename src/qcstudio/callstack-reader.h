@@ -0,0 +1,240 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+// QCStudio
+
+#include "callstack-recorder.h"
+#include "mapped-file.h"
+#include "local-socket.h"
+
+// C++
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+
+#if defined(_MSC_VER)
+#    pragma warning(disable : 4251)
+#endif
+#pragma push_macro("QCS_API")
+#undef QCS_API
+#if !defined(_WIN32)
+#    define QCS_API __attribute__((visibility("default")))
+#elif defined(BUILDING_QCSTUDIO)
+#    define QCS_API __declspec(dllexport)
+#else
+#    define QCS_API __declspec(dllimport)
+#endif
+
+/*
+    Zero-copy reader of recordings.
+    The file is memory mapped and the events are decoded in place: paths and frames are views over the mapping
+    (valid until the reader is closed) so nothing is allocated per event. Recordings made in mapped mode are
+    merged by timestamp on the fly. Every format version is read (see callstack-format.h); in v2 the frames are
+    rebuilt into a buffer of the reader, hence, their views are only valid until the next event.
+    Chunks (v2) are listed with their time range and can also be decoded on their own, from any thread, with
+    'read_chunk'. Compressed ones are decompressed into a buffer first: the views point there instead.
+    Live streams come through a connection instead of a file (see live_reader_t below)
+*/
+
+namespace qcstudio::callstack {
+
+    using namespace std;
+
+    // Frames of a stack as stored in the recording (not necessarily aligned, hence, the copies on access)
+
+    class frames_view_t {
+    public:
+        class iterator {
+        public:
+            iterator(const uint8_t* _pos) : pos_(_pos) {}
+            auto operator*() const -> uintptr_t {
+                auto ret = uintptr_t{};
+                memcpy(&ret, pos_, sizeof(ret));
+                return ret;
+            }
+            auto operator++() -> iterator& {
+                pos_ += sizeof(uintptr_t);
+                return *this;
+            }
+            auto operator!=(const iterator& _other) const -> bool {
+                return pos_ != _other.pos_;
+            }
+
+        private:
+            const uint8_t* pos_;
+        };
+
+        frames_view_t() = default;
+        frames_view_t(const uint8_t* _data, uint16_t _size) : data_(_data), size_(_size) {}
+
+        auto size() const -> size_t {
+            return size_;
+        }
+        auto operator[](size_t _index) const -> uintptr_t {
+            return *iterator(data_ + _index * sizeof(uintptr_t));
+        }
+        auto begin() const -> iterator {
+            return {data_};
+        }
+        auto end() const -> iterator {
+            return {data_ + size_ * sizeof(uintptr_t)};
+        }
+
+    private:
+        const uint8_t* data_ = nullptr;
+        uint16_t       size_ = 0;
+    };
+
+    // Module path as stored in the recording
+
+    struct path_view_t {
+        const uint8_t* data   = nullptr;
+        uint16_t       length = 0;  // in characters
+
+        auto str() const -> wstring {
+            auto ret = wstring(length, L'\0');
+            memcpy(ret.data(), data, length * sizeof(wchar_t));
+            return ret;
+        }
+    };
+
+    // Decoded event (only the fields of its type are meaningful)
+
+    struct event_t {
+        recorder_t::event          type;
+        uint64_t                   timestamp;
+        path_view_t                path;       // add_module, del_module
+        uintptr_t                  base_addr;  // add_module
+        uint32_t                   size;       // add_module
+        uint32_t                   id;         // stack_def, callstack_ref
+        int64_t                    wall_time;  // calibration
+        uint64_t                   frequency;  // calibration
+        uintptr_t                  address;    // heap_alloc, heap_free
+        uint64_t                   bytes;      // heap_alloc
+        uint64_t                   period;     // heap_alloc (sampling period in bytes)
+        const recorder_t::stats_t* stats;      // telemetry (valid until the next event, null in v1)
+        frames_view_t              frames;     // callstack, stack_def, heap_alloc
+        const uint8_t*             raw;        // the whole encoded event
+        size_t                     raw_size;
+    };
+
+    // Chunk of a recording (v2)
+
+    struct chunk_t {
+        size_t  offset;       // of its data within the file
+        size_t  size;         // bytes of its data
+        size_t  events_size;  // bytes of its events (once decompressed)
+        uint8_t codec;        // of its data (see format::codec)
+        int64_t first, last;  // time range (ns, see callstack-format.h); the widest one if the file has no index
+    };
+
+    class QCS_API reader_t {
+    public:
+        auto open(const wchar_t* _filename) -> bool;
+        void close();
+
+        auto next(event_t& _event) -> bool;  // false at the end (a truncated or unknown event ends its range too)
+        auto mapped() const -> bool;         // recorded in mapped mode
+        auto version() const -> uint16_t;    // of the recording format
+        auto size() const -> size_t;         // bytes of the file
+
+        // chunks (none in v1). 'read_chunk' calls '_callback' for every event of the chunk (until it returns
+        // false) and returns false if the chunk is corrupt or truncated. Compressed chunks are decompressed into
+        // '_buffer', which the paths and the raw events of the events point to
+
+        auto chunks() const -> const vector<chunk_t>&;
+        auto read_chunk(size_t _index, vector<uint8_t>& _buffer, const function<bool(event_t&)>& _callback) const -> bool;
+
+        static auto decode(const uint8_t* _pos, const uint8_t* _end, event_t& _event) -> bool;  // v1
+
+    private:
+        using head_t = pair<uint64_t, size_t>;  // timestamp, range index
+
+        // v2 decoding state (restarted at every chunk)
+
+        struct decoder_t {
+            uint64_t            timestamp = 0;
+            vector<uintptr_t>   modules;  // base address by module id - 1
+            vector<uintptr_t>   frames;
+            recorder_t::stats_t stats;
+        };
+
+        misc::mapped_file_t                            file_;
+        vector<pair<const uint8_t*, const uint8_t*>> ranges_;  // sorted runs of events (or chunk data)
+        vector<head_t>                                 heads_;   // min-heap of the next event of every range (v1)
+        vector<chunk_t>                                chunks_;
+        bool                                           mapped_  = false;
+        uint16_t                                       version_ = 1;
+
+        // v2
+
+        size_t          current_ = 0;        // next range to decode
+        const uint8_t*  cursor_  = nullptr;  // within the events of the previous one
+        const uint8_t*  end_     = nullptr;
+        vector<uint8_t> buffer_;             // decompressed events
+        decoder_t       decoder_;
+
+        void open_chunks(const uint8_t* _data, size_t _size);
+        void push_head(size_t _index);
+        auto events(size_t _index, vector<uint8_t>& _buffer) const -> pair<const uint8_t*, const uint8_t*>;
+
+        static auto decode_v2(decoder_t& _decoder, const uint8_t* _pos, const uint8_t* _end, event_t& _event) -> bool;
+        static auto decode_chunk(const uint8_t* _pos, const uint8_t* _end, const function<bool(event_t&)>& _callback) -> bool;
+
+        friend class live_reader_t;
+    };
+
+    /*
+        Reader of live streams (see recorder_t::start_live_streaming): a recording without index whose chunks come
+        through a local connection as the recorder writes them. 'accept' waits for a recorder to connect to
+        '_address'; 'read_chunk' waits for its next chunk and calls '_callback' for every event of it (until it
+        returns false) and returns false once the recorder is done, or the stream is corrupt. The views of the
+        events are valid until the next chunk
+    */
+
+    class QCS_API live_reader_t {
+    public:
+        auto accept(const wchar_t* _address) -> bool;
+        void close();
+
+        auto read_chunk(const function<bool(event_t&)>& _callback) -> bool;
+        auto version() const -> uint16_t;  // of the recording format
+
+    private:
+        misc::local_socket_t socket_;
+        vector<uint8_t>      data_;    // chunk as received
+        vector<uint8_t>      buffer_;  // decompressed events
+        uint16_t             version_ = 0;
+    };
+
+}  // namespace qcstudio::callstack
+
+#pragma pop_macro("QCS_API")
@@ -0,0 +1,940 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Own
+
+#include "callstack-recorder.h"
+#include "unicode.h"
+
+// C++
+
+#include <array>
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <climits>
+#include <cerrno>
+#include <cmath>
+
+// Linux
+
+#include <dlfcn.h>
+#include <link.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ucontext.h>
+#include <sys/syscall.h>
+#include <x86intrin.h>
+
+using namespace std;
+
+/*
+    Linux specific parts of the recorder:
+    - Module snapshot through dl_iterate_phdr
+    - Module tracking on the capture path: the loader's add/sub counters (the first entry of dl_iterate_phdr) tell
+      whether anything was loaded/unloaded since last time and, only then, the loader's module list is diffed
+      against ours. Nothing of the loader is interposed, so the way the process loads libraries never changes
+      (e.g. the RUNPATH of the caller of a dlopen)
+    - Stack walking by following the frame pointer chain (requires -fno-omit-frame-pointer, see premake5.lua)
+    - Sampling through per-thread CPU time timers that signal the thread, whose handler walks the interrupted stack
+    - Heap sampling by interposing malloc/calloc/realloc/free and the aligned allocation functions, forwarded to
+      glibc's own implementation. Only when
+      built with QCS_HEAP_SAMPLING (premake5 --heap-sampling): otherwise the allocation functions are left alone
+      and 'start_heap_sampling' fails
+*/
+
+#if defined(QCS_HEAP_SAMPLING)
+extern "C" {
+    auto __libc_malloc(size_t _size) -> void*;
+    auto __libc_calloc(size_t _count, size_t _size) -> void*;
+    auto __libc_realloc(void* _ptr, size_t _size) -> void*;
+    auto __libc_memalign(size_t _alignment, size_t _size) -> void*;
+    auto __libc_valloc(size_t _size) -> void*;
+    auto __libc_pvalloc(size_t _size) -> void*;
+    void __libc_free(void* _ptr);
+}
+#endif
+
+namespace {
+    // Every frame starts with |previous frame pointer|return address|. Callers live at higher addresses, all of
+    // them within [_lo, _hi) so that a broken chain never makes us read outside of the stack
+
+    auto walk_frames(uintptr_t* _fp, uintptr_t _lo, uintptr_t _hi, void** _frames, uint16_t _max_frames, uint16_t _skip) -> uint16_t {
+        auto num_frames = uint16_t{0};
+        while (num_frames < _max_frames) {
+            if ((uintptr_t)_fp < _lo || (uintptr_t)(_fp + 2) > _hi || ((uintptr_t)_fp & (sizeof(uintptr_t) - 1))) {
+                break;
+            }
+            const auto ret = _fp[1];
+            if (!ret) {
+                break;
+            }
+            if (_skip) {
+                --_skip;
+            } else {
+                _frames[num_frames++] = (void*)ret;
+            }
+            const auto next = (uintptr_t*)_fp[0];
+            if (next <= _fp) {
+                break;
+            }
+            _fp = next;
+        }
+        return num_frames;
+    }
+}  // namespace
+
+namespace qcstudio::callstack {
+
+    struct module_tracker_t {
+        struct module_t {
+            uintptr_t base;
+            size_t    size;
+            char*     path;  // strdup'ed
+            bool      alive;
+        };
+
+        static inline auto lock     = std::mutex{};
+        static inline auto instance = (recorder_t*)nullptr;
+        static inline auto adds     = atomic<uint64_t>{~0ull};  // loader counters at the last sync (written under the lock)
+        static inline auto subs     = atomic<uint64_t>{~0ull};
+
+        // Known modules, as many as the process has. Built on first use rather than at static initialization, as
+        // the recorder may sync before the constructors of this file run, and never destroyed, as a capture may
+        // come after the destructors (lock must be held)
+
+        static auto modules() -> vector<module_t>& {
+            static auto ret = new vector<module_t>{};
+            return *ret;
+        }
+
+        // Bring our list up to date with the loader's one (lock must be held). The events are stamped with
+        // '_timestamp' if any (see recorder_t::record)
+
+        static void sync(optional<int64_t> _timestamp = nullopt) {
+            if (!instance) {
+                return;
+            }
+
+            for (auto& module : modules()) {
+                module.alive = false;
+            }
+
+            struct pass_t {
+                bool              first;
+                optional<int64_t> timestamp;
+            };
+            auto pass      = pass_t{true, _timestamp};
+            auto unchanged = dl_iterate_phdr(
+                [](dl_phdr_info* _info, size_t, void* _pass) -> int {
+                    auto& pass = *(pass_t*)_pass;
+
+                    // Bail out straight away if nothing was loaded/unloaded since last time
+
+                    if (pass.first) {
+                        pass.first = false;
+                        if (_info->dlpi_adds == adds.load(memory_order_relaxed) && _info->dlpi_subs == subs.load(memory_order_relaxed)) {
+                            return 1;
+                        }
+                        adds.store(_info->dlpi_adds, memory_order_relaxed);
+                        subs.store(_info->dlpi_subs, memory_order_relaxed);
+                    }
+
+                    // Memory range covered by the loadable segments
+
+                    auto lo = ~uintptr_t{0}, hi = uintptr_t{0};
+                    for (auto i = 0; i < _info->dlpi_phnum; ++i) {
+                        if (_info->dlpi_phdr[i].p_type == PT_LOAD) {
+                            lo = min<uintptr_t>(lo, _info->dlpi_phdr[i].p_vaddr);
+                            hi = max<uintptr_t>(hi, _info->dlpi_phdr[i].p_vaddr + _info->dlpi_phdr[i].p_memsz);
+                        }
+                    }
+                    if (lo >= hi) {
+                        return 0;
+                    }
+                    const auto base = _info->dlpi_addr + lo;
+
+                    // Already known?
+
+                    for (auto& module : modules()) {
+                        if (module.base == base && module.size == hi - lo) {
+                            module.alive = true;
+                            return 0;
+                        }
+                    }
+
+                    // New one: the main program comes with an empty name and the vdso has no file behind
+
+                    auto path = (char*)nullptr;
+                    if (!_info->dlpi_name || !*_info->dlpi_name) {
+                        char exe[PATH_MAX];
+                        if (auto len = readlink("/proc/self/exe", exe, sizeof(exe) - 1); len > 0) {
+                            exe[len] = 0;
+                            path     = strdup(exe);
+                        }
+                    } else {
+                        path = realpath(_info->dlpi_name, nullptr);
+                    }
+                    if (!path) {
+                        return 0;
+                    }
+
+                    modules().push_back({base, hi - lo, path, true});
+
+                    wchar_t wpath[PATH_MAX];
+                    unicode::to_wide(path, wpath, PATH_MAX);
+                    instance->on_add_module(wpath, base, hi - lo, pass.timestamp);
+                    return 0;
+                },
+                &pass);
+
+            if (unchanged) {
+                return;
+            }
+
+            // Whatever we did not see is gone
+
+            auto& known = modules();
+            for (auto i = 0u; i < known.size();) {
+                if (!known[i].alive) {
+                    wchar_t wpath[PATH_MAX];
+                    unicode::to_wide(known[i].path, wpath, PATH_MAX);
+                    instance->on_del_module(wpath, known[i].base, known[i].size, _timestamp);
+                    free(known[i].path);
+                    known[i] = known.back();
+                    known.pop_back();
+                } else {
+                    ++i;
+                }
+            }
+        }
+    };
+
+    /*
+        Sampler
+
+        Every thread gets a timer on its own CPU time clock that sends it SIGPROF each period of CPU time it
+        consumes, so idle threads cost nothing. The handler only touches memory preallocated for the thread: it
+        walks the interrupted stack into the next free sample of a single producer/single consumer ring. The
+        sampler thread discovers the threads (rescanning /proc/self/task before every drain), arms and deletes
+        their timers, finds their stack bounds and drains the rings through the regular capture path, in
+        timestamp order. Hence, a thread is sampled from the first scan after it starts (within a DRAIN_PERIOD)
+        until it is gone; one living less than that may be missed altogether.
+    */
+
+    struct sampler_t {
+        static constexpr auto MAX_THREADS   = 4096;
+        static constexpr auto MAX_FRAMES    = 64;
+        static constexpr auto RING_SIZE     = 64u;  // samples in flight per thread (drained every DRAIN_PERIOD)
+        static constexpr auto DRAIN_PERIOD  = std::chrono::milliseconds(10);
+        static constexpr auto VERIFY_PERIOD = 10;   // in drains, see 'scan'
+        static constexpr auto SIGNAL_TAG    = 0x51C50000;
+
+        struct sample_t {
+            int64_t  timestamp;
+            uint16_t num_frames;
+            uint16_t weight;  // periods elapsed (the timers only expire on a scheduler tick, see si_overrun)
+            void*    frames[MAX_FRAMES];
+        };
+
+        struct ring_t {
+            pid_t             tid;         // 0 when the thread is gone (the sampler thread only touches these 4)
+            uint64_t          start_time;  // of the thread, tells apart a reused tid
+            timer_t           timer;
+            bool              seen;
+            atomic<uintptr_t> probe;       // stack pointer left by the handler when out of the known bounds
+            atomic<uintptr_t> stack_lo;
+            atomic<uintptr_t> stack_hi;    // 0 until known
+            atomic<uint32_t>  head;        // written by the handler
+            atomic<uint32_t>  tail;        // written by the sampler thread
+            sample_t          samples[RING_SIZE];
+        };
+
+        static inline auto lock      = std::mutex{};
+        static inline auto instance  = atomic<recorder_t*>{nullptr};
+        static inline auto rings     = array<atomic<ring_t*>, MAX_THREADS>{};  // never freed, recycled
+        static inline auto installed = false;
+        static inline struct sigaction previous = {};
+        static inline auto period    = int64_t{0};  // ns of CPU time
+        static inline auto stop      = false;
+        static inline auto wake      = std::condition_variable{};
+        static inline auto thread    = std::thread{};
+
+        // signal handler
+
+        static auto timestamp(const recorder_t* _recorder) -> int64_t {
+            if (_recorder->time_source_ == recorder_t::time_source::tsc) {
+                return (int64_t)__rdtsc();
+            }
+            auto ts = timespec{};
+            clock_gettime(CLOCK_REALTIME, &ts);
+            return (int64_t)ts.tv_sec * 1'000'000'000 + ts.tv_nsec;
+        }
+
+        static void on_signal(int _signal, siginfo_t* _info, void* _context) {
+            const auto index = (unsigned)(_info->si_value.sival_int ^ SIGNAL_TAG);
+            const auto ring  = _info->si_code == SI_TIMER && index < MAX_THREADS ? rings[index].load(memory_order_acquire) : nullptr;
+            if (!ring) {
+                // not ours, chain
+                if (previous.sa_flags & SA_SIGINFO) {
+                    previous.sa_sigaction(_signal, _info, _context);
+                } else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN) {
+                    previous.sa_handler(_signal);
+                }
+                return;
+            }
+            const auto recorder = instance.load(memory_order_acquire);
+            if (!recorder) {
+                return;  // a late signal of a deleted timer
+            }
+
+            const auto saved_errno = errno;
+            const auto head        = ring->head.load(memory_order_relaxed);
+            if (head - ring->tail.load(memory_order_acquire) == RING_SIZE) {
+                recorder->dropped_.fetch_add(1, memory_order_relaxed);
+            } else {
+                const auto& regs   = ((ucontext_t*)_context)->uc_mcontext.gregs;
+                const auto  sp     = (uintptr_t)regs[REG_RSP];
+                const auto  hi     = ring->stack_hi.load(memory_order_acquire);
+                const auto  lo     = ring->stack_lo.load(memory_order_relaxed);
+                auto&       sample = ring->samples[head % RING_SIZE];
+                sample.timestamp   = timestamp(recorder);
+                sample.weight      = (uint16_t)min(1 + max(_info->si_overrun, 0), 0xffff);
+                sample.frames[0]   = (void*)regs[REG_RIP];
+                sample.num_frames  = 1;
+                if (sp >= lo && sp < hi) {
+                    sample.num_frames += walk_frames((uintptr_t*)regs[REG_RBP], sp, hi, sample.frames + 1, MAX_FRAMES - 1, 0);
+                } else {
+                    ring->probe.store(sp, memory_order_relaxed);  // only the leaf until the sampler thread finds the stack
+                }
+                ring->head.store(head + 1, memory_order_release);
+            }
+            errno = saved_errno;
+        }
+
+        // sampler thread
+
+        static auto start_time_of(pid_t _tid) -> uint64_t {
+            char path[64], stat[1024];
+            snprintf(path, sizeof(path), "/proc/self/task/%d/stat", (int)_tid);
+            auto fd = open(path, O_RDONLY);
+            if (fd < 0) {
+                return 0;
+            }
+            auto len = read(fd, stat, sizeof(stat) - 1);
+            close(fd);
+            if (len <= 0) {
+                return 0;
+            }
+            stat[len] = 0;
+
+            // 22nd field, the 2nd one (the name) is parenthesized and may contain anything
+
+            auto field = strrchr(stat, ')');
+            for (auto i = 2; field && i < 22; ++i) {
+                field = strchr(field + 1, ' ');
+            }
+            return field ? strtoull(field + 1, nullptr, 10) : 0;
+        }
+
+        static void arm(pid_t _tid, uint64_t _start_time) {
+            // A ring left by a thread that is gone and fully drained, or a new one
+
+            auto index = -1;
+            for (auto i = 0; i < MAX_THREADS; ++i) {
+                const auto ring = rings[i].load(memory_order_relaxed);
+                if (!ring) {
+                    rings[i].store(new ring_t{}, memory_order_release);
+                    index = i;
+                    break;
+                }
+                if (!ring->tid && ring->head.load(memory_order_acquire) == ring->tail.load(memory_order_relaxed)) {
+                    index = i;
+                    break;
+                }
+            }
+            if (index < 0) {
+                return;  // that thread will not be sampled
+            }
+
+            auto ring        = rings[index].load(memory_order_relaxed);
+            ring->probe      = 0;
+            ring->stack_lo   = 0;
+            ring->stack_hi.store(0, memory_order_release);
+
+            auto event                  = sigevent{};
+            event.sigev_notify          = SIGEV_THREAD_ID;
+            event.sigev_signo           = SIGPROF;
+            event.sigev_value.sival_int = SIGNAL_TAG ^ index;
+            event._sigev_un._tid        = _tid;
+
+            const auto clock = (clockid_t)((~(unsigned)_tid << 3) | 6);  // CPU time of the thread (MAKE_THREAD_CPUCLOCK, CPUCLOCK_SCHED)
+            if (timer_create(clock, &event, &ring->timer)) {
+                return;  // already gone
+            }
+            auto spec     = itimerspec{};
+            spec.it_value = spec.it_interval = timespec{(time_t)(period / 1'000'000'000), (long)(period % 1'000'000'000)};
+            timer_settime(ring->timer, 0, &spec, nullptr);
+            ring->tid        = _tid;
+            ring->start_time = _start_time;
+            ring->seen       = true;
+        }
+
+        static void disarm(ring_t* _ring) {
+            timer_delete(_ring->timer);
+            _ring->tid = 0;
+        }
+
+        // New threads are armed on every scan, whereas telling a reused tid apart takes reading the start time
+        // of every thread, only done every '_verify' scan. Rings are taken in order and never freed: the first
+        // empty slot ends them
+
+        static void scan(pid_t _self, bool _verify) {
+            for (auto& slot : rings) {
+                if (auto ring = slot.load(memory_order_relaxed)) {
+                    ring->seen = false;
+                } else {
+                    break;
+                }
+            }
+
+            if (auto dir = opendir("/proc/self/task")) {
+                while (auto entry = readdir(dir)) {
+                    const auto tid = (pid_t)atoi(entry->d_name);
+                    if (tid <= 0 || tid == _self) {
+                        continue;
+                    }
+                    auto start_time = _verify ? start_time_of(tid) : 0;
+                    auto known      = false;
+                    for (auto& slot : rings) {
+                        auto ring = slot.load(memory_order_relaxed);
+                        if (!ring) {
+                            break;
+                        }
+                        if (ring->tid == tid && (!_verify || ring->start_time == start_time)) {
+                            ring->seen = known = true;
+                            break;
+                        }
+                    }
+                    if (!known && !_verify) {
+                        start_time = start_time_of(tid);
+                    }
+                    if (!known && start_time) {
+                        arm(tid, start_time);
+                    }
+                }
+                closedir(dir);
+            }
+
+            for (auto& slot : rings) {
+                auto ring = slot.load(memory_order_relaxed);
+                if (ring && ring->tid && !ring->seen) {
+                    disarm(ring);
+                }
+            }
+        }
+
+        // Stack bounds of the threads whose handler left a stack pointer: the mapping that contains it. Once
+        // known, the bounds only grow downwards (the main thread stack), a thread running on another stack
+        // (sigaltstack, coroutines) keeps being sampled without callers
+
+        static void find_stacks() {
+            auto pending = false;
+            for (auto& slot : rings) {
+                auto ring = slot.load(memory_order_relaxed);
+                pending |= ring && ring->tid && ring->probe.load(memory_order_relaxed);
+            }
+            if (!pending) {
+                return;
+            }
+
+            auto maps = fopen("/proc/self/maps", "r");
+            if (!maps) {
+                return;
+            }
+            auto lo = (unsigned long)0, hi = (unsigned long)0;
+            char line[PATH_MAX + 128];
+            while (fgets(line, sizeof(line), maps)) {
+                if (sscanf(line, "%lx-%lx", &lo, &hi) != 2) {
+                    continue;
+                }
+                for (auto& slot : rings) {
+                    auto       ring  = slot.load(memory_order_relaxed);
+                    const auto probe = ring && ring->tid ? ring->probe.load(memory_order_relaxed) : 0;
+                    if (!probe || probe < lo || probe >= hi) {
+                        continue;
+                    }
+                    const auto known = ring->stack_hi.load(memory_order_relaxed);
+                    if (!known) {
+                        ring->stack_lo.store(lo, memory_order_relaxed);
+                        ring->stack_hi.store(hi, memory_order_release);
+                    } else if (known == hi) {
+                        ring->stack_lo.store(lo, memory_order_relaxed);
+                    }
+                    ring->probe.store(0, memory_order_relaxed);
+                }
+            }
+            fclose(maps);
+        }
+
+        // Samples go to the recorder in timestamp order, only those older than the previous drain as a handler
+        // may still be pushing an older sample than the ones just taken
+
+        static void drain(recorder_t* _recorder, vector<sample_t>& _pending, int64_t _until) {
+            for (auto& slot : rings) {
+                if (auto ring = slot.load(memory_order_acquire)) {
+                    const auto head = ring->head.load(memory_order_acquire);
+                    for (auto tail = ring->tail.load(memory_order_relaxed); tail != head; ++tail) {
+                        _pending.push_back(ring->samples[tail % RING_SIZE]);
+                    }
+                    ring->tail.store(head, memory_order_release);
+                }
+            }
+
+            sort(_pending.begin(), _pending.end(), [](const sample_t& _a, const sample_t& _b) { return _a.timestamp < _b.timestamp; });
+            auto ready = size_t{0};
+            for (; ready < _pending.size() && _pending[ready].timestamp < _until; ++ready) {
+                for (auto i = 0u; i < _pending[ready].weight; ++i) {
+                    _recorder->record(_pending[ready].frames, _pending[ready].num_frames, _pending[ready].timestamp);
+                }
+            }
+            _pending.erase(_pending.begin(), _pending.begin() + ready);
+        }
+
+        static void loop(recorder_t* _recorder) {
+            const auto self    = (pid_t)syscall(SYS_gettid);
+            auto       pending = vector<sample_t>{};
+            auto       until   = _recorder->now();
+
+            // Take the thread buffer now: an adopted one (see local_buffer) must not end with events newer than
+            // the first samples. And drop the leftovers of a previous session
+
+            _recorder->local_buffer();
+
+            for (auto& slot : rings) {
+                if (auto ring = slot.load(memory_order_acquire)) {
+                    ring->tail.store(ring->head.load(memory_order_acquire), memory_order_release);
+                }
+            }
+
+            auto guard = unique_lock(lock);
+            for (auto pass = 0; !stop; ++pass) {
+                guard.unlock();
+                scan(self, pass % VERIFY_PERIOD == 0);
+                find_stacks();
+                const auto next = _recorder->now();
+                drain(_recorder, pending, until);
+                _recorder->set_sampled_until(until);
+                until = next;
+                guard.lock();
+                wake.wait_for(guard, DRAIN_PERIOD, [] { return stop; });
+            }
+            guard.unlock();
+
+            for (auto& slot : rings) {
+                auto ring = slot.load(memory_order_relaxed);
+                if (ring && ring->tid) {
+                    disarm(ring);
+                }
+            }
+            drain(_recorder, pending, numeric_limits<int64_t>::max());
+            _recorder->set_sampled_until(0);
+        }
+    };
+
+#if defined(QCS_HEAP_SAMPLING)
+    /*
+        Heap tracker
+
+        Called by every allocation and release of the process, hence, the state is constant initialized (there may
+        be allocations before our constructors run) and, when not sampling, the interposed functions do a single
+        relaxed load before forwarding (see 'sampling' and 'tracking'). Otherwise the common path is a subtraction. Every
+        thread counts down the bytes left until its next sample, drawn from an exponential distribution so that
+        samples are a Poisson process over the bytes allocated. Sampled addresses are kept in a table of small
+        buckets (a cache line each) so that releases are told apart without locks; allocations not fitting in
+        their bucket are recorded anyway, their release is not.
+    */
+
+    struct heap_tracker_t {
+        static constexpr auto NUM_BUCKETS = 4096;
+        static constexpr auto BUCKET_SIZE = 8;
+        static constexpr auto MAX_FRAMES  = 128;
+
+        struct thread_state_t {
+            int64_t  countdown;  // bytes until the next sample
+            uint64_t random;     // xorshift state, 0 until seeded
+            bool     busy;       // inside the recorder (which allocates too)
+        };
+
+        static inline auto instance    = atomic<recorder_t*>{nullptr};
+        static inline auto period      = size_t{0};
+        static inline auto num_sampled = atomic<uint32_t>{0};
+        static inline auto sampled     = array<array<atomic<uintptr_t>, BUCKET_SIZE>, NUM_BUCKETS>{};
+        static inline auto lock        = std::mutex{};
+
+        static inline thread_local __attribute__((tls_model("initial-exec"))) thread_state_t state = {};
+
+        static auto sampling() -> bool {
+            return instance.load(memory_order_relaxed);
+        }
+
+        static auto tracking() -> bool {
+            return num_sampled.load(memory_order_relaxed);  // sampled allocations whose release is pending
+        }
+
+        static auto bucket_of(const void* _address) -> array<atomic<uintptr_t>, BUCKET_SIZE>& {
+            return sampled[((uintptr_t)_address * 0x9e3779b97f4a7c15ull) >> 52];  // top 12 bits
+        }
+
+        static auto next_interval() -> int64_t {
+            if (!state.random) {
+                state.random = (((uintptr_t)&state * 0x9e3779b97f4a7c15ull) ^ __rdtsc()) | 1;
+            }
+            state.random ^= state.random << 13;
+            state.random ^= state.random >> 7;
+            state.random ^= state.random << 17;
+            const auto uniform = (double)((state.random >> 11) + 1) * 0x1p-53;  // (0, 1]
+            return (int64_t)(-log(uniform) * (double)period) + 1;
+        }
+
+        __attribute__((noinline)) static void on_alloc(void* _address, size_t _size) {
+            const auto recorder = instance.load(memory_order_relaxed);
+            if (!recorder || !_address || state.busy) {
+                return;
+            }
+            if (!state.random) {
+                state.countdown = next_interval();
+            }
+            if ((state.countdown -= (int64_t)_size) >= 0) {
+                return;
+            }
+
+            state.busy      = true;
+            state.countdown = next_interval();
+
+            void* frames[MAX_FRAMES];
+            const auto num_frames = recorder_t::walk_stack(frames, MAX_FRAMES, 2);  // skips us and the interposed function
+            recorder->record_alloc(frames, num_frames, _address, _size, period);
+            for (auto& slot : bucket_of(_address)) {
+                auto empty = uintptr_t{0};
+                if (slot.compare_exchange_strong(empty, (uintptr_t)_address, memory_order_relaxed)) {
+                    num_sampled.fetch_add(1, memory_order_relaxed);
+                    break;
+                }
+            }
+            state.busy = false;
+        }
+
+        __attribute__((noinline)) static void on_free(void* _address) {
+            if (!_address || state.busy) {
+                return;
+            }
+            for (auto& slot : bucket_of(_address)) {
+                auto expected = (uintptr_t)_address;
+                if (slot.load(memory_order_relaxed) == expected && slot.compare_exchange_strong(expected, 0, memory_order_relaxed)) {
+                    num_sampled.fetch_sub(1, memory_order_relaxed);
+                    if (const auto recorder = instance.load(memory_order_relaxed)) {
+                        state.busy = true;
+                        recorder->record_free(_address);
+                        state.busy = false;
+                    }
+                    break;
+                }
+            }
+        }
+    };
+#endif
+
+}  // namespace qcstudio::callstack
+
+/*
+    Interposed allocation functions (operator new/delete end up here too, the over-aligned ones through
+    aligned_alloc), only in builds with heap sampling. glibc has no entry points of its own for aligned_alloc and
+    posix_memalign: they go to memalign's
+*/
+
+#if defined(QCS_HEAP_SAMPLING)
+extern "C" __attribute__((visibility("default"))) auto malloc(size_t _size) noexcept -> void* {
+    auto ret = __libc_malloc(_size);
+    if (qcstudio::callstack::heap_tracker_t::sampling()) {
+        qcstudio::callstack::heap_tracker_t::on_alloc(ret, _size);
+    }
+    return ret;
+}
+
+extern "C" __attribute__((visibility("default"))) auto calloc(size_t _count, size_t _size) noexcept -> void* {
+    auto ret = __libc_calloc(_count, _size);
+    if (qcstudio::callstack::heap_tracker_t::sampling()) {
+        qcstudio::callstack::heap_tracker_t::on_alloc(ret, _count * _size);
+    }
+    return ret;
+}
+
+extern "C" __attribute__((visibility("default"))) auto realloc(void* _ptr, size_t _size) noexcept -> void* {
+    // The block is only released if the call succeeds (or it is a release, with a size of 0): a failed one leaves
+    // it allocated
+
+    auto ret = __libc_realloc(_ptr, _size);
+    if ((ret || !_size) && qcstudio::callstack::heap_tracker_t::tracking()) {
+        qcstudio::callstack::heap_tracker_t::on_free(_ptr);
+    }
+    if (qcstudio::callstack::heap_tracker_t::sampling()) {
+        qcstudio::callstack::heap_tracker_t::on_alloc(ret, _size);
+    }
+    return ret;
+}
+
+extern "C" __attribute__((visibility("default"))) auto memalign(size_t _alignment, size_t _size) noexcept -> void* {
+    auto ret = __libc_memalign(_alignment, _size);
+    if (qcstudio::callstack::heap_tracker_t::sampling()) {
+        qcstudio::callstack::heap_tracker_t::on_alloc(ret, _size);
+    }
+    return ret;
+}
+
+extern "C" __attribute__((visibility("default"))) auto aligned_alloc(size_t _alignment, size_t _size) noexcept -> void* {
+    if (!_alignment || (_alignment & (_alignment - 1))) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    auto ret = __libc_memalign(_alignment, _size);
+    if (qcstudio::callstack::heap_tracker_t::sampling()) {
+        qcstudio::callstack::heap_tracker_t::on_alloc(ret, _size);
+    }
+    return ret;
+}
+
+extern "C" __attribute__((visibility("default"))) auto posix_memalign(void** _ptr, size_t _alignment, size_t _size) noexcept -> int {
+    if (_alignment % sizeof(void*) || (_alignment & (_alignment - 1))) {
+        return EINVAL;
+    }
+    auto ret = __libc_memalign(_alignment, _size);
+    if (!ret) {
+        return ENOMEM;
+    }
+    if (qcstudio::callstack::heap_tracker_t::sampling()) {
+        qcstudio::callstack::heap_tracker_t::on_alloc(ret, _size);
+    }
+    *_ptr = ret;
+    return 0;
+}
+
+extern "C" __attribute__((visibility("default"))) auto valloc(size_t _size) noexcept -> void* {
+    auto ret = __libc_valloc(_size);
+    if (qcstudio::callstack::heap_tracker_t::sampling()) {
+        qcstudio::callstack::heap_tracker_t::on_alloc(ret, _size);
+    }
+    return ret;
+}
+
+extern "C" __attribute__((visibility("default"))) auto pvalloc(size_t _size) noexcept -> void* {
+    auto ret = __libc_pvalloc(_size);
+    if (qcstudio::callstack::heap_tracker_t::sampling()) {
+        qcstudio::callstack::heap_tracker_t::on_alloc(ret, _size);
+    }
+    return ret;
+}
+
+extern "C" __attribute__((visibility("default"))) void free(void* _ptr) noexcept {
+    if (qcstudio::callstack::heap_tracker_t::tracking()) {
+        qcstudio::callstack::heap_tracker_t::on_free(_ptr);
+    }
+    __libc_free(_ptr);
+}
+#endif
+
+/*
+    The manager
+*/
+
+auto qcstudio::callstack::recorder_t::start_tracking_modules() -> bool {
+    auto guard                 = std::lock_guard(module_tracker_t::lock);
+    module_tracker_t::instance = this;
+    cookie_                    = this;
+    return true;
+}
+
+void qcstudio::callstack::recorder_t::stop_tracking_modules() {
+    auto guard = std::lock_guard(module_tracker_t::lock);
+    if (module_tracker_t::instance == this) {
+        module_tracker_t::instance = nullptr;
+    }
+    cookie_ = nullptr;
+}
+
+auto qcstudio::callstack::recorder_t::enum_modules() -> bool {
+    auto guard = std::lock_guard(module_tracker_t::lock);
+    module_tracker_t::sync();
+    return !module_tracker_t::modules().empty();
+}
+
+void qcstudio::callstack::recorder_t::check_modules(optional<int64_t> _timestamp) {
+    // The first entry of the loader's list carries its counters: stop right there and only sync if they moved
+    // (a few tens of ns). A sample is recorded after the fact, by the sampler thread, whose buffer has to stay
+    // in timestamp order: the changes are stamped as the sample
+
+    auto counters = pair<uint64_t, uint64_t>{};
+    dl_iterate_phdr(
+        [](dl_phdr_info* _info, size_t, void* _counters) -> int {
+            *(pair<uint64_t, uint64_t>*)_counters = {_info->dlpi_adds, _info->dlpi_subs};
+            return 1;
+        },
+        &counters);
+    if (counters.first != module_tracker_t::adds.load(memory_order_relaxed) || counters.second != module_tracker_t::subs.load(memory_order_relaxed)) {
+        auto guard = std::lock_guard(module_tracker_t::lock);
+        module_tracker_t::sync(_timestamp);
+    }
+}
+
+void qcstudio::callstack::recorder_t::restate_modules() {
+    // The ones we know, then whatever changed since the last sync
+
+    auto guard = std::lock_guard(module_tracker_t::lock);
+    if (module_tracker_t::instance != this) {
+        return;
+    }
+    for (auto& module : module_tracker_t::modules()) {
+        wchar_t wpath[PATH_MAX];
+        unicode::to_wide(module.path, wpath, PATH_MAX);
+        on_add_module(wpath, module.base, module.size);
+    }
+    module_tracker_t::sync();
+}
+
+auto qcstudio::callstack::recorder_t::start_sampling(unsigned _frequency) -> bool {
+    bootstrap();
+
+    auto guard = std::lock_guard(sampler_t::lock);
+    if (sampler_t::instance.load(memory_order_relaxed) || !_frequency) {
+        return false;
+    }
+
+    // The handler stays installed for good: a signal of a timer just deleted may still be on its way
+
+    if (!sampler_t::installed) {
+        struct sigaction action = {};
+        action.sa_sigaction     = sampler_t::on_signal;
+        action.sa_flags         = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGPROF, &action, &sampler_t::previous)) {
+            return false;
+        }
+        sampler_t::installed = true;
+    }
+
+    sampler_t::period = max<int64_t>(1'000'000'000 / _frequency, 1);
+    sampler_t::stop   = false;
+    set_sampled_until(now());
+    sampler_t::instance.store(this, memory_order_release);
+    sampler_t::thread = std::thread(sampler_t::loop, this);
+    return true;
+}
+
+#if defined(QCS_HEAP_SAMPLING)
+auto qcstudio::callstack::recorder_t::start_heap_sampling(size_t _period) -> bool {
+    bootstrap();
+
+    auto guard = std::lock_guard(heap_tracker_t::lock);
+    if (heap_tracker_t::instance.load(memory_order_relaxed) || !_period) {
+        return false;
+    }
+    heap_tracker_t::period = _period;
+    heap_tracker_t::instance.store(this, memory_order_release);
+    return true;
+}
+
+auto qcstudio::callstack::recorder_t::stop_heap_sampling() -> bool {
+    auto guard = std::lock_guard(heap_tracker_t::lock);
+    if (heap_tracker_t::instance.load(memory_order_relaxed) != this) {
+        return false;
+    }
+    heap_tracker_t::instance.store(nullptr, memory_order_release);
+
+    // Forget the sampled allocations: their release belongs to no recording now
+
+    for (auto& bucket : heap_tracker_t::sampled) {
+        for (auto& slot : bucket) {
+            slot.store(0, memory_order_relaxed);
+        }
+    }
+    heap_tracker_t::num_sampled.store(0, memory_order_relaxed);
+    return true;
+}
+#else
+// Not in this build (see QCS_HEAP_SAMPLING above)
+
+auto qcstudio::callstack::recorder_t::start_heap_sampling(size_t) -> bool {
+    return false;
+}
+
+auto qcstudio::callstack::recorder_t::stop_heap_sampling() -> bool {
+    return false;
+}
+#endif
+
+auto qcstudio::callstack::recorder_t::stop_sampling() -> bool {
+    auto guard = unique_lock(sampler_t::lock);
+    if (sampler_t::instance.load(memory_order_relaxed) != this) {
+        return false;
+    }
+    sampler_t::stop = true;
+    sampler_t::wake.notify_one();
+    guard.unlock();
+    sampler_t::thread.join();
+
+    sampler_t::instance.store(nullptr, memory_order_release);
+    return true;
+}
+
+__attribute__((noinline)) auto qcstudio::callstack::recorder_t::walk_stack(void** _frames, uint16_t _max_frames, uint16_t _skip) -> uint16_t {
+    // Stack limits of the current thread so that a broken chain never makes us read outside of it
+
+    thread_local auto stack_lo = uintptr_t{0}, stack_hi = uintptr_t{0};
+    if (!stack_hi) {
+        auto attr = pthread_attr_t{};
+        if (!pthread_getattr_np(pthread_self(), &attr)) {
+            auto addr = (void*)nullptr;
+            auto size = size_t{0};
+            if (!pthread_attr_getstack(&attr, &addr, &size)) {
+                stack_lo = (uintptr_t)addr;
+                stack_hi = stack_lo + size;
+            }
+            pthread_attr_destroy(&attr);
+        }
+        if (!stack_hi) {
+            return 0;
+        }
+    }
+
+    return walk_frames((uintptr_t*)__builtin_frame_address(0), stack_lo, stack_hi, _frames, _max_frames, _skip);
+}
@@ -0,0 +1,160 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Own
+
+#include "callstack-recorder.h"
+#include "dll-notification-structs.h"
+
+/*
+    Windows specific parts of the recorder:
+    - Module tracking through the loader notifications (LdrRegisterDllNotification)
+    - Module snapshot through EnumProcessModulesEx
+    - Stack walking through RtlCaptureStackBackTrace
+    - No sampling, of stacks or heap
+*/
+
+auto qcstudio::callstack::recorder_t::start_tracking_modules() -> bool {
+    auto ntdll = LoadLibraryA("ntdll.dll");
+    if (!ntdll) {
+        return false;
+    }
+
+    // internal callback
+
+    LdrDllNotification internal_callback =
+        [](ULONG _reason, PCLDR_DLL_NOTIFICATION_DATA _notification_data, PVOID _ctx) mutable {
+            const auto instance = (recorder_t*)_ctx;
+            if (_notification_data) {
+                switch (_reason) {
+                    case LDR_DLL_NOTIFICATION_REASON_LOADED: {
+                        instance->on_add_module(
+                            _notification_data->Loaded.FullDllName->Buffer,
+                            (uintptr_t)_notification_data->Loaded.DllBase,
+                            _notification_data->Loaded.SizeOfImage);
+                        break;
+                    }
+                    case LDR_DLL_NOTIFICATION_REASON_UNLOADED: {
+                        instance->on_del_module(
+                            _notification_data->Loaded.FullDllName->Buffer,
+                            (uintptr_t)_notification_data->Loaded.DllBase,
+                            _notification_data->Loaded.SizeOfImage);
+                        break;
+                    }
+                }
+            }
+        };
+
+    // retrieve reg/unreg functions
+
+    reg_   = GetProcAddress(ntdll, "LdrRegisterDllNotification");
+    unreg_ = GetProcAddress(ntdll, "LdrUnregisterDllNotification");
+    if (!reg_ || !unreg_) {
+        return false;
+    }
+
+    // register the internal callback
+
+    if (((LdrRegisterDllNotification)reg_)(0, internal_callback, this, &cookie_)) {
+        return false;
+    }
+
+    return true;
+}
+
+void qcstudio::callstack::recorder_t::stop_tracking_modules() {
+    if (cookie_ && unreg_) {
+        ((LdrUnregisterDllNotification)unreg_)(cookie_);
+    }
+    cookie_ = nullptr;
+}
+
+auto qcstudio::callstack::recorder_t::enum_modules() -> bool {
+    // First call to get the total number of modules available
+
+    auto bytes_required = DWORD{};
+    if (!EnumProcessModulesEx(GetCurrentProcess(), NULL, 0, &bytes_required, LIST_MODULES_ALL)) {
+        return false;
+    }
+
+    // Alloc space to hold all the modules
+
+    auto ok = false;
+    if (auto buffer = (LPBYTE)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, bytes_required)) {
+        auto  module_array = (HMODULE*)buffer;
+        WCHAR module_path[1024];
+
+        ok = true;  // Assume we will succeed
+        if (EnumProcessModules(GetCurrentProcess(), module_array, bytes_required, &bytes_required)) {
+            auto num_modules = bytes_required / sizeof(HMODULE);
+            for (auto i = 0u; i < num_modules; ++i) {
+                auto module_info = MODULEINFO{};
+                if (GetModuleInformation(GetCurrentProcess(), module_array[i], &module_info, sizeof(module_info))) {
+                    GetModuleFileNameW(module_array[i], module_path, 1024);
+                    on_add_module(module_path, reinterpret_cast<uintptr_t>(module_info.lpBaseOfDll), module_info.SizeOfImage);
+                } else {
+                    ok = false;
+                }
+            }
+        } else {
+            ok = false;
+        }
+
+        LocalFree(buffer);
+    }
+
+    return ok;
+}
+
+void qcstudio::callstack::recorder_t::restate_modules() {
+    enum_modules();  // (we keep no list, the snapshot is the full one already)
+}
+
+void qcstudio::callstack::recorder_t::check_modules(optional<int64_t>) {
+    // Nothing to do, the loader notifies us (see start_tracking_modules)
+}
+
+// Sampling is not implemented yet (it would take a thread suspending the others to walk their contexts)
+
+auto qcstudio::callstack::recorder_t::start_sampling(unsigned) -> bool {
+    return false;
+}
+
+auto qcstudio::callstack::recorder_t::stop_sampling() -> bool {
+    return false;
+}
+
+// Neither is heap sampling (it would take hooking the heap functions of every module)
+
+auto qcstudio::callstack::recorder_t::start_heap_sampling(size_t) -> bool {
+    return false;
+}
+
+auto qcstudio::callstack::recorder_t::stop_heap_sampling() -> bool {
+    return false;
+}
+
+auto qcstudio::callstack::recorder_t::walk_stack(void** _frames, uint16_t _max_frames, uint16_t _skip) -> uint16_t {
+    return RtlCaptureStackBackTrace(_skip + 1, _max_frames, _frames, nullptr);  // +1 skips ourselves
+}
@@ -22,207 +22,1267 @@
     SOFTWARE.
 */
 
-#pragma once
-
 // Own
 
 #include "callstack-recorder.h"
-#include "dll-notification-structs.h"
+#include "unicode.h"
+#include "mapped-file.h"
+#include "callstack-reader.h"
+#include "callstack-writer.h"
+#include "local-socket.h"
+#include "shared-memory.h"
+#include "callstack-shared.h"
 
 // C++
 
 #include <array>
 #include <vector>
+#include <queue>
+#include <new>
 #include <iostream>
 #include <chrono>
 #include <fstream>
+#include <filesystem>
+#include <cstring>
+#include <cwchar>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <limits>
+#include <optional>
+#include <cmath>
+
+// Time stamp counter
+
+#if defined(_MSC_VER)
+#    include <intrin.h>
+#else
+#    include <x86intrin.h>
+#    include <cpuid.h>
+#endif
 
 using namespace std;
 using namespace std::chrono;
 
 namespace {
-    static constexpr auto BUFFER_SIZE = 1 * 1024 * 1024;  // this should be more than enough for this example
+    static constexpr auto BUFFER_SIZE       = size_t{1 * 1024 * 1024};  // per thread; this should be more than enough for this example
+    static constexpr auto SEGMENT_SIZE      = size_t{256 * 1024};       // streaming mode
+    static constexpr auto FLUSH_PERIOD      = milliseconds{100};        // streaming mode: max delay of the events that are not in a full segment
+    static constexpr auto MAPPED_CHUNK_SIZE = size_t{16 * 1024 * 1024};  // mapped mode: file growth step (multiple of SEGMENT_SIZE)
+    static constexpr auto MIN_RING_SIZE     = size_t{64 * 1024};       // shared mode (power of 2)
+    static constexpr auto INTERN_SLOTS      = 64 * 1024;        // power of 2
+    static constexpr auto INTERN_MAX_PROBES = 32;
+    static constexpr auto CALIBRATION_SPIN   = nanoseconds{milliseconds{1}};  // first measurement of the tick frequency
+    static constexpr auto CALIBRATION_PERIOD = nanoseconds{seconds{1}};           // doubles from the spin up to this
+    static constexpr auto LATENCY_SAMPLING   = 16u;                               // one capture timed every this many (per thread)
+
+    // Time sources
+
+    inline auto wall_now() -> int64_t {
+        return duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+    }
+
+    inline auto steady_now() -> int64_t {
+        return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    inline auto ticks_now() -> int64_t {
+        return (int64_t)__rdtsc();
+    }
+
+    // Telemetry counters are only written by the thread owning them: no need for an atomic read-modify-write
+
+    inline void increase(atomic<uint64_t>& _counter, uint64_t _amount) {
+        _counter.store(_counter.load(memory_order_relaxed) + _amount, memory_order_relaxed);
+    }
+
+    // Latency bucket of a duration (see recorder_t::stats_t): exact below 8 ns, then the power of 2 and the 3 bits
+    // that follow the leading one
+
+    inline auto latency_bucket(uint64_t _ns) -> size_t {
+        if (_ns < 8) {
+            return (size_t)_ns;
+        }
+#if defined(_MSC_VER)
+        auto log = 0ul;
+        _BitScanReverse64(&log, _ns);
+#else
+        const auto log = 63 - __builtin_clzll(_ns);
+#endif
+        return (size_t)((log - 2) * 8 + ((_ns >> (log - 3)) & 7));
+    }
+
+    // Ticks at a constant rate regardless of power states and frequency changes (CPUID 0x80000007, EDX bit 8)
+
+    auto has_invariant_tsc() -> bool {
+#if defined(_MSC_VER)
+        int regs[4];
+        __cpuid(regs, 0x80000000);
+        if ((unsigned)regs[0] < 0x80000007) {
+            return false;
+        }
+        __cpuid(regs, 0x80000007);
+        return regs[3] & (1 << 8);
+#else
+        auto eax = 0u, ebx = 0u, ecx = 0u, edx = 0u;
+        return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8));
+#endif
+    }
+
+    // 64 bits hash of the frames (murmur3 finalizer per frame), see recorder_t::intern for what makes an id
+
+    auto hash_frames(void* const* _frames, uint16_t _num_frames, uint64_t _seed) -> uint64_t {
+        const auto mix = [](uint64_t _h) {
+            _h ^= _h >> 33;
+            _h *= 0xff51afd7ed558ccdull;
+            _h ^= _h >> 33;
+            _h *= 0xc4ceb9fe1a85ec53ull;
+            _h ^= _h >> 33;
+            return _h;
+        };
+        auto h = mix(_seed ^ _num_frames);
+        for (auto i = 0u; i < _num_frames; ++i) {
+            h = mix(h ^ (uint64_t)(uintptr_t)_frames[i]) + i;
+        }
+        return h ? h : 1;  // 0 is reserved for empty slots
+    }
+}
+
+/*
+    Per-thread ownership of a buffer.
+    The destructor runs on thread exit and gives the buffer back so that another thread can adopt it
+    (the events already committed stay in there until the recorder is destroyed)
+*/
+
+namespace qcstudio::callstack {
+    struct thread_buffer_owner_t {
+        recorder_t*                  recorder = nullptr;
+        recorder_t::thread_buffer_t* buffer   = nullptr;
+
+        ~thread_buffer_owner_t() {
+            if (buffer) {
+                recorder->release(buffer);
+            }
+        }
+    };
+}  // namespace qcstudio::callstack
+
+namespace {
+    thread_local auto tls_owner = qcstudio::callstack::thread_buffer_owner_t{};
 }
 
+/*
+    Streaming state.
+    It lives behind a pointer so that the global recorder keeps its constant initialization, and it is only freed
+    by the destructor so that a producer blocked on it never outlives it
+*/
+
+struct qcstudio::callstack::recorder_t::stream_t {
+    std::mutex          lock;
+    condition_variable  wake;      // streaming thread: a segment was sealed or we have to stop
+    condition_variable  recycled;  // producers blocked waiting for a segment
+    segment_t*          sealed       = nullptr;
+    segment_t*          available    = nullptr;
+    size_t              allocated    = 0;
+    size_t              max_segments = 0;
+    backpressure        policy       = backpressure::drop;
+    bool                stop         = false;
+    atomic<bool>        active       = false;
+    bool                live         = false;  // every pass ends a chunk (see start_live_streaming)
+    unique_ptr<ostream> out;                   // the file, or the connection of a live stream
+    optional<writer_t>  encoder;               // encoding state of the output (current chunk, modules, stacks)
+    std::thread         writer;
+};
+
+/*
+    Background dumps.
+    A single thread writes the snapshots in the order they were taken. Until it is done with them, streaming cannot
+    start, as it would recycle the segments they point into
+*/
+
+struct qcstudio::callstack::recorder_t::dumper_t {
+    std::mutex                   lock;
+    condition_variable           wake;  // dumping thread: a snapshot was queued or we have to stop
+    condition_variable           idle;  // every snapshot queued so far is written
+    deque<packaged_task<bool()>> pending;
+    bool                         busy = false;
+    bool                         stop = false;
+    std::thread                  writer;
+};
+
+/*
+    Mapped mode state.
+    The file is |magic(8 bytes)|segment header size(4 bytes)|reserved(4 bytes)| followed by contiguous segments,
+    each one being |committed(8 bytes)|capacity(8 bytes)|rest of the header|data(capacity bytes)|. Segments are
+    carved in order and never reused; the first one with a zero capacity marks the end of the recording. Only
+    'committed' bytes of a segment hold (whole) events, which is what makes a crashed recording readable
+*/
+
+struct qcstudio::callstack::recorder_t::mapping_t {
+    std::mutex          lock;
+    misc::mapped_file_t file;
+    uint8_t*            cursor = nullptr;  // free space left in the last mapped region
+    uint8_t*            end    = nullptr;
+
+    auto carve(size_t _length) -> segment_t* {
+        const auto stride = ((sizeof(segment_t) + _length + SEGMENT_SIZE) / SEGMENT_SIZE) * SEGMENT_SIZE;
+        if ((size_t)(end - cursor) < stride) {
+            // Fill the gap with an empty segment and map a new region
+
+            if ((size_t)(end - cursor) >= sizeof(segment_t)) {
+                auto filler      = new (cursor) segment_t{};
+                filler->capacity = (end - cursor) - sizeof(segment_t);
+            }
+            auto region = file.grow(max(MAPPED_CHUNK_SIZE, stride));
+            if (!region) {
+                return nullptr;
+            }
+            cursor = region;
+            end    = region + max(MAPPED_CHUNK_SIZE, stride);
+        }
+
+        auto segment      = new (cursor) segment_t{};
+        segment->capacity = stride - sizeof(segment_t);
+        segment->data     = cursor + sizeof(segment_t);
+        cursor += stride;
+        return segment;
+    }
+
+    auto used() const -> size_t {
+        return file.size() - (end - cursor);
+    }
+};
+
+/*
+    Shared mode state.
+    Rings are claimed as thread buffers are created, so that a buffer adopted by another thread keeps its ring. The
+    tail of the collector is only read when the last value seen leaves no room, and it is the only time a producer
+    touches a cache line the collector writes
+*/
+
+struct qcstudio::callstack::recorder_t::shared_t {
+    misc::shared_memory_t memory;
+    shared::header_t*     header = nullptr;
+    uint64_t              mask   = 0;  // ring size - 1
+
+    auto claim() -> shared::ring_t* {
+        const auto index = header->rings.fetch_add(1, memory_order_relaxed);
+        return index < header->max_rings ? shared::ring(header, index) : nullptr;
+    }
+
+    auto reserve(shared::ring_t* _ring, size_t _length) -> uint8_t* {
+        if (!_ring) {
+            header->dropped.fetch_add(1, memory_order_relaxed);
+            return nullptr;
+        }
+        auto       head   = _ring->head.load(memory_order_relaxed);
+        const auto offset = head & mask;
+        const auto skip   = offset + _length > mask + 1 ? mask + 1 - offset : 0;  // wrap it to the beginning
+        if (head + skip + _length - _ring->seen > mask + 1) {
+            _ring->seen = _ring->tail.load(memory_order_acquire);
+            if (head + skip + _length - _ring->seen > mask + 1) {
+                header->dropped.fetch_add(1, memory_order_relaxed);
+                return nullptr;
+            }
+        }
+        if (skip) {
+            _ring->data()[offset] = shared::wrap;
+            _ring->head.store(head += skip, memory_order_release);
+        }
+        return _ring->data() + (head & mask);
+    }
+
+    auto commit(shared::ring_t* _ring, const uint8_t* _end) -> size_t {
+        const auto head   = _ring->head.load(memory_order_relaxed);
+        const auto length = (size_t)(_end - (_ring->data() + (head & mask)));
+        _ring->head.store(head + length, memory_order_release);
+        return length;
+    }
+};
+
 /*
     The manager
 */
 
 void qcstudio::callstack::recorder_t::bootstrap() {
     // As the recorder recorder instance is a static variable it will be zero-initialized,
-    // hence, we can safely assume that nullptr means not initialized
+    // hence, we can safely assume that false means not initialized
     // (https://en.cppreference.com/w/cpp/language/initialization#Static_initialization)
 
-    if (!buffer_) {
-        buffer_ = (uint8_t*)malloc(BUFFER_SIZE);  // make use of malloc in order to avoid potential "new operator" overrides
-        cursor_ = 0;
+    if (!ready_.load(memory_order_acquire)) {
+        auto guard = std::lock_guard(lock_);
+        if (!ready_.load(memory_order_relaxed)) {
+            // Table of interned stacks, both generations (zeroed memory means empty slots)
+
+            interned_ = (intern_slot_t*)calloc(2 * INTERN_SLOTS, sizeof(intern_slot_t));
 
-        // Enumerate the modules and register for tracking events
+            // First calibration, before any other event is stamped with ticks
 
-        start_tracking_modules();
-        enum_modules();
+            ns_per_tick_.store(1.0, memory_order_relaxed);
+            if (auto shared = shared_.load(memory_order_relaxed)) {
+                shared->header->time_source.store((uint8_t)time_source_, memory_order_release);
+            }
+            if (time_source_ == time_source::tsc) {
+                base_ticks_  = ticks_now();
+                base_steady_ = steady_now();
+                while (steady_now() - base_steady_ < CALIBRATION_SPIN.count()) {
+                }
+                calibrate(local_buffer());
+            }
+
+            // Enumerate the modules and register for tracking events
+
+            start_tracking_modules();
+            enum_modules();
+
+            ready_.store(true, memory_order_release);
+        }
     }
 }
 
 qcstudio::callstack::recorder_t::~recorder_t() {
-    if (buffer_) {
+    stop_sampling();
+    stop_heap_sampling();
+
+    if (auto dumper = dumper_.exchange(nullptr)) {
+        {
+            auto lock    = std::lock_guard(dumper->lock);
+            dumper->stop = true;
+        }
+        dumper->wake.notify_one();
+        dumper->writer.join();  // after writing whatever was pending
+        delete dumper;
+    }
+
+    stop_streaming();
+    delete stream_.exchange(nullptr);
+
+    if (auto mapping = mapping_.exchange(nullptr)) {
+        mapping->file.close(mapping->used());  // drop the unused tail
+        delete mapping;
+    }
+
+    if (auto shared = shared_.exchange(nullptr)) {
+        shared->header->closed.store(1, memory_order_release);  // in case 'stop_sharing' was not called
+        delete shared;
+    }
+
+    if (ready_) {
         stop_tracking_modules();
-        free(buffer_);
+    }
+
+    free(interned_);
+
+    auto buffer = buffers_.exchange(nullptr);
+    while (buffer) {
+        auto next = buffer->next;
+        buffer->~thread_buffer_t();
+        free(buffer);
+        buffer = next;
+    }
+
+    auto segment = segments_.exchange(nullptr);
+    while (segment) {
+        auto next = segment->chain;
+        segment->~segment_t();
+        free(segment);
+        segment = next;
     }
 }
 
-auto qcstudio::callstack::recorder_t::start_tracking_modules() -> bool {
-    auto ntdll = LoadLibraryA("ntdll.dll");
-    if (!ntdll) {
-        return false;
+auto qcstudio::callstack::recorder_t::local_buffer() -> thread_buffer_t* {
+    if (tls_owner.recorder == this) {
+        return tls_owner.buffer;
     }
 
-    // internal callback
-
-    LdrDllNotification internal_callback =
-        [](ULONG _reason, PCLDR_DLL_NOTIFICATION_DATA _notification_data, PVOID _ctx) mutable {
-            const auto instance = (recorder_t*)_ctx;
-            if (_notification_data) {
-                switch (_reason) {
-                    case LDR_DLL_NOTIFICATION_REASON_LOADED: {
-                        instance->on_add_module(
-                            _notification_data->Loaded.FullDllName->Buffer,
-                            (uintptr_t)_notification_data->Loaded.DllBase,
-                            _notification_data->Loaded.SizeOfImage);
-                        break;
-                    }
-                    case LDR_DLL_NOTIFICATION_REASON_UNLOADED: {
-                        instance->on_del_module(
-                            _notification_data->Loaded.FullDllName->Buffer,
-                            (uintptr_t)_notification_data->Loaded.DllBase,
-                            _notification_data->Loaded.SizeOfImage);
-                        break;
-                    }
-                }
-            }
-        };
+    // Adopt a buffer released by a finished thread...
+
+    auto buffer = buffers_.load(memory_order_acquire);
+    for (; buffer; buffer = buffer->next) {
+        auto expected = false;
+        if (!buffer->in_use.load(memory_order_relaxed) && buffer->in_use.compare_exchange_strong(expected, true, memory_order_acquire)) {
+            break;
+        }
+    }
 
-    // retrieve reg/unreg functions
+    // ...or create a new one and push it to the list
 
-    reg_   = GetProcAddress(ntdll, "LdrRegisterDllNotification");
-    unreg_ = GetProcAddress(ntdll, "LdrUnregisterDllNotification");
-    if (!reg_ || !unreg_) {
-        return false;
+    if (!buffer) {
+        auto memory = malloc(sizeof(thread_buffer_t));  // make use of malloc in order to avoid potential "new operator" overrides
+        if (!memory) {
+            return nullptr;
+        }
+        buffer = new (memory) thread_buffer_t{};
+        buffer->in_use.store(true, memory_order_relaxed);
+        buffer->segment.store(nullptr, memory_order_relaxed);  // lazily assigned by 'reserve'
+        if (auto shared = shared_.load(memory_order_acquire)) {
+            buffer->ring = shared->claim();
+        }
+        buffer->next = buffers_.load(memory_order_relaxed);
+        while (!buffers_.compare_exchange_weak(buffer->next, buffer, memory_order_release, memory_order_relaxed)) {
+        }
     }
 
-    // register the internal callback
+    if (tls_owner.buffer) {
+        tls_owner.recorder->release(tls_owner.buffer);
+    }
+    tls_owner.recorder = this;
+    tls_owner.buffer   = buffer;
+    return buffer;
+}
 
-    if (((LdrRegisterDllNotification)reg_)(0, internal_callback, this, &cookie_)) {
-        return false;
+void qcstudio::callstack::recorder_t::release(thread_buffer_t* _buffer) {
+    // While streaming the segment is sealed, or an idle buffer could hold it until some thread adopts the buffer,
+    // while other threads wait for a segment (blocking policy)
+
+    if (auto stream = stream_.load(memory_order_acquire); stream && stream->active.load(memory_order_acquire)) {
+        auto lock = std::lock_guard(stream->lock);
+        if (auto current = stream->stop ? nullptr : _buffer->segment.exchange(nullptr, memory_order_acq_rel)) {
+            current->next  = stream->sealed;
+            stream->sealed = current;
+            stream->wake.notify_one();
+        }
     }
+    _buffer->in_use.store(false, memory_order_release);
+}
 
-    return true;
+auto qcstudio::callstack::recorder_t::new_segment(size_t _capacity) -> segment_t* {
+    auto memory = (uint8_t*)malloc(sizeof(segment_t) + _capacity);
+    if (!memory) {
+        return nullptr;
+    }
+    auto segment = new (memory) segment_t{};
+    segment->committed.store(0, memory_order_relaxed);
+    segment->flushed  = 0;
+    segment->capacity = _capacity;
+    segment->data     = memory + sizeof(segment_t);
+    segment->chain    = segments_.load(memory_order_relaxed);
+    while (!segments_.compare_exchange_weak(segment->chain, segment, memory_order_release, memory_order_relaxed)) {
+    }
+    return segment;
+}
+
+auto qcstudio::callstack::recorder_t::next_segment(thread_buffer_t* _buffer, size_t _length) -> segment_t* {
+    // Mapped mode: the full segment just stays in the file and a new one is carved after the last one
+
+    if (auto mapping = mapping_.load(memory_order_acquire)) {
+        const auto start = steady_now();
+        auto       guard = std::lock_guard(mapping->lock);
+        increase(_buffer->lock_wait, steady_now() - start);
+        auto segment = mapping->carve(_length);
+        if (segment) {
+            _buffer->segment.store(segment, memory_order_release);
+        }
+        return segment;
+    }
+
+    // Buffered mode: a single segment per thread, once it is full the events are dropped. Unless a stream that is
+    // over wrote it all out (its writer is gone): nothing in it is ever read again, so it goes back to the pool
+
+    auto stream = stream_.load(memory_order_acquire);
+    if (!stream || !stream->active.load(memory_order_acquire)) {
+        if (auto current = _buffer->segment.load(memory_order_relaxed)) {
+            if (!stream || current->flushed < current->committed.load(memory_order_relaxed)) {
+                return nullptr;
+            }
+            auto lock = std::lock_guard(stream->lock);
+            if (stream->active.load(memory_order_relaxed)) {
+                return nullptr;  // just started, try again with the next event
+            }
+            _buffer->segment.store(nullptr, memory_order_release);
+            current->next     = stream->available;
+            stream->available = current;
+        }
+        auto segment = new_segment(max(BUFFER_SIZE, _length));
+        _buffer->segment.store(segment, memory_order_release);
+        return segment;
+    }
+
+    // Streaming mode: seal the current segment (the streaming thread writes what is left and recycles it) and
+    // take another one from the pool, allocating it while under the limit. The stream lock also serializes us
+    // with the streaming thread's snapshot of the current segments. When dropping we never wait, not even for
+    // the lock (the next event will try again)
+
+    auto lock = unique_lock(stream->lock, defer_lock);
+    if (stream->policy == backpressure::block) {
+        const auto start = steady_now();
+        lock.lock();
+        increase(_buffer->lock_wait, steady_now() - start);
+    } else if (!lock.try_lock()) {
+        return nullptr;
+    }
+    if (stream->stop) {
+        return nullptr;
+    }
+    if (auto current = _buffer->segment.exchange(nullptr, memory_order_acq_rel)) {
+        current->next  = stream->sealed;
+        stream->sealed = current;
+        stream->wake.notify_one();
+    }
+
+    auto segment = (segment_t*)nullptr;
+    while (!segment) {
+        if (stream->available && stream->available->capacity > _length) {
+            segment           = stream->available;
+            stream->available = segment->next;
+        } else if (stream->allocated < stream->max_segments || _length >= SEGMENT_SIZE) {
+            if (!(segment = new_segment(max(SEGMENT_SIZE, _length + 1)))) {
+                return nullptr;
+            }
+            ++stream->allocated;
+        } else if (stream->policy == backpressure::block && !stream->stop) {
+            const auto start = steady_now();
+            stream->recycled.wait(lock);
+            increase(_buffer->lock_wait, steady_now() - start);
+        } else {
+            return nullptr;
+        }
+    }
+    segment->committed.store(0, memory_order_relaxed);
+    segment->flushed = 0;
+    _buffer->segment.store(segment, memory_order_release);
+    return segment;
 }
 
-void qcstudio::callstack::recorder_t::stop_tracking_modules() {
-    if (cookie_ && unreg_) {
-        ((LdrUnregisterDllNotification)unreg_)(cookie_);
+auto qcstudio::callstack::recorder_t::reserve(thread_buffer_t* _buffer, size_t _length) -> uint8_t* {
+    // Only the owner thread writes, so the committed size is also the write cursor. Events that do not fit
+    // are dropped as a whole so that every segment always contains a valid sequence of events
+
+    if (!_buffer) {
+        return nullptr;
+    }
+    if (auto shared = shared_.load(memory_order_acquire)) {
+        auto cursor = shared->reserve(_buffer->ring, _length);
+        if (!cursor) {
+            dropped_.fetch_add(1, memory_order_relaxed);
+        }
+        return cursor;
+    }
+    auto segment = _buffer->segment.load(memory_order_relaxed);
+    if (!segment || (segment->committed.load(memory_order_relaxed) + _length) >= segment->capacity) {
+        if (!(segment = next_segment(_buffer, _length))) {
+            dropped_.fetch_add(1, memory_order_relaxed);
+            return nullptr;
+        }
     }
-    cookie_ = nullptr;
+    return segment->data + segment->committed.load(memory_order_relaxed);
 }
 
-auto qcstudio::callstack::recorder_t::write(uint8_t* _data, size_t _length) -> bool {
-    // check enough space
+void qcstudio::callstack::recorder_t::commit(thread_buffer_t* _buffer, uint8_t* _end) {
+    if (_buffer->ring) {
+        increase(_buffer->bytes, shared_.load(memory_order_relaxed)->commit(_buffer->ring, _end));
+        return;
+    }
+    const auto segment = _buffer->segment.load(memory_order_relaxed);
+    increase(_buffer->bytes, _end - (segment->data + segment->committed.load(memory_order_relaxed)));
+    segment->committed.store(_end - segment->data, memory_order_release);
+}
 
-    if ((cursor_ + _length) >= BUFFER_SIZE) {
-        return false;
+void qcstudio::callstack::recorder_t::write(uint8_t*& _cursor, const void* _data, size_t _length) {
+    memcpy(_cursor, _data, _length);
+    _cursor += _length;
+}
+
+void qcstudio::callstack::recorder_t::write_merged(writer_t& _writer, vector<pair<const uint8_t*, const uint8_t*>>& _ranges, int64_t _until) {
+    // K-way merge by timestamp (events are already sorted within each range). Events from '_until' onwards are
+    // left in the ranges, whose first member ends up pointing to the first event not written
+
+    using head_t    = pair<int64_t, size_t>;  // timestamp, range index
+    const auto peek = [](const uint8_t* _event) {
+        auto timestamp = int64_t{};
+        memcpy(&timestamp, _event + 1, sizeof(timestamp));
+        return timestamp;
+    };
+    auto heads = priority_queue<head_t, vector<head_t>, greater<head_t>>{};
+    for (auto i = 0u; i < _ranges.size(); ++i) {
+        if (_ranges[i].first < _ranges[i].second) {
+            heads.push({peek(_ranges[i].first), i});
+        }
     }
+    while (!heads.empty() && heads.top().first < _until) {
+        const auto index         = heads.top().second;
+        auto& [cursor, end]      = _ranges[index];
+        heads.pop();
 
-    // copy the data to the buffer
+        _writer.write(cursor);
+        cursor += event_size(cursor);
+        if (cursor < end) {
+            heads.push({peek(cursor), index});
+        }
+    }
+}
 
-    memcpy(buffer_ + cursor_, _data, _length);
-    cursor_ += _length;
+auto qcstudio::callstack::recorder_t::event_size(const uint8_t* _event) -> size_t {
+    // |event(1 byte)|timestamp(8 bytes)|count(2 bytes)|... (except for the interned stack events, see the header)
 
-    return true;
+    auto count = uint16_t{};
+    memcpy(&count, _event + 1 + sizeof(int64_t), sizeof(count));
+    const auto header = 1 + sizeof(int64_t) + sizeof(count);
+    switch (*_event) {
+        case event::add_module: return header + count * sizeof(wchar_t) + sizeof(uintptr_t) + sizeof(uint32_t);
+        case event::del_module: return header + count * sizeof(wchar_t);
+        case event::callstack: return header + count * sizeof(void*);
+        case event::stack_def: {
+            memcpy(&count, _event + 1 + sizeof(int64_t) + sizeof(uint32_t), sizeof(count));
+            return header + sizeof(uint32_t) + count * sizeof(void*);
+        }
+        case event::callstack_ref: return 1 + sizeof(int64_t) + sizeof(uint32_t);
+        case event::calibration: return 1 + sizeof(int64_t) + sizeof(int64_t) + sizeof(uint64_t);
+        case event::heap_alloc: {
+            memcpy(&count, _event + 1 + sizeof(int64_t) + sizeof(void*) + 2 * sizeof(uint64_t), sizeof(count));
+            return header + sizeof(void*) + 2 * sizeof(uint64_t) + count * sizeof(void*);
+        }
+        case event::heap_free: return 1 + sizeof(int64_t) + sizeof(void*);
+        case event::telemetry: {
+            const auto counters = 1 + sizeof(int64_t) + 5 * sizeof(uint64_t) + sizeof(uint32_t);
+            memcpy(&count, _event + counters, sizeof(count));
+            return counters + sizeof(count) + count * sizeof(uint64_t);
+        }
+    }
+    return 0;
 }
 
 void qcstudio::callstack::recorder_t::capture() {
+    void* frames[max_depth];
+    capture(frames, max_depth, 1);
+}
+
+void qcstudio::callstack::recorder_t::capture(uint16_t _max_depth, uint16_t _skip) {
+    void* frames[max_depth];
+    capture(frames, min(_max_depth, max_depth), _skip + 1);
+}
+
+void qcstudio::callstack::recorder_t::capture(void** _frames, uint16_t _max_frames, uint16_t _skip) {
     bootstrap();
 
-    auto guard     = std::lock_guard(lock_);
-    auto buffer    = array<void*, 200>{};
-    auto num_addrs = RtlCaptureStackBackTrace(1, (DWORD)buffer.size(), buffer.data(), nullptr);
-    auto timestamp = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+    // Only some captures are timed, reading the clock twice more is not free
+
+    const auto local = local_buffer();
+    const auto timed = local && local->captures.load(memory_order_relaxed) % LATENCY_SAMPLING == 0;
+    const auto start = timed ? now() : 0;
 
-    write(event::callstack);
-    write(timestamp);
-    write((uint16_t)num_addrs);                                 // 2 bytes
-    write((uint8_t*)buffer.data(), num_addrs * sizeof(void*));  // n bytes (#addrs * size_of_addr)
+    const auto num_frames = walk_stack(_frames, _max_frames, _skip + 1);
+    record(_frames, num_frames);
+
+    if (timed) {
+        const auto elapsed = (double)(now() - start) * ns_per_tick_.load(memory_order_relaxed);
+        increase(local->latency[latency_bucket(elapsed > 0 ? (uint64_t)elapsed : 0)], 1);
+    }
+}
+
+void qcstudio::callstack::recorder_t::record(void* const* _frames, uint16_t _num_frames, optional<int64_t> _timestamp) {
+    check_modules(_timestamp);  // so that the module of any frame is recorded before the capture (and no later)
+
+    // Time for a new calibration? (only one thread gets to write it). Checked before the capture is stamped, as
+    // the calibration goes first in the thread buffer; a sample (older than now) stamps it with its own timestamp
+
+    const auto local = local_buffer();
+    if (time_source_ == time_source::tsc) {
+        if (auto next = next_calibration_.load(memory_order_relaxed); (_timestamp ? *_timestamp : ticks_now()) >= next) {
+            if (next_calibration_.compare_exchange_strong(next, numeric_limits<int64_t>::max(), memory_order_relaxed)) {
+                calibrate(local, _timestamp);
+            }
+        }
+    }
+
+    const auto interning = intern(_frames, _num_frames);
+    const auto id        = interning.id;
+    auto       result    = interning.result;
+    auto       timestamp = _timestamp ? *_timestamp : now();  // after interning so that a reference is never older than its definition
+    if (result == intern_result::referenced) {
+        auto&      slot    = interned_[id];
+        const auto defined = slot.timestamp.load(memory_order_relaxed);  // (nor stamped alike, whose order is up to the merge,
+        atomic_thread_fence(memory_order_acquire);                        // nor defined in a stream that is over, nor one
+        if (slot.key.load(memory_order_relaxed) != interning.key || defined >= timestamp || defined < restated_.load(memory_order_acquire)) {  // of a slot taken again)
+            result = intern_result::unavailable;
+        }
+    }
+
+    if (local) {
+        increase(local->captures, 1);
+        if (result == intern_result::full) {
+            increase(local->uninterned, 1);
+        }
+    }
+    switch (result) {
+        case intern_result::referenced: {
+            if (auto cursor = reserve(local, 1 + sizeof(timestamp) + sizeof(id))) {
+                write(cursor, event::callstack_ref);
+                write(cursor, timestamp);
+                write(cursor, id);  // 4 bytes
+                commit(local, cursor);
+            }
+            break;
+        }
+        case intern_result::defining: {
+            auto defined = false;
+            if (auto cursor = reserve(local, 1 + sizeof(timestamp) + sizeof(id) + sizeof(uint16_t) + _num_frames * sizeof(void*))) {
+                write(cursor, event::stack_def);
+                write(cursor, timestamp);
+                write(cursor, id);                                    // 4 bytes
+                write(cursor, _num_frames);                           // 2 bytes
+                write(cursor, _frames, _num_frames * sizeof(void*));  // n bytes (#addrs * size_of_addr)
+                commit(local, cursor);
+                defined = true;
+            }
+            publish(interning, defined, timestamp);
+            break;
+        }
+        case intern_result::unavailable:
+        case intern_result::full: {
+            if (auto cursor = reserve(local, 1 + sizeof(timestamp) + sizeof(uint16_t) + _num_frames * sizeof(void*))) {
+                write(cursor, event::callstack);
+                write(cursor, timestamp);
+                write(cursor, _num_frames);                           // 2 bytes
+                write(cursor, _frames, _num_frames * sizeof(void*));  // n bytes (#addrs * size_of_addr)
+                commit(local, cursor);
+            }
+            break;
+        }
+    }
+}
+
+void qcstudio::callstack::recorder_t::record_alloc(void* const* _frames, uint16_t _num_frames, const void* _address, size_t _size, size_t _period) {
+    const auto local     = local_buffer();
+    const auto timestamp = now();
+    if (auto cursor = reserve(local, 1 + sizeof(timestamp) + sizeof(_address) + 2 * sizeof(uint64_t) + sizeof(uint16_t) + _num_frames * sizeof(void*))) {
+        write(cursor, event::heap_alloc);
+        write(cursor, timestamp);
+        write(cursor, _address);                              // 4/8 bytes
+        write(cursor, (uint64_t)_size);                       // 8 bytes
+        write(cursor, (uint64_t)_period);                     // 8 bytes
+        write(cursor, _num_frames);                           // 2 bytes
+        write(cursor, _frames, _num_frames * sizeof(void*));  // n bytes (#addrs * size_of_addr)
+        commit(local, cursor);
+    }
+}
+
+void qcstudio::callstack::recorder_t::record_free(const void* _address) {
+    const auto local     = local_buffer();
+    const auto timestamp = now();
+    if (auto cursor = reserve(local, 1 + sizeof(timestamp) + sizeof(_address))) {
+        write(cursor, event::heap_free);
+        write(cursor, timestamp);
+        write(cursor, _address);  // 4/8 bytes
+        commit(local, cursor);
+    }
+}
+
+auto qcstudio::callstack::recorder_t::intern(void* const* _frames, uint16_t _num_frames) -> interning_t {
+    if (!interned_) {
+        return {0, intern_result::unavailable, 0};
+    }
+
+    // The key is |1(1 bit)|hash bits 62 to 18|number of frames(16 bits)|state(2 bits)|, the low bits of the hash
+    // being the slot index, so that two different stacks only share an id if they are as deep and their hashes
+    // match in 61 bits (a collision is not detected, it would replay one stack for the other). The top bit
+    // keeps keys away from 0
+
+    const auto epoch      = module_epoch_.load(memory_order_acquire);
+    const auto generation = epoch & 1;
+    const auto hash       = hash_frames(_frames, _num_frames, epoch);
+    const auto key        = ((hash | 1ull << 63) & ~0x3ffffull) | (uint64_t)_num_frames << 2;
+    auto       index      = (uint32_t)(hash & (INTERN_SLOTS - 1));
+    for (auto probe = 0; probe < INTERN_MAX_PROBES; ++probe, index = (index + 1) & (INTERN_SLOTS - 1)) {
+        const auto id      = generation * INTERN_SLOTS + index;
+        auto&      slot    = interned_[id];
+        auto       current = slot.key.load(memory_order_acquire);
+        if (!current) {
+            // Claimed as a definition in flight, which keeps the generation from being emptied (see
+            // 'next_module_epoch'), unless the epoch moved on and it may be being emptied already
+
+            defining_[generation].fetch_add(1, memory_order_seq_cst);
+            if (module_epoch_.load(memory_order_seq_cst) != epoch) {
+                defining_[generation].fetch_sub(1, memory_order_release);
+                return {0, intern_result::unavailable, 0};
+            }
+            if (slot.key.compare_exchange_strong(current, key, memory_order_acq_rel)) {
+                claimed_[generation].fetch_add(1, memory_order_relaxed);
+                return {id, intern_result::defining, key};  // freshly claimed (state stays 'defining' until published)
+            }
+            defining_[generation].fetch_sub(1, memory_order_release);  // someone else's now
+        }
+        if ((current & ~uint64_t{3}) == key) {
+            const auto state = (intern_result)(current & 3);  // 'defining': not published yet
+            return {id, state == intern_result::referenced ? intern_result::referenced : intern_result::unavailable, current};
+        }
+    }
+    return {0, intern_result::full, 0};
+}
+
+void qcstudio::callstack::recorder_t::publish(const interning_t& _interning, bool _defined, int64_t _timestamp) {
+    // The timestamp goes first, for the references to find it
+
+    auto& slot = interned_[_interning.id];
+    slot.timestamp.store(_timestamp, memory_order_relaxed);
+    slot.key.store(_interning.key | (uint64_t)(_defined ? intern_result::referenced : intern_result::unavailable), memory_order_release);
+    defining_[_interning.id / INTERN_SLOTS].fetch_sub(1, memory_order_release);
+}
+
+void qcstudio::callstack::recorder_t::next_module_epoch() {
+    // The new epoch interns into the generation of the previous one, emptied first unless a definition is still in
+    // flight there: it then stays as it is (stale keys take room but never match) until the next change. Only the
+    // keys go, a slot has no timestamp until its key is published
+
+    auto       guard      = std::lock_guard(epoch_lock_);
+    const auto epoch      = module_epoch_.load(memory_order_relaxed) + 1;
+    const auto generation = epoch & 1;
+    if (interned_ && !defining_[generation].load(memory_order_seq_cst) && claimed_[generation].load(memory_order_relaxed)) {
+        for (auto i = generation * INTERN_SLOTS; i < (generation + 1) * INTERN_SLOTS; ++i) {
+            interned_[i].key.store(0, memory_order_relaxed);
+        }
+        claimed_[generation].store(0, memory_order_relaxed);
+    }
+    module_epoch_.store(epoch, memory_order_seq_cst);
 }
 
 auto qcstudio::callstack::recorder_t::dump(const wchar_t* _filename) -> bool {
-    if (buffer_) {
-        if (auto file = std::ofstream(_filename, ios_base::binary | ios_base::out)) {
-            auto guard = std::lock_guard(lock_);
-            file.write((const char*)buffer_, cursor_);
-            return true;
+    return dump_async(_filename).get();
+}
+
+auto qcstudio::callstack::recorder_t::dump_async(const wchar_t* _filename) -> future<bool> {
+    auto guard  = std::lock_guard(lock_);
+    auto task   = snapshot(_filename);
+    auto result = task.get_future();
+
+    auto dumper = dumper_.load(memory_order_acquire);
+    if (!dumper) {
+        dumper         = new dumper_t{};
+        dumper->writer = std::thread(&recorder_t::dump_loop, this, dumper);
+        dumper_.store(dumper, memory_order_release);
+    }
+    {
+        auto lock = std::lock_guard(dumper->lock);
+        dumper->pending.push_back(std::move(task));
+    }
+    dumper->wake.notify_one();
+    return result;
+}
+
+auto qcstudio::callstack::recorder_t::snapshot(const wchar_t* _filename) -> packaged_task<bool()> {
+    // Called under the lock, so that streaming cannot start before the snapshot is queued
+
+    if (!ready_.load(memory_order_acquire)) {
+        return packaged_task<bool()>([] { return false; });
+    }
+    if (auto stream = stream_.load(memory_order_acquire); stream && stream->active.load(memory_order_acquire)) {
+        return packaged_task<bool()>([] { return false; });  // the events are already going to the stream file
+    }
+    if (auto mapping = mapping_.load(memory_order_acquire)) {
+        return packaged_task<bool()>([mapping] { return mapping->file.sync(); });  // the events are already in the mapped file
+    }
+    if (shared_.load(memory_order_acquire)) {
+        return packaged_task<bool()>([] { return false; });  // the events are going to the collector
+    }
+
+    // What every thread has committed so far (threads keep capturing meanwhile) skipping whatever a previous
+    // streaming session already wrote out (the modules and the stacks it defined were restated when it stopped).
+    // Events stamped after the cut are left out, as in 'stream_loop': the buffers are read one after the other,
+    // and one read early may lack the definition of a stack (or the module) a capture in a later one refers to.
+    // The telemetry is taken now too, so that it matches the events
+
+    const auto until  = now();
+    auto       ranges = vector<pair<const uint8_t*, const uint8_t*>>{};
+    for (auto buffer = buffers_.load(memory_order_acquire); buffer; buffer = buffer->next) {
+        if (const auto segment = buffer->segment.load(memory_order_acquire)) {
+            ranges.push_back({segment->data + segment->flushed, segment->data + segment->committed.load(memory_order_acquire)});
         }
     }
-    return false;
+    return packaged_task<bool()>([filename = wstring(_filename), ranges = std::move(ranges), until, codec = compress_ ? format::codec::lz : format::codec::none, telemetry = telemetry_event()]() mutable {
+        auto file = std::ofstream(unicode::native_path(filename.c_str()), ios_base::binary | ios_base::out);
+        if (!file) {
+            return false;
+        }
+        auto writer = writer_t{file, codec};
+        write_merged(writer, ranges, until);
+        writer.write(telemetry.data());
+        writer.finish();
+        file.close();
+        return !file.fail();
+    });
 }
 
-void qcstudio::callstack::recorder_t::on_add_module(const wchar_t* _path, uintptr_t _base_addr, size_t _size) {
-    auto guard     = std::lock_guard(lock_);
-    auto timestamp = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
-    write(event::add_module);
-    write(timestamp);
-    const auto len = (uint16_t)wcslen(_path);
-    write(len);
-    write((uint8_t*)_path, len * sizeof(wchar_t));
-    write(_base_addr);
-    write((uint32_t)_size);
+void qcstudio::callstack::recorder_t::dump_loop(dumper_t* _dumper) {
+    auto lock = unique_lock(_dumper->lock);
+    for (;;) {
+        _dumper->wake.wait(lock, [&] { return !_dumper->pending.empty() || _dumper->stop; });
+        if (_dumper->pending.empty()) {
+            break;  // stopping, and nothing left to write
+        }
+        auto task = std::move(_dumper->pending.front());
+        _dumper->pending.pop_front();
+        _dumper->busy = true;
+        lock.unlock();
+
+        task();
+
+        lock.lock();
+        _dumper->busy = false;
+        _dumper->idle.notify_all();
+    }
 }
 
-void qcstudio::callstack::recorder_t::on_del_module(const wchar_t* _path, uintptr_t _base_addr, size_t _size) {
-    auto guard     = std::lock_guard(lock_);
-    auto timestamp = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
-    write(event::del_module);
-    write(timestamp);
-    const auto len = (uint16_t)wcslen(_path);
-    write(len);
-    write((uint8_t*)_path, len * sizeof(wchar_t));
+void qcstudio::callstack::recorder_t::wait_dumps() {
+    if (auto dumper = dumper_.load(memory_order_acquire)) {
+        auto lock = unique_lock(dumper->lock);
+        dumper->idle.wait(lock, [&] { return dumper->pending.empty() && !dumper->busy; });
+    }
 }
 
-auto qcstudio::callstack::recorder_t::enum_modules() -> bool {
-    // First call to get the total number of modules available
+auto qcstudio::callstack::recorder_t::start_streaming(const wchar_t* _filename, backpressure _policy, size_t _max_segments) -> bool {
+    const auto open = [&]() -> unique_ptr<ostream> {
+        auto file = make_unique<std::ofstream>(unicode::native_path(_filename), ios_base::binary | ios_base::out);
+        return *file ? std::move(file) : nullptr;
+    };
+    return start_stream(open, false, _policy, _max_segments);
+}
+
+auto qcstudio::callstack::recorder_t::start_live_streaming(const wchar_t* _address, backpressure _policy, size_t _max_segments) -> bool {
+    const auto open = [&]() -> unique_ptr<ostream> {
+        auto connection = make_unique<misc::local_ostream_t>();
+        return connection->connect(_address) ? std::move(connection) : nullptr;
+    };
+    return start_stream(open, true, _policy, _max_segments);
+}
+
+auto qcstudio::callstack::recorder_t::start_stream(const function<unique_ptr<ostream>()>& _open, bool _live, backpressure _policy, size_t _max_segments) -> bool {
+    bootstrap();  // so that the module snapshot goes into the stream
+
+    auto guard  = std::lock_guard(lock_);
+    auto stream = stream_.load(memory_order_acquire);
+    if ((stream && stream->active.load(memory_order_relaxed)) || mapping_.load(memory_order_relaxed) || shared_.load(memory_order_relaxed)) {
+        return false;
+    }
+    wait_dumps();  // they point into the segments that streaming recycles
+    if (!stream) {
+        stream = new stream_t{};
+        stream_.store(stream, memory_order_release);
+    }
+
+    stream->out = _open();
+    if (!stream->out) {
+        return false;
+    }
+    stream->encoder.emplace(*stream->out, compress_ ? format::codec::lz : format::codec::none, format::chunk_size, !_live);
+    stream->live         = _live;
+    stream->policy       = _policy;
+    stream->max_segments = _max_segments;
+    stream->stop         = false;
+    stream->active.store(true, memory_order_release);
+    stream->writer = std::thread(&recorder_t::stream_loop, this, stream);
+    return true;
+}
 
-    auto bytes_required = DWORD{};
-    if (!EnumProcessModulesEx(GetCurrentProcess(), NULL, 0, &bytes_required, LIST_MODULES_ALL)) {
+auto qcstudio::callstack::recorder_t::stop_streaming() -> bool {
+    auto guard  = std::lock_guard(lock_);
+    auto stream = stream_.load(memory_order_acquire);
+    if (!stream || !stream->active.load(memory_order_relaxed)) {
         return false;
     }
 
-    // Alloc space to hold all the modules
+    {
+        auto lock    = std::lock_guard(stream->lock);
+        stream->stop = true;
+        stream->active.store(false, memory_order_release);
+    }
+    stream->wake.notify_one();
+    stream->recycled.notify_all();
+    stream->writer.join();
 
-    auto ok = false;
-    if (auto buffer = (LPBYTE)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, bytes_required)) {
-        auto  module_array = (HMODULE*)buffer;
-        WCHAR module_path[1024];
+    stream->encoder->write(telemetry_event().data());
+    stream->encoder.reset();  // finishes the recording
+    stream->out->flush();
+    const auto ok = !stream->out->fail();
+    stream->out.reset();
 
-        ok = true;  // Assume we will succeed
-        if (EnumProcessModules(GetCurrentProcess(), module_array, bytes_required, &bytes_required)) {
-            auto num_modules = bytes_required / sizeof(HMODULE);
-            for (auto i = 0u; i < num_modules; ++i) {
-                auto module_info = MODULEINFO{};
-                if (GetModuleInformation(GetCurrentProcess(), module_array[i], &module_info, sizeof(module_info))) {
-                    GetModuleFileNameW(module_array[i], module_path, 1024);
-                    on_add_module(module_path, reinterpret_cast<uintptr_t>(module_info.lpBaseOfDll), module_info.SizeOfImage);
-                } else {
-                    ok = false;
-                }
+    restate();  // for whatever comes next, all that was written out is gone
+    return ok;
+}
+
+void qcstudio::callstack::recorder_t::restate() {
+    // New ids first, then the cut: a capture that still got an id of before references a definition older than
+    // the cut and writes the whole stack instead. The modules follow, stamped after the cut
+
+    next_module_epoch();
+    restated_.store(now(), memory_order_release);
+    restate_modules();
+}
+
+void qcstudio::callstack::recorder_t::stream_loop(stream_t* _stream) {
+    // Every pass writes the sealed segments plus whatever was committed so far in the current ones, all merged
+    // by timestamp so that the file keeps the same global ordering as 'dump'. Events stamped after the pass
+    // started are left for the next one, as a thread may still be about to commit older ones (or the definition
+    // of a stack another thread already references), and so are those the sampler has not drained yet. The file
+    // is only written with the lock released; capturing threads can seal (and grab recycled segments) meanwhile
+
+    auto lock = unique_lock(_stream->lock);
+    for (;;) {
+        _stream->wake.wait_for(lock, FLUSH_PERIOD, [&] { return _stream->sealed || _stream->stop; });
+        const auto stop    = _stream->stop;
+        const auto sampled = sampled_until_.load(memory_order_acquire);
+        const auto until   = stop ? numeric_limits<int64_t>::max() : sampled ? min(now(), sampled) : now();
+        auto       sealed  = exchange(_stream->sealed, nullptr);
+
+        auto segments = vector<segment_t*>{};
+        auto ranges   = vector<pair<const uint8_t*, const uint8_t*>>{};
+        const auto add = [&](segment_t* _segment) {
+            segments.push_back(_segment);
+            ranges.push_back({_segment->data + _segment->flushed, _segment->data + _segment->committed.load(memory_order_acquire)});
+        };
+        for (auto segment = sealed; segment; segment = segment->next) {
+            add(segment);
+        }
+        for (auto buffer = buffers_.load(memory_order_acquire); buffer; buffer = buffer->next) {
+            if (const auto segment = buffer->segment.load(memory_order_acquire)) {
+                add(segment);
             }
-        } else {
-            ok = false;
         }
+        lock.unlock();
 
-        LocalFree(buffer);
+        write_merged(*_stream->encoder, ranges, until);
+        if (_stream->live) {
+            _stream->encoder->flush();
+        }
+        _stream->out->flush();
+        for (auto i = 0u; i < segments.size(); ++i) {
+            segments[i]->flushed = ranges[i].first - segments[i]->data;
+        }
+
+        // Recycle the sealed segments fully written, the rest go back for the next pass
+
+        lock.lock();
+        while (sealed) {
+            auto next = sealed->next;
+            if (sealed->flushed == sealed->committed.load(memory_order_relaxed)) {
+                sealed->next       = _stream->available;
+                _stream->available = sealed;
+            } else {
+                sealed->next    = _stream->sealed;
+                _stream->sealed = sealed;
+            }
+            sealed = next;
+        }
+        _stream->recycled.notify_all();
+        if (stop) {
+            break;
+        }
     }
+}
 
-    return ok;
+auto qcstudio::callstack::recorder_t::start_mapping(const wchar_t* _filename) -> bool {
+    auto guard = std::lock_guard(lock_);
+    if (ready_.load(memory_order_relaxed) || mapping_.load(memory_order_relaxed) || shared_.load(memory_order_relaxed)) {
+        return false;  // too late, something may have been captured already
+    }
+
+    auto mapping = new mapping_t{};
+    auto region  = mapping->file.create(_filename) ? mapping->file.grow(MAPPED_CHUNK_SIZE) : nullptr;
+    if (!region) {
+        delete mapping;
+        return false;
+    }
+    auto cursor = region;
+    write(cursor, mapped_magic, sizeof(mapped_magic));
+    write(cursor, (uint32_t)sizeof(segment_t));
+    write(cursor, uint32_t{0});
+    mapping->cursor = cursor;
+    mapping->end    = region + MAPPED_CHUNK_SIZE;
+
+    mapping_.store(mapping, memory_order_release);
+    return true;
+}
+
+auto qcstudio::callstack::recorder_t::start_sharing(const wchar_t* _name, size_t _ring_size, uint32_t _max_threads) -> bool {
+    auto guard = std::lock_guard(lock_);
+    if (ready_.load(memory_order_relaxed) || mapping_.load(memory_order_relaxed) || shared_.load(memory_order_relaxed) || !_max_threads) {
+        return false;  // too late, something may have been captured already
+    }
+
+    // Every ring starts at a cache line and is left zeroed, i.e. empty
+
+    auto ring_size = MIN_RING_SIZE;
+    while (ring_size < _ring_size && ring_size < (size_t{1} << 40)) {
+        ring_size *= 2;
+    }
+    const auto header_size = (sizeof(shared::header_t) + shared::line - 1) / shared::line * shared::line;
+    const auto stride      = sizeof(shared::ring_t) + ring_size;
+
+    auto shared = new shared_t{};
+    auto memory = shared->memory.create(_name, header_size + _max_threads * stride);
+    if (!memory) {
+        delete shared;
+        return false;
+    }
+    auto header         = new (memory) shared::header_t{};
+    header->header_size = (uint32_t)header_size;
+    header->max_rings   = _max_threads;
+    header->ring_size   = ring_size;
+    header->ring_stride = stride;
+    header->owner       = misc::current_process();
+    header->time_source.store((uint8_t)time_source_, memory_order_relaxed);
+    header->magic.store(shared::magic_number(), memory_order_release);  // last, a collector may be polling for it
+
+    shared->header = header;
+    shared->mask   = ring_size - 1;
+    shared_.store(shared, memory_order_release);
+    return true;
+}
+
+auto qcstudio::callstack::recorder_t::stop_sharing() -> bool {
+    auto guard  = std::lock_guard(lock_);
+    auto shared = shared_.load(memory_order_acquire);
+    if (!shared || shared->header->closed.load(memory_order_relaxed)) {
+        return false;
+    }
+
+    // The telemetry goes through the ring of the calling thread, as any other event
+
+    const auto telemetry = telemetry_event();
+    const auto local     = local_buffer();
+    if (auto cursor = reserve(local, telemetry.size())) {
+        write(cursor, telemetry.data(), telemetry.size());
+        commit(local, cursor);
+    }
+    shared->header->closed.store(1, memory_order_release);
+    return true;
+}
+
+void qcstudio::callstack::recorder_t::set_sampled_until(int64_t _until) {
+    sampled_until_.store(_until, memory_order_release);
+    if (auto shared = shared_.load(memory_order_acquire)) {
+        shared->header->sampled_until.store(_until, memory_order_release);
+    }
+}
+
+auto qcstudio::callstack::recorder_t::recover(const wchar_t* _filename, ostream& _out) -> bool {
+    auto reader = reader_t{};
+    if (!reader.open(_filename) || !reader.mapped()) {
+        return false;
+    }
+    auto writer = writer_t{_out};
+    for (auto event = event_t{}; reader.next(event);) {
+        writer.write(event.raw);
+    }
+    writer.finish();
+    return (bool)_out;
+}
+
+auto qcstudio::callstack::recorder_t::dropped_events() const -> uint64_t {
+    return dropped_.load(memory_order_relaxed);
+}
+
+auto qcstudio::callstack::recorder_t::stats() const -> stats_t {
+    auto ret    = stats_t{};
+    ret.dropped = dropped_.load(memory_order_relaxed);
+    for (auto buffer = buffers_.load(memory_order_acquire); buffer; buffer = buffer->next) {
+        ++ret.threads;
+        ret.captures += buffer->captures.load(memory_order_relaxed);
+        ret.bytes += buffer->bytes.load(memory_order_relaxed);
+        ret.lock_wait += buffer->lock_wait.load(memory_order_relaxed);
+        ret.uninterned += buffer->uninterned.load(memory_order_relaxed);
+        for (auto i = 0u; i < stats_t::latency_buckets; ++i) {
+            ret.latency[i] += buffer->latency[i].load(memory_order_relaxed);
+        }
+    }
+    return ret;
+}
+
+auto qcstudio::callstack::recorder_t::telemetry_event() const -> vector<uint8_t> {
+    // The last event of the recording, stamped after everything else
+
+    const auto stats  = this->stats();
+    auto       data   = vector<uint8_t>(1 + sizeof(int64_t) + 5 * sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint16_t) + sizeof(stats.latency));
+    auto       cursor = data.data();
+    write(cursor, event::telemetry);
+    write(cursor, now());
+    write(cursor, stats.captures);
+    write(cursor, stats.dropped);
+    write(cursor, stats.bytes);
+    write(cursor, stats.lock_wait);
+    write(cursor, stats.uninterned);
+    write(cursor, stats.threads);
+    write(cursor, (uint16_t)stats.latency.size());
+    write(cursor, stats.latency.data(), sizeof(stats.latency));
+    return data;
+}
+
+/*
+    Time sources
+*/
+
+auto qcstudio::callstack::recorder_t::set_time_source(time_source _source) -> bool {
+    auto guard = std::lock_guard(lock_);
+    if (ready_.load(memory_order_relaxed)) {
+        return false;  // too late, timestamps are already being written
+    }
+    if (_source == time_source::tsc && !has_invariant_tsc()) {
+        return false;
+    }
+    time_source_ = _source;
+    return true;
+}
+
+void qcstudio::callstack::recorder_t::set_compression(bool _enabled) {
+    auto guard = std::lock_guard(lock_);
+    compress_  = _enabled;
+}
+
+auto qcstudio::callstack::recorder_t::now() const -> int64_t {
+    return time_source_ == time_source::tsc ? ticks_now() : wall_now();
+}
+
+void qcstudio::callstack::recorder_t::calibrate(thread_buffer_t* _buffer, optional<int64_t> _timestamp) {
+    // The longer the interval since the first calibration, the better the frequency, hence, calibrations are
+    // frequent at first (so that the early estimates are not extrapolated for long) and then every second.
+    // Stamped earlier than now (see 'record'), the wall clock goes back as many ticks
+
+    const auto now_ticks = ticks_now();
+    const auto now_wall  = wall_now();
+    const auto frequency = (double)(now_ticks - base_ticks_) * 1e9 / (double)max<int64_t>(steady_now() - base_steady_, 1);
+    ns_per_tick_.store(1e9 / frequency, memory_order_relaxed);
+    calibration_period_ = min<int64_t>(max<int64_t>(calibration_period_ * 2, CALIBRATION_SPIN.count()), CALIBRATION_PERIOD.count());
+    next_calibration_.store(now_ticks + (int64_t)(frequency * (double)calibration_period_ / 1e9), memory_order_relaxed);
+
+    const auto ticks = _timestamp ? min(*_timestamp, now_ticks) : now_ticks;
+    const auto wall  = now_wall - (int64_t)((double)(now_ticks - ticks) * 1e9 / frequency);
+    if (auto cursor = reserve(_buffer, 1 + sizeof(ticks) + sizeof(wall) + sizeof(uint64_t))) {
+        write(cursor, event::calibration);
+        write(cursor, ticks);
+        write(cursor, wall);
+        write(cursor, (uint64_t)llround(frequency));
+        commit(_buffer, cursor);
+    }
+}
+
+void qcstudio::callstack::recorder_t::on_add_module(const wchar_t* _path, uintptr_t _base_addr, size_t _size, optional<int64_t> _timestamp) {
+    next_module_epoch();
+    auto       timestamp = _timestamp ? *_timestamp : now();
+    const auto len       = (uint16_t)wcslen(_path);
+    const auto local     = local_buffer();
+    if (auto cursor = reserve(local, 1 + sizeof(timestamp) + sizeof(len) + len * sizeof(wchar_t) + sizeof(_base_addr) + sizeof(uint32_t))) {
+        write(cursor, event::add_module);
+        write(cursor, timestamp);
+        write(cursor, len);
+        write(cursor, _path, len * sizeof(wchar_t));
+        write(cursor, _base_addr);
+        write(cursor, (uint32_t)_size);
+        commit(local, cursor);
+    }
+}
+
+void qcstudio::callstack::recorder_t::on_del_module(const wchar_t* _path, uintptr_t, size_t, optional<int64_t> _timestamp) {
+    next_module_epoch();
+    auto       timestamp = _timestamp ? *_timestamp : now();
+    const auto len       = (uint16_t)wcslen(_path);
+    const auto local     = local_buffer();
+    if (auto cursor = reserve(local, 1 + sizeof(timestamp) + sizeof(len) + len * sizeof(wchar_t))) {
+        write(cursor, event::del_module);
+        write(cursor, timestamp);
+        write(cursor, len);
+        write(cursor, _path, len * sizeof(wchar_t));
+        commit(local, cursor);
+    }
 }
 
 /*
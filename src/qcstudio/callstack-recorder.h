@@ -25,15 +25,38 @@
 #pragma once
 
 #include <mutex>
+#include <array>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <iosfwd>
+#include <optional>
+#include <limits>
+#include <future>
 
-#pragma warning(disable : 4251)
+#if defined(_MSC_VER)
+#    pragma warning(disable : 4251)
+#endif
 #pragma push_macro("QCS_API")
 #undef QCS_API
-#if defined(BUILDING_QCSTUDIO)
+#if !defined(_WIN32)
+#    define QCS_API __attribute__((visibility("default")))
+#elif defined(BUILDING_QCSTUDIO)
 #    define QCS_API __declspec(dllexport)
 #else
 #    define QCS_API __declspec(dllimport)
 #endif
+#pragma push_macro("QCS_NOINLINE")
+#undef QCS_NOINLINE
+#if defined(_MSC_VER)
+#    define QCS_NOINLINE __declspec(noinline)
+#else
+#    define QCS_NOINLINE __attribute__((noinline))
+#endif
 
 /*
     Call-stack capturing library.
@@ -47,6 +70,12 @@ namespace qcstudio::callstack {
 
     using namespace std;
 
+    class writer_t;
+
+    namespace shared {
+        struct ring_t;
+    }
+
     class QCS_API recorder_t {
     public:
         virtual ~recorder_t();
@@ -57,45 +86,346 @@ namespace qcstudio::callstack {
             add_module = 0,  // |numchars(2 bytes)|path(n x 2/4 bytes)|baseaddr(4/8 bytes)|size(4 bytes)
             del_module,      // |numchars(2 bytes)|path(n x 2/4 bytes)
             callstack,       // |numframes(2 bytes)|frames(n x 4/8 bytes)
+            stack_def,       // |id(4 bytes)|numframes(2 bytes)|frames(n x 4/8 bytes) (first time a stack is seen; also counts as a capture)
+            callstack_ref,   // |id(4 bytes)| (a capture of a stack previously defined)
+            calibration,     // |wall clock(8 bytes, ns)|frequency(8 bytes, ticks per second)| (tick based time sources only)
+            heap_alloc,      // |address(4/8 bytes)|size(8 bytes)|sampling period(8 bytes)|numframes(2 bytes)|frames(n x 4/8 bytes) (a sampled allocation)
+            heap_free,       // |address(4/8 bytes)| (release of a sampled allocation)
+            telemetry,       // |captures, dropped, bytes, lock wait, uninterned(8 bytes each)|threads(4 bytes)|numbuckets(2 bytes)|latency buckets(n x 8 bytes)| (see stats_t)
         };
 
-        void capture();
+        void capture();  // of up to 'max_depth' frames
+
+        // captures of up to '_max_depth' frames that also skip the '_skip' innermost ones (the caller's helpers), so
+        // that the walk stops early and only '_max_depth' frames of scratch space are used. Stacks of different
+        // depths mix freely in a recording: every one carries its number of frames. The template flavour sizes the
+        // scratch space at compile time; both are limited to 'max_depth'
+
+        static constexpr uint16_t max_depth = 200;
+
+        template<uint16_t MaxDepth, uint16_t Skip = 0>
+        QCS_NOINLINE void capture();
+        void capture(uint16_t _max_depth, uint16_t _skip = 0);
+
+        // dumps take a snapshot of what every thread committed so far (just its bounds, as segments only grow) and
+        // write it out in a background thread, one dump after the other, while threads keep capturing. 'dump' waits
+        // for the file to be written, 'dump_async' returns right after the snapshot
+
         auto dump(const wchar_t* _filename) -> bool;
+        auto dump_async(const wchar_t* _filename) -> future<bool>;
+
+        // time source of the timestamps: the wall clock in nanoseconds (default) or the CPU ticks (rdtsc), which
+        // are several times cheaper to read but need an invariant TSC. Tick based recordings carry 'calibration'
+        // events (at bootstrap and then up to every second) so that players turn the ticks back into nanoseconds. It
+        // has to be chosen before capturing anything; returns false if the source is not available
+
+        enum class time_source : uint8_t {
+            system,
+            tsc,
+        };
+
+        auto set_time_source(time_source _source) -> bool;
+
+        // compression of the chunks of the recordings written by 'dump' and streaming (see callstack-format.h). Off
+        // by default; recordings usually get twice as small at the cost of compressing them while writing
+
+        void set_compression(bool _enabled);
+
+        // streaming mode: full segments are appended to a file by a background thread while the capturing
+        // threads carry on with fresh ones, so the length of the recording is only bounded by the disk. Events reach
+        // the file a chunk at a time (see callstack-format.h): those of the last chunk are lost if the process dies
+
+        enum class backpressure : uint8_t {
+            drop,   // no segment available: drop the event (see 'dropped_events')
+            block,  // no segment available: wait for the streaming thread to recycle one
+        };
+
+        auto start_streaming(const wchar_t* _filename, backpressure _policy = backpressure::drop, size_t _max_segments = 64) -> bool;
+        auto stop_streaming() -> bool;
+
+        // live streaming: streaming mode to a local connection instead of a file (see local-socket.h) where a
+        // player waits for it (see player_t::start_live). Every pass of the streaming thread ends a chunk and sends
+        // it in large writes, so events reach the player within about a tenth of a second. False if nobody is
+        // waiting at '_address'; if the player goes away the events are discarded until 'stop_streaming'
+
+        auto start_live_streaming(const wchar_t* _address, backpressure _policy = backpressure::drop, size_t _max_segments = 64) -> bool;
+        auto dropped_events() const -> uint64_t;
+
+        // telemetry: every thread keeps its own counters (written by itself only, so no contention) and 'stats'
+        // adds them up. Recordings written by 'dump' and streaming end with a 'telemetry' event of the time
+
+        struct stats_t {
+            static constexpr auto latency_buckets = size_t{8 * 62};  // 8 of 1 ns and then 8 per power of 2
+
+            uint64_t captures  = 0;  // taken, samples and dropped ones included
+            uint64_t dropped   = 0;  // events lost for lack of space (see 'dropped_events')
+            uint64_t bytes     = 0;  // of the events recorded
+            uint64_t lock_wait  = 0;  // ns the capturing threads waited for a segment (streaming and mapped modes)
+            uint64_t uninterned = 0;  // captures written whole as the interning table had no room for their stack
+            uint32_t threads    = 0;  // buffers, i.e. the most threads recording at once
+
+            array<uint64_t, latency_buckets> latency = {};  // a sample of the 'capture' calls by duration in ns (see 'latency_floor')
+
+            static auto latency_floor(size_t _bucket) -> uint64_t {
+                return _bucket < 8 ? _bucket : (8 + _bucket % 8) << (_bucket / 8 - 1);
+            }
+
+            // ns within which '_fraction' of the captures completed (the top of a bucket, so up to 12.5% over)
+
+            auto percentile(double _fraction) const -> uint64_t {
+                auto total = uint64_t{0};
+                for (auto count : latency) {
+                    total += count;
+                }
+                auto below = uint64_t{0};
+                for (auto i = size_t{0}; i < latency_buckets; ++i) {
+                    below += latency[i];
+                    if (below && (double)below >= _fraction * (double)total) {
+                        return i + 1 < latency_buckets ? latency_floor(i + 1) - 1 : numeric_limits<uint64_t>::max();
+                    }
+                }
+                return 0;
+            }
+        };
+
+        auto stats() const -> stats_t;
+
+        // mapped mode: the events go straight into a memory mapped file that grows as needed, so they reach the
+        // disk without any copy and survive a crash of the process. It has to be enabled before capturing anything
+        // (so that the module snapshot goes there too) and it excludes streaming. 'dump' just flushes the mapping
+        // in this mode (the file name is ignored)
+
+        auto start_mapping(const wchar_t* _filename) -> bool;
+
+        // shared mode: the events go into rings in named shared memory (see callstack-shared.h), one per thread,
+        // for a collector in another process to take them out (see collector_t), so that a capture costs the stack
+        // walk and a copy, without any system call or lock. A full ring drops the event, hence, '_ring_size' bytes
+        // have to cover the lag of the collector (for up to '_max_threads' threads, any other drops everything). It
+        // has to be enabled before capturing anything and it excludes streaming and mapped mode ('dump' fails).
+        // 'stop_sharing' adds the telemetry and tells the collector to finish
+
+        auto start_sharing(const wchar_t* _name, size_t _ring_size = 1024 * 1024, uint32_t _max_threads = 64) -> bool;
+        auto stop_sharing() -> bool;
+
+        // sampling mode (Linux only): every thread of the process is sampled '_frequency' times per second of
+        // the CPU time it consumes (a per-thread CPU time timer delivering a signal), turning the recording into
+        // a statistical CPU profile. Samples are regular captures for the player. Threads are found every 10 ms,
+        // so a thread living less than that may go unsampled. Only one recorder samples at a time; false if
+        // sampling is not available or already running
+
+        auto start_sampling(unsigned _frequency = 1000) -> bool;
+        auto stop_sampling() -> bool;
+
+        // heap sampling (Linux only): malloc/calloc/realloc/free and the aligned flavours (memalign, aligned_alloc,
+        // posix_memalign, valloc, pvalloc), so every new/delete too, are interposed and allocations are sampled by
+        // bytes, a Poisson process capturing one every '_period' bytes on average (so the bigger the allocation, the
+        // likelier). Sampled allocations are recorded with their call stack, and so is their release,
+        // for the player to estimate the heap by call path (see player_t::heap_profile). Opt-in at build time, as
+        // the interposed functions take every allocation of the process: the library has to be built with
+        // QCS_HEAP_SAMPLING (premake5 --heap-sampling), otherwise 'start_heap_sampling' fails
+
+        auto start_heap_sampling(size_t _period = 512 * 1024) -> bool;
+        auto stop_heap_sampling() -> bool;
+
+        // Writes the events of a mapped file (even one left by a crashed process) as a regular recording (see
+        // callstack-format.h). Returns false if the file is not a mapped one
+
+        static auto recover(const wchar_t* _filename, ostream& _out) -> bool;
+
+        static constexpr char mapped_magic[8] = {'Q', 'C', 'S', 'M', 'A', 'P', '0', '1'};  // first bytes of a mapped file
 
     private:
 
         // storage
+        //
+        // Every thread writes its events into its own segment without taking any lock. Thread buffers are
+        // chained in a lock-free list owned by the recorder and their segments are merged in timestamp
+        // order when written out. When a thread exits its buffer is released and can be adopted by a new
+        // thread. By default every thread owns a single segment; in streaming mode full segments are sealed
+        // and replaced by recycled ones (this is the only place where a capturing thread may take a lock).
 
-        uint8_t*   buffer_;
-        size_t     cursor_;
-        std::mutex lock_;
+        struct segment_t {
+            atomic<size_t> committed;  // bytes visible to readers (only whole events)
+            size_t         capacity;   // (these two first: they are the header of the segments in a mapped file)
+            segment_t*     next;       // free/sealed lists (guarded by the stream lock)
+            segment_t*     chain;      // every segment ever allocated (for the destructor)
+            size_t         flushed;    // bytes already written out by the streaming thread
+            uint8_t*       data;
+        };
 
-        template<typename T>
-        auto write(const T& _data) -> bool;
-        auto write(uint8_t* _data, size_t _length) -> bool;
+        struct thread_buffer_t {
+            thread_buffer_t*   next;
+            atomic<bool>       in_use;
+            atomic<segment_t*> segment;  // current segment (only replaced by the owner thread)
+            shared::ring_t*    ring;     // shared mode: its ring instead (see callstack-shared.h)
+
+            // telemetry (see stats_t), only written by the owner thread
+
+            atomic<uint64_t>                                  captures;
+            atomic<uint64_t>                                  bytes;
+            atomic<uint64_t>                                  lock_wait;
+            atomic<uint64_t>                                  uninterned;
+            array<atomic<uint64_t>, stats_t::latency_buckets> latency;
+        };
+
+        struct stream_t;   // streaming state, allocated on first use (see callstack-recorder.cpp)
+        struct mapping_t;  // mapped mode state (ditto)
+        struct dumper_t;   // background dumps (ditto)
+        struct shared_t;   // shared mode state (ditto)
+
+        atomic<thread_buffer_t*> buffers_;
+        atomic<segment_t*>       segments_;
+        atomic<stream_t*>        stream_;
+        atomic<mapping_t*>       mapping_;
+        atomic<dumper_t*>        dumper_;
+        atomic<shared_t*>        shared_;
+        atomic<uint64_t>         dropped_;
+        atomic<bool>             ready_;
+        std::mutex               lock_;  // bootstrap, dump snapshots and streaming setup only, never taken while capturing
+
+        auto local_buffer() -> thread_buffer_t*;
+        void release(thread_buffer_t* _buffer);
+        auto new_segment(size_t _capacity) -> segment_t*;
+        auto next_segment(thread_buffer_t* _buffer, size_t _length) -> segment_t*;
+        auto reserve(thread_buffer_t* _buffer, size_t _length) -> uint8_t*;
+        void commit(thread_buffer_t* _buffer, uint8_t* _end);
         void bootstrap();
+        auto start_stream(const function<unique_ptr<ostream>()>& _open, bool _live, backpressure _policy, size_t _max_segments) -> bool;
+        void stream_loop(stream_t* _stream);
+        void dump_loop(dumper_t* _dumper);
+        void wait_dumps();
+        auto snapshot(const wchar_t* _filename) -> packaged_task<bool()>;
+        auto telemetry_event() const -> vector<uint8_t>;
+
+        template<typename T>
+        static void write(uint8_t*& _cursor, const T& _data);
+        static void write(uint8_t*& _cursor, const void* _data, size_t _length);
+        static void write_merged(writer_t& _writer, vector<pair<const uint8_t*, const uint8_t*>>& _ranges, int64_t _until);
+        static auto event_size(const uint8_t* _event) -> size_t;
+
+        friend struct thread_buffer_owner_t;
+
+        // stack interning
+        //
+        // Open addressing table of stack keys shared by all threads. The first thread to insert a key
+        // writes the 'stack_def' event and publishes it; from then on captures of the same stack only
+        // write a 'callstack_ref'. The slot index is the id of the stack. Slots are zeroed memory, hence,
+        // 'defining' goes first: a slot claimed but not published yet reads as such, and other threads
+        // capturing the same stack meanwhile write it whole rather than referencing a definition that may
+        // never be recorded.
+        //
+        // A module change makes every stack interned so far stale (see module_epoch_), so the table has two
+        // generations, one per parity of the epoch: a new epoch empties the generation of the one before the
+        // current, whose definitions are not in flight anymore (or it stays as it is until the next change).
+        // A slot may then be claimed again for another stack, hence, a reference checks that its slot is still
+        // the one it found once it has its timestamp: a later definition of the id is stamped after it.
+
+        enum class intern_result : uint8_t {
+            defining,     // we own the slot, write the definition and publish it (the state of a slot until then)
+            referenced,   // already defined, write a reference
+            unavailable,  // being defined by another thread or failed: write the whole stack
+            full,         // no slot within reach (never a state): ditto, counted as 'uninterned'
+        };
+
+        struct intern_slot_t {
+            atomic<uint64_t> key;        // 0 means empty, see 'intern'
+            atomic<int64_t>  timestamp;  // of the definition (valid once referenced)
+        };
+
+        struct interning_t {
+            uint32_t      id;
+            intern_result result;
+            uint64_t      key;  // of the slot, as found
+        };
+
+        intern_slot_t*             interned_;      // two generations (see above)
+        atomic<uint32_t>           module_epoch_;  // mixed into the hashes so that module changes never reuse stale ids
+        array<atomic<uint32_t>, 2> defining_;      // definitions in flight, per generation
+        array<atomic<uint32_t>, 2> claimed_;       // slots taken since the generation was emptied
+        std::mutex                 epoch_lock_;    // serializes the epoch changes
+        atomic<int64_t>            restated_;      // stacks defined before this are in a stream that is over (see restate)
+
+        auto intern(void* const* _frames, uint16_t _num_frames) -> interning_t;
+        void publish(const interning_t& _interning, bool _defined, int64_t _timestamp);
+        void next_module_epoch();  // (empties a generation of the table)
+
+        // Once a stream is over its events are gone from the segments, the module snapshot and the definitions of
+        // the stacks included. Hence, the modules loaded are recorded again and the stacks interned so far are not
+        // referenced anymore, so that the next stream or dump stands on its own
+
+        void restate();
+
+        // Writes a capture of the calling thread. Captures taken earlier (samples) come with their timestamp and
+        // never reference a stack defined after them
+
+        void record(void* const* _frames, uint16_t _num_frames, optional<int64_t> _timestamp = nullopt);
+
+        // Heap events. Sampled allocations are rare enough to carry their whole stack instead of interning it
+
+        void record_alloc(void* const* _frames, uint16_t _num_frames, const void* _address, size_t _size, size_t _period);
+        void record_free(const void* _address);
+
+        // time source
+        //
+        // The tick frequency is first measured against the steady clock over a short spin at bootstrap and
+        // refined by every later calibration, as the interval since bootstrap grows.
+
+        time_source     time_source_;
+        int64_t         base_ticks_;          // tick and steady clock readings at bootstrap
+        int64_t         base_steady_;
+        int64_t         calibration_period_;  // ns (only touched by the thread calibrating)
+        atomic<int64_t> next_calibration_;    // tick count that triggers the next calibration
+        atomic<double>  ns_per_tick_;         // of the time source (latency telemetry)
+
+        auto now() const -> int64_t;
+        void calibrate(thread_buffer_t* _buffer, optional<int64_t> _timestamp = nullopt);  // stamped no later than '_timestamp'
+
+        bool            compress_;       // see set_compression
+        atomic<int64_t> sampled_until_;  // samples older than this are already recorded (0 when not sampling)
+
+        void set_sampled_until(int64_t _until);  // (published to the collector in shared mode)
 
         // events
 
-        void on_add_module(const wchar_t* _path, uintptr_t _base_addr, size_t _size);
-        void on_del_module(const wchar_t* _path, uintptr_t _base_addr, size_t _size);
+        void on_add_module(const wchar_t* _path, uintptr_t _base_addr, size_t _size, optional<int64_t> _timestamp = nullopt);
+        void on_del_module(const wchar_t* _path, uintptr_t _base_addr, size_t _size, optional<int64_t> _timestamp = nullopt);
 
-        // related to module tracking
+        // related to module tracking and stack walking (platform specific, see callstack-recorder-<platform>.cpp)
 
         void* cookie_ = nullptr;
         void* reg_    = nullptr;
         void* unreg_  = nullptr;
 
         auto enum_modules() -> bool;
+        void restate_modules();  // an 'add_module' of every module loaded, known or not
+        void check_modules(optional<int64_t> _timestamp);  // before every capture: records the modules loaded/unloaded since the last one (Linux)
         auto start_tracking_modules() -> bool;
         void stop_tracking_modules();
+
+        static auto walk_stack(void** _frames, uint16_t _max_frames, uint16_t _skip) -> uint16_t;
+
+        // Walks the stack into '_frames' skipping ourselves and '_skip' frames more, and records it (all of the
+        // 'capture' overloads end here, with a frame of their own that never gets inlined)
+
+        QCS_NOINLINE void capture(void** _frames, uint16_t _max_frames, uint16_t _skip);
+
+        friend struct module_tracker_t;
+        friend struct sampler_t;
+        friend struct heap_tracker_t;
     };
 
 }  // namespace qcstudio::callstack
 
+template<uint16_t MaxDepth, uint16_t Skip>
+void qcstudio::callstack::recorder_t::capture() {
+    static_assert(MaxDepth > 0 && MaxDepth <= max_depth, "capture depth out of range");
+    void* frames[MaxDepth];  // left uninitialized, only the frames walked are read
+    capture(frames, MaxDepth, Skip + 1);
+}
+
 template<typename T>
-auto qcstudio::callstack::recorder_t::write(const T& _data) -> bool {
-    return write((uint8_t*)&_data, sizeof(T));
+void qcstudio::callstack::recorder_t::write(uint8_t*& _cursor, const T& _data) {
+    write(_cursor, &_data, sizeof(T));
 }
 
 /*
@@ -104,4 +434,5 @@ auto qcstudio::callstack::recorder_t::write(const T& _data) -> bool {
 
 extern QCS_API qcstudio::callstack::recorder_t g_callstack_recorder;
 
+#pragma pop_macro("QCS_NOINLINE")
 #pragma pop_macro("QCS_API")
\ No newline at end of file
@@ -0,0 +1,97 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+/*
+    Layout of the shared memory of shared mode (see recorder_t::start_sharing and collector_t).
+    |header|ring|...|ring|, every ring being |ring_t|data(ring_size bytes)| and owned by a single thread of the
+    recorder, which claims it with a 'fetch_add' on 'rings' the first time it records (wait-free, and the only
+    write to memory shared by several producers). From then on a ring has a single producer and a single consumer:
+    - 'head' and 'tail' are byte counts that only grow (the position within the data being count % ring_size); the
+      producer only writes 'head' and the consumer only writes 'tail'
+    - events are the ones of the recorder in memory (see recorder_t::event), never split: one that does not fit
+      before the end of the data is preceded by a 'wrap' byte and goes at the beginning
+    - the producer publishes an event by moving 'head' past it (release); if there is no room between 'head' and
+      'tail' the event is dropped and counted in 'dropped', it never waits
+    Counters are written by one side only (except 'dropped', bumped by the producers that overflow): the collector
+    reports in the header how far behind it is
+*/
+
+namespace qcstudio::callstack::shared {
+
+    using namespace std;
+
+    static constexpr char    magic[8] = {'Q', 'C', 'S', 'S', 'H', 'M', '0', '1'};
+    static constexpr uint8_t wrap     = 0xff;  // in place of an event: the rest of the data is unused
+    static constexpr size_t  line     = 64;    // cache line, so that both sides never share one
+
+    struct header_t {
+        atomic<uint64_t> magic;          // see 'magic_number', stored last by the recorder (release)
+        uint32_t         header_size;    // offset of the first ring
+        uint32_t         max_rings;      // threads beyond these get no ring, their events are dropped
+        uint64_t         ring_size;      // bytes of data of every ring (a power of 2)
+        uint64_t         ring_stride;    // bytes from a ring to the next one
+        uint32_t         owner;          // process id of the recorder
+        atomic<uint8_t>  time_source;    // of the timestamps (see recorder_t::time_source)
+        atomic<uint8_t>  closed;         // the recorder is done (see recorder_t::stop_sharing)
+        atomic<uint32_t> rings;          // claimed so far (may go beyond 'max_rings')
+        atomic<int64_t>  sampled_until;  // samples older than this are recorded already (0 when not sampling)
+        atomic<uint64_t> dropped;        // events lost because their ring was full (or there was none)
+
+        // written by the collector
+
+        alignas(line) atomic<uint64_t> collected;  // bytes of events taken out of the rings
+        atomic<uint64_t>               backlog;    // bytes waiting in the rings when the last pass began (its lag)
+        atomic<uint64_t>               max_backlog;
+        atomic<int64_t>                last_pass;  // wall clock (ns) when the last pass ended
+        atomic<uint32_t>               attached;   // collectors so far
+    };
+
+    struct ring_t {
+        alignas(line) atomic<uint64_t> head;  // bytes written (producer)
+        uint64_t                       seen;  // the last value of 'tail' read by the producer
+        alignas(line) atomic<uint64_t> tail;  // bytes collected (consumer)
+
+        auto data() -> uint8_t* {
+            return (uint8_t*)this + sizeof(ring_t);
+        }
+    };
+
+    inline auto magic_number() -> uint64_t {
+        auto ret = uint64_t{};
+        memcpy(&ret, magic, sizeof(ret));
+        return ret;
+    }
+
+    inline auto ring(header_t* _header, uint32_t _index) -> ring_t* {
+        return (ring_t*)((uint8_t*)_header + _header->header_size + _index * _header->ring_stride);
+    }
+
+}  // namespace qcstudio::callstack::shared
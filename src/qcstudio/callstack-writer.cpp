@@ -0,0 +1,389 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Own
+
+#include "callstack-writer.h"
+#include "callstack-recorder.h"
+#include "lz.h"
+
+// C++
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <ostream>
+
+using namespace std;
+
+namespace {
+    constexpr auto UNDEFINED = numeric_limits<size_t>::max();  // chunk of the stacks referenced but never defined
+}
+
+qcstudio::callstack::writer_t::writer_t(ostream& _out, format::codec _codec, size_t _chunk_size, bool _indexed) : out_(_out), codec_(_codec), chunk_size_(min<size_t>(_chunk_size, format::max_chunk_size / 2)), indexed_(_indexed) {
+}
+
+qcstudio::callstack::writer_t::~writer_t() {
+    finish();
+}
+
+void qcstudio::callstack::writer_t::write(const uint8_t* _event) {
+    if (finished_) {
+        return;
+    }
+    if (!header_) {
+        header_ = true;
+        out_.write(format::magic, sizeof(format::magic));
+        out_.write((const char*)&format::version, sizeof(format::version));
+        out_.put((char)sizeof(uintptr_t));
+        out_.put((char)format::native_endianness());
+        offset_ = format::header_size;
+    }
+
+    // |event(1 byte)|timestamp(8 bytes)|payload| (see recorder_t::event)
+
+    const auto type      = (recorder_t::event)_event[0];
+    const auto payload   = _event + 1 + sizeof(int64_t);
+    auto       timestamp = int64_t{};
+    memcpy(&timestamp, _event + 1, sizeof(timestamp));
+
+    // A new chunk restates what it depends on before its first event (so the previous calibration, if this
+    // one is a calibration)
+
+    const auto fresh = chunk_.empty();
+    if (fresh) {
+        begin_chunk();
+    }
+
+    switch (type) {
+        case recorder_t::event::add_module: {
+            auto count = uint16_t{};
+            auto base  = uintptr_t{};
+            auto size  = uint32_t{};
+            memcpy(&count, payload, sizeof(count));
+            memcpy(&base, payload + sizeof(count) + count * sizeof(wchar_t), sizeof(base));
+            memcpy(&size, payload + sizeof(count) + count * sizeof(wchar_t) + sizeof(base), sizeof(size));
+
+            auto module = module_t{base, size, timestamp, 0, wstring(count, 0)};
+            memcpy(module.path.data(), payload + sizeof(count), count * sizeof(wchar_t));
+            auto it = upper_bound(modules_.begin(), modules_.end(), base, [](uintptr_t _base, const module_t& _module) {
+                return _base < _module.base;
+            });
+            put_module(timestamp, *modules_.insert(it, move(module)));
+            break;
+        }
+        case recorder_t::event::del_module: {
+            auto count = uint16_t{};
+            memcpy(&count, payload, sizeof(count));
+            const auto path = payload + sizeof(count);
+
+            auto cursor = reserve(1 + 2 * format::max_varint + count * sizeof(wchar_t));
+            put_tag(cursor, type, timestamp);
+            format::put_varint(cursor, count);
+            memcpy(cursor, path, count * sizeof(wchar_t));
+            commit(cursor + count * sizeof(wchar_t));
+
+            for (auto it = modules_.begin(); it != modules_.end(); ++it) {
+                if (it->path.size() == count && !memcmp(it->path.data(), path, count * sizeof(wchar_t))) {
+                    modules_.erase(it);
+                    break;
+                }
+            }
+            break;
+        }
+        case recorder_t::event::callstack: {
+            auto count = uint16_t{};
+            memcpy(&count, payload, sizeof(count));
+
+            auto cursor = reserve(1 + 2 * format::max_varint + count * 2 * format::max_varint);
+            put_tag(cursor, type, timestamp);
+            format::put_varint(cursor, count);
+            put_frames(cursor, payload + sizeof(count), count);
+            commit(cursor);
+            break;
+        }
+        case recorder_t::event::stack_def: {
+            auto id    = uint32_t{};
+            auto count = uint16_t{};
+            memcpy(&id, payload, sizeof(id));
+            memcpy(&count, payload + sizeof(id), sizeof(count));
+
+            auto& stack = stacks_.try_emplace(id, interned_t{(uint32_t)stacks_.size(), 0, {}}).first->second;
+            stack.chunk = index_.size();
+            stack.frames.resize(count);
+            memcpy(stack.frames.data(), payload + sizeof(id) + sizeof(count), count * sizeof(uintptr_t));
+            put_stack(timestamp, stack);
+            break;
+        }
+        case recorder_t::event::callstack_ref: {
+            auto id = uint32_t{};
+            memcpy(&id, payload, sizeof(id));
+
+            // First reference of the chunk: it becomes a definition. Stacks never defined in the recording stay
+            // references (the recorder does not write them, see recorder_t::restate)
+
+            auto& stack = stacks_.try_emplace(id, interned_t{(uint32_t)stacks_.size(), UNDEFINED, {}}).first->second;
+            if (stack.chunk != UNDEFINED && stack.chunk != index_.size()) {
+                stack.chunk = index_.size();
+                put_stack(timestamp, stack);
+            } else {
+                auto cursor = reserve(1 + 2 * format::max_varint);
+                put_tag(cursor, type, timestamp);
+                format::put_varint(cursor, stack.id);
+                commit(cursor);
+            }
+            break;
+        }
+        case recorder_t::event::calibration: {
+            memcpy(&calibration_.wall_time, payload, sizeof(calibration_.wall_time));
+            memcpy(&calibration_.frequency, payload + sizeof(calibration_.wall_time), sizeof(calibration_.frequency));
+            calibration_.timestamp = timestamp;
+            timebase_.calibrate(timestamp, calibration_.wall_time, calibration_.frequency);
+            put_calibration();
+            break;
+        }
+        case recorder_t::event::heap_alloc: {
+            auto address = uintptr_t{};
+            auto size    = uint64_t{};
+            auto period  = uint64_t{};
+            auto count   = uint16_t{};
+            memcpy(&address, payload, sizeof(address));
+            memcpy(&size, payload + sizeof(address), sizeof(size));
+            memcpy(&period, payload + sizeof(address) + sizeof(size), sizeof(period));
+            memcpy(&count, payload + sizeof(address) + sizeof(size) + sizeof(period), sizeof(count));
+
+            auto cursor = reserve(1 + 5 * format::max_varint + count * 2 * format::max_varint);
+            put_tag(cursor, type, timestamp);
+            format::put_varint(cursor, address);
+            format::put_varint(cursor, size);
+            format::put_varint(cursor, period);
+            format::put_varint(cursor, count);
+            put_frames(cursor, payload + sizeof(address) + sizeof(size) + sizeof(period) + sizeof(count), count);
+            commit(cursor);
+            break;
+        }
+        case recorder_t::event::heap_free: {
+            auto address = uintptr_t{};
+            memcpy(&address, payload, sizeof(address));
+
+            auto cursor = reserve(2 + 2 * format::max_varint);
+            put_tag(cursor, type, timestamp);
+            format::put_varint(cursor, address);
+            commit(cursor);
+            break;
+        }
+        case recorder_t::event::telemetry: {
+            auto counters = array<uint64_t, 5>{};  // captures, dropped, bytes, lock wait, uninterned
+            auto threads  = uint32_t{};
+            auto count    = uint16_t{};
+            memcpy(counters.data(), payload, sizeof(counters));
+            memcpy(&threads, payload + sizeof(counters), sizeof(threads));
+            memcpy(&count, payload + sizeof(counters) + sizeof(threads), sizeof(count));
+            const auto buckets = payload + sizeof(counters) + sizeof(threads) + sizeof(count);
+
+            auto cursor = reserve(2 + (counters.size() + 3 + count) * format::max_varint);
+            put_tag(cursor, type, timestamp);
+            for (auto counter : counters) {
+                format::put_varint(cursor, counter);
+            }
+            format::put_varint(cursor, threads);
+            format::put_varint(cursor, count);
+            for (auto i = 0u; i < count; ++i) {
+                auto bucket = uint64_t{};
+                memcpy(&bucket, buckets + i * sizeof(bucket), sizeof(bucket));
+                format::put_varint(cursor, bucket);
+            }
+            commit(cursor);
+            break;
+        }
+    }
+
+    // Time range of the chunk for the index
+
+    const auto ns = timebase_.to_ns(timestamp);
+    first_ns_     = fresh ? ns : min(first_ns_, ns);
+    last_ns_      = fresh ? ns : max(last_ns_, ns);
+
+    if (chunk_.size() >= chunk_size_) {
+        end_chunk();
+    }
+}
+
+void qcstudio::callstack::writer_t::flush() {
+    if (!finished_) {
+        end_chunk();  // the next event begins a new one
+    }
+}
+
+void qcstudio::callstack::writer_t::finish() {
+    if (finished_) {
+        return;
+    }
+    finished_ = true;
+    if (!header_) {
+        return;  // nothing was written
+    }
+    end_chunk();
+    if (!indexed_) {
+        return;
+    }
+
+    // |offset|first timestamp|last timestamp| per chunk and the trailer
+
+    for (auto& entry : index_) {
+        out_.write((const char*)&entry.offset, sizeof(entry.offset));
+        out_.write((const char*)&entry.first, sizeof(entry.first));
+        out_.write((const char*)&entry.last, sizeof(entry.last));
+    }
+    const auto num_chunks = (uint32_t)index_.size();
+    out_.write((const char*)&offset_, sizeof(offset_));
+    out_.write((const char*)&num_chunks, sizeof(num_chunks));
+    out_.write(format::index_magic, sizeof(format::index_magic));
+}
+
+void qcstudio::callstack::writer_t::begin_chunk() {
+    // The encoding restarts and the calibration and the modules in effect are restated
+
+    last_timestamp_ = 0;
+    num_modules_    = 0;
+    if (calibration_.frequency) {
+        put_calibration();
+    }
+    for (auto& module : modules_) {
+        put_module(module.timestamp, module);
+    }
+}
+
+void qcstudio::callstack::writer_t::end_chunk() {
+    if (chunk_.empty()) {
+        return;
+    }
+
+    // Compressed only if it pays off
+
+    const auto events = (uint32_t)chunk_.size();
+    auto       codec  = format::codec::none;
+    auto       data   = chunk_.data();
+    auto       size   = events;
+    if (codec_ == format::codec::lz) {
+        packed_.resize(lz::bound(events));
+        if (const auto packed = lz::compress(chunk_.data(), events, packed_.data()); packed < events) {
+            codec = format::codec::lz;
+            data  = packed_.data();
+            size  = (uint32_t)packed;
+        }
+    }
+
+    // |size|codec|events size|data|
+
+    out_.write((const char*)&size, sizeof(size));
+    out_.put((char)codec);
+    out_.write((const char*)&events, sizeof(events));
+    out_.write((const char*)data, size);
+    index_.push_back({offset_, first_ns_, last_ns_});
+    offset_ += format::chunk_header + size;
+    chunk_.clear();
+}
+
+auto qcstudio::callstack::writer_t::reserve(size_t _bytes) -> uint8_t* {
+    const auto used = chunk_.size();
+    chunk_.resize(used + _bytes);
+    return chunk_.data() + used;
+}
+
+void qcstudio::callstack::writer_t::commit(const uint8_t* _end) {
+    chunk_.resize(_end - chunk_.data());
+}
+
+void qcstudio::callstack::writer_t::put_tag(uint8_t*& _cursor, uint8_t _type, int64_t _timestamp) {
+    const auto delta    = format::zigzag(_timestamp - last_timestamp_);
+    const auto more     = delta >> format::delta_shift;
+    const auto extended = _type >= format::extended_event;
+    *_cursor++          = (uint8_t)((extended ? format::extended_event : _type) | (more ? format::delta_follows : 0) | (delta << format::delta_shift));
+    if (more) {
+        format::put_varint(_cursor, more);
+    }
+    if (extended) {
+        *_cursor++ = _type;
+    }
+    last_timestamp_ = _timestamp;
+}
+
+void qcstudio::callstack::writer_t::put_module(int64_t _timestamp, module_t& _module) {
+    const auto count  = _module.path.size();
+    auto       cursor = reserve(1 + 4 * format::max_varint + count * sizeof(wchar_t));
+    put_tag(cursor, recorder_t::event::add_module, _timestamp);
+    format::put_varint(cursor, count);
+    memcpy(cursor, _module.path.data(), count * sizeof(wchar_t));
+    cursor += count * sizeof(wchar_t);
+    format::put_varint(cursor, _module.base);
+    format::put_varint(cursor, _module.size);
+    commit(cursor);
+    _module.id = ++num_modules_;
+}
+
+void qcstudio::callstack::writer_t::put_calibration() {
+    auto cursor = reserve(1 + 3 * format::max_varint);
+    put_tag(cursor, recorder_t::event::calibration, calibration_.timestamp);
+    format::put_varint(cursor, format::zigzag(calibration_.wall_time));
+    format::put_varint(cursor, calibration_.frequency);
+    commit(cursor);
+}
+
+void qcstudio::callstack::writer_t::put_stack(int64_t _timestamp, const interned_t& _stack) {
+    auto cursor = reserve(1 + 3 * format::max_varint + _stack.frames.size() * 2 * format::max_varint);
+    put_tag(cursor, recorder_t::event::stack_def, _timestamp);
+    format::put_varint(cursor, _stack.id);
+    format::put_varint(cursor, _stack.frames.size());
+    put_frames(cursor, (const uint8_t*)_stack.frames.data(), _stack.frames.size());
+    commit(cursor);
+}
+
+void qcstudio::callstack::writer_t::put_frames(uint8_t*& _cursor, const uint8_t* _frames, size_t _count) const {
+    // Consecutive frames tend to be in the same module (which is then written only once)
+
+    auto module = (const module_t*)nullptr;
+    auto last   = ~0ull;
+    for (auto i = 0u; i < _count; ++i) {
+        auto addr = uintptr_t{};
+        memcpy(&addr, _frames + i * sizeof(addr), sizeof(addr));
+        if (!module || addr < module->base || addr - module->base >= module->size) {
+            module  = nullptr;
+            auto it = upper_bound(modules_.begin(), modules_.end(), addr, [](uintptr_t _addr, const module_t& _module) {
+                return _addr < _module.base;
+            });
+            if (it != modules_.begin() && addr - prev(it)->base < prev(it)->size) {
+                module = &*prev(it);
+            }
+        }
+        const auto id     = module ? module->id : 0;
+        const auto offset = (uint64_t)(module ? addr - module->base : addr);
+        format::put_varint(_cursor, offset << 1 | (id != last));
+        if (id != last) {
+            format::put_varint(_cursor, id);
+            last = id;
+        }
+    }
+}
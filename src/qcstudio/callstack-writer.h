@@ -0,0 +1,123 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+// Own
+
+#include "callstack-format.h"
+
+// C++
+
+#include <cstdint>
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/*
+    Writer of recordings (see callstack-format.h).
+    Takes the events as the recorder stores them in memory, in recording order, and encodes them into chunks that
+    go out (optionally compressed) as they fill up; the index of the chunks is written by 'finish' (or the
+    destructor). It keeps track of the modules, the last calibration and the stacks so that every chunk can
+    restate what it depends on. Live streams go without index: their reader takes the chunks as they come
+*/
+
+namespace qcstudio::callstack {
+
+    using namespace std;
+
+    class writer_t {
+    public:
+        explicit writer_t(ostream& _out, format::codec _codec = format::codec::none, size_t _chunk_size = format::chunk_size, bool _indexed = true);
+        ~writer_t();
+
+        void write(const uint8_t* _event);
+        void flush();   // ends the pending chunk, so that everything written so far can be decoded
+        void finish();  // the pending chunk and the index (nothing can be written afterwards)
+
+    private:
+        struct module_t {
+            uintptr_t base;
+            size_t    size;
+            int64_t   timestamp;  // when it was loaded
+            uint32_t  id;         // within the current chunk
+            wstring   path;
+        };
+
+        struct interned_t {
+            uint32_t          id;     // renumbered (see callstack-format.h)
+            size_t            chunk;  // the last one that defines it
+            vector<uintptr_t> frames;
+        };
+
+        struct calibration_t {
+            int64_t  timestamp = 0;
+            int64_t  wall_time = 0;
+            uint64_t frequency = 0;  // 0: none yet
+        };
+
+        struct entry_t {
+            uint64_t offset;
+            int64_t  first, last;
+        };
+
+        ostream&                            out_;
+        format::codec                       codec_;
+        size_t                              chunk_size_;
+        bool                                indexed_;
+        bool                                header_   = false;
+        bool                                finished_ = false;
+        vector<module_t>                    modules_;  // loaded ones, sorted by base address
+        unordered_map<uint32_t, interned_t> stacks_;   // by recorder's id
+        calibration_t                       calibration_;
+        format::timebase_t                  timebase_;
+
+        // current chunk
+
+        vector<uint8_t> chunk_;
+        vector<uint8_t> packed_;  // compressed chunk
+        int64_t         last_timestamp_ = 0;
+        uint32_t        num_modules_    = 0;
+        int64_t         first_ns_       = 0;
+        int64_t         last_ns_        = 0;
+
+        // index
+
+        vector<entry_t> index_;
+        uint64_t        offset_ = 0;  // of the next chunk
+
+        void begin_chunk();
+        void end_chunk();
+        auto reserve(size_t _bytes) -> uint8_t*;
+        void commit(const uint8_t* _end);
+        void put_tag(uint8_t*& _cursor, uint8_t _type, int64_t _timestamp);
+        void put_module(int64_t _timestamp, module_t& _module);
+        void put_calibration();
+        void put_stack(int64_t _timestamp, const interned_t& _stack);
+        void put_frames(uint8_t*& _cursor, const uint8_t* _frames, size_t _count) const;
+    };
+
+}  // namespace qcstudio::callstack
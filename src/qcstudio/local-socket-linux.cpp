@@ -0,0 +1,148 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Own
+
+#include "local-socket.h"
+#include "unicode.h"
+
+// Linux
+
+#include <cerrno>
+#include <cstring>
+#include <cwchar>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+    // Abstract namespace: a leading zero byte and the name in UTF-8 (no terminator, the length tells)
+
+    auto make_address(const wchar_t* _address, sockaddr_un& _addr) -> socklen_t {
+        const auto name = qcstudio::unicode::to_utf8(_address, wcslen(_address));
+        if (name.empty() || name.size() >= sizeof(_addr.sun_path)) {
+            return 0;
+        }
+        _addr            = sockaddr_un{};
+        _addr.sun_family = AF_UNIX;
+        memcpy(_addr.sun_path + 1, name.data(), name.size());
+        return (socklen_t)(offsetof(sockaddr_un, sun_path) + 1 + name.size());
+    }
+}  // namespace
+
+qcstudio::misc::local_socket_t::~local_socket_t() {
+    close();
+}
+
+auto qcstudio::misc::local_socket_t::connect(const wchar_t* _address) -> bool {
+    close();
+
+    auto       addr   = sockaddr_un{};
+    const auto length = make_address(_address, addr);
+    if (!length) {
+        return false;
+    }
+    const auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (::connect(fd, (const sockaddr*)&addr, length)) {
+        ::close(fd);
+        return false;
+    }
+    handle_ = fd;
+    return true;
+}
+
+auto qcstudio::misc::local_socket_t::accept(const wchar_t* _address) -> bool {
+    close();
+
+    auto       addr   = sockaddr_un{};
+    const auto length = make_address(_address, addr);
+    if (!length) {
+        return false;
+    }
+    const auto listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        return false;
+    }
+    if (bind(listener, (const sockaddr*)&addr, length) || listen(listener, 1)) {
+        ::close(listener);
+        return false;
+    }
+    auto fd = -1;
+    do {
+        fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    } while (fd < 0 && errno == EINTR);
+    ::close(listener);  // a single peer, the name is free again
+    if (fd < 0) {
+        return false;
+    }
+    handle_ = fd;
+    return true;
+}
+
+void qcstudio::misc::local_socket_t::close() {
+    if (handle_ >= 0) {
+        ::close((int)handle_);
+        handle_ = -1;
+    }
+}
+
+auto qcstudio::misc::local_socket_t::write(const void* _data, size_t _size) -> bool {
+    // MSG_NOSIGNAL: a peer that is gone is an error, not a SIGPIPE that kills the process
+
+    auto data = (const uint8_t*)_data;
+    while (_size && handle_ >= 0) {
+        const auto sent = send((int)handle_, data, _size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        _size -= sent;
+    }
+    return !_size;
+}
+
+auto qcstudio::misc::local_socket_t::read(void* _data, size_t _size) -> bool {
+    auto data = (uint8_t*)_data;
+    while (_size && handle_ >= 0) {
+        const auto received = recv((int)handle_, data, _size, 0);
+        if (received <= 0) {
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += received;
+        _size -= received;
+    }
+    return !_size;
+}
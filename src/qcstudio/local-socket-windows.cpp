@@ -0,0 +1,120 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Own
+
+#include "local-socket.h"
+
+// Windows
+
+#undef WIN32_LEAN_AND_MEAN
+#undef NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+// C++
+
+#include <algorithm>
+#include <string>
+
+using namespace std;
+
+/*
+    The address is the name of a pipe under \\.\pipe\, inbound for the receiving end
+*/
+
+namespace {
+    auto pipe_name(const wchar_t* _address) -> wstring {
+        return L"\\\\.\\pipe\\" + wstring(_address);
+    }
+}  // namespace
+
+qcstudio::misc::local_socket_t::~local_socket_t() {
+    close();
+}
+
+auto qcstudio::misc::local_socket_t::connect(const wchar_t* _address) -> bool {
+    close();
+
+    const auto name = pipe_name(_address);
+    for (;;) {
+        const auto pipe = CreateFileW(name.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+        if (pipe != INVALID_HANDLE_VALUE) {
+            handle_ = (intptr_t)pipe;
+            return true;
+        }
+        if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeW(name.c_str(), NMPWAIT_USE_DEFAULT_WAIT)) {
+            return false;
+        }
+    }
+}
+
+auto qcstudio::misc::local_socket_t::accept(const wchar_t* _address) -> bool {
+    close();
+
+    const auto pipe = CreateNamedPipeW(pipe_name(_address).c_str(), PIPE_ACCESS_INBOUND, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, 0, (DWORD)local_ostream_t::batch_size, 0, NULL);
+    if (pipe == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    if (!ConnectNamedPipe(pipe, NULL) && GetLastError() != ERROR_PIPE_CONNECTED) {
+        CloseHandle(pipe);
+        return false;
+    }
+    handle_ = (intptr_t)pipe;
+    return true;
+}
+
+void qcstudio::misc::local_socket_t::close() {
+    if (handle_ != -1) {
+        CloseHandle((HANDLE)handle_);
+        handle_ = -1;
+    }
+}
+
+auto qcstudio::misc::local_socket_t::write(const void* _data, size_t _size) -> bool {
+    auto data = (const uint8_t*)_data;
+    while (_size && handle_ != -1) {
+        auto written = DWORD{0};
+        if (!WriteFile((HANDLE)handle_, data, (DWORD)min<size_t>(_size, MAXDWORD), &written, NULL)) {
+            return false;
+        }
+        data += written;
+        _size -= written;
+    }
+    return !_size;
+}
+
+auto qcstudio::misc::local_socket_t::read(void* _data, size_t _size) -> bool {
+    auto data = (uint8_t*)_data;
+    while (_size && handle_ != -1) {
+        auto received = DWORD{0};
+        if (!ReadFile((HANDLE)handle_, data, (DWORD)min<size_t>(_size, MAXDWORD), &received, NULL) || !received) {
+            return false;  // ERROR_BROKEN_PIPE once the sending end is gone
+        }
+        data += received;
+        _size -= received;
+    }
+    return !_size;
+}
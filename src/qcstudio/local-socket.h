@@ -0,0 +1,112 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+/*
+    Local connections, one way: a Unix domain socket in the abstract namespace on Linux and a named pipe on
+    Windows, both named by '_address' (no file is left behind). The receiving end waits for the sending one to
+    connect. Platform specific parts in local-socket-<platform>.cpp
+*/
+
+namespace qcstudio::misc {
+
+    using namespace std;
+
+    class local_socket_t {
+    public:
+        local_socket_t() = default;
+        local_socket_t(const local_socket_t&) = delete;
+        auto operator=(const local_socket_t&) -> local_socket_t& = delete;
+        ~local_socket_t();
+
+        auto connect(const wchar_t* _address) -> bool;  // sending end: false if nobody is waiting at '_address'
+        auto accept(const wchar_t* _address) -> bool;   // receiving end: waits for the sending end to connect
+        void close();
+
+        auto write(const void* _data, size_t _size) -> bool;  // all of it (false if the peer is gone)
+        auto read(void* _data, size_t _size) -> bool;         // all of it, waiting as needed (false at the end)
+
+    private:
+        intptr_t handle_ = -1;
+    };
+
+    // Output stream over a connection: what is written goes out in batches of 'batch_size' bytes and on flush,
+    // so that the number of system calls stays low whatever the number of writes
+
+    class local_ostream_t : public ostream {
+    public:
+        static constexpr size_t batch_size = 64 * 1024;
+
+        local_ostream_t() : ostream(&buffer_) {}
+
+        auto connect(const wchar_t* _address) -> bool {
+            return socket_.connect(_address);
+        }
+
+    private:
+        class buffer_t : public streambuf {
+        public:
+            explicit buffer_t(local_socket_t& _socket) : socket_(_socket), data_(batch_size) {
+                setp(data_.data(), data_.data() + data_.size());
+            }
+
+        protected:
+            auto overflow(int_type _char) -> int_type override {
+                if (!send()) {
+                    return traits_type::eof();
+                }
+                if (!traits_type::eq_int_type(_char, traits_type::eof())) {
+                    *pptr() = traits_type::to_char_type(_char);
+                    pbump(1);
+                }
+                return traits_type::not_eof(_char);
+            }
+
+            auto sync() -> int override {
+                return send() ? 0 : -1;
+            }
+
+        private:
+            local_socket_t& socket_;
+            vector<char>    data_;
+
+            auto send() -> bool {
+                const auto size = (size_t)(pptr() - pbase());
+                setp(data_.data(), data_.data() + data_.size());
+                return !size || socket_.write(data_.data(), size);
+            }
+        };
+
+        local_socket_t socket_;
+        buffer_t       buffer_{socket_};
+    };
+
+}  // namespace qcstudio::misc
@@ -0,0 +1,179 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Own
+
+#include "lz.h"
+
+// C++
+
+#include <cstring>
+#include <memory>
+
+using namespace std;
+
+namespace {
+    constexpr auto MIN_MATCH     = size_t{4};
+    constexpr auto MAX_OFFSET    = size_t{0xffff};
+    constexpr auto LAST_LITERALS = size_t{5};   // the tail of a block is always left as literals ...
+    constexpr auto MATCH_LIMIT   = size_t{12};  // ... and no match starts this close to the end
+    constexpr auto HASH_BITS     = 14u;
+
+    inline auto read32(const uint8_t* _pos) -> uint32_t {
+        auto ret = uint32_t{};
+        memcpy(&ret, _pos, sizeof(ret));
+        return ret;
+    }
+
+    inline auto hash_of(uint32_t _sequence) -> uint32_t {
+        return (_sequence * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    inline void put_length(uint8_t*& _dst, size_t _length) {
+        for (; _length >= 255; _length -= 255) {
+            *_dst++ = 255;
+        }
+        *_dst++ = (uint8_t)_length;
+    }
+
+    inline auto get_length(const uint8_t*& _src, const uint8_t* _end, size_t& _length) -> bool {
+        for (;;) {
+            if (_src == _end) {
+                return false;
+            }
+            const auto byte = *_src++;
+            _length += byte;
+            if (byte != 255) {
+                return true;
+            }
+        }
+    }
+
+    // |token|literals|offset|match|, without the match part if '_match' is 0
+
+    void put_sequence(uint8_t*& _dst, const uint8_t* _literals, size_t _num_literals, size_t _offset, size_t _match) {
+        auto& token = *_dst++;
+        token       = (uint8_t)(min<size_t>(_num_literals, 15) << 4);
+        if (_num_literals >= 15) {
+            put_length(_dst, _num_literals - 15);
+        }
+        memcpy(_dst, _literals, _num_literals);
+        _dst += _num_literals;
+        if (_match) {
+            *_dst++ = (uint8_t)_offset;
+            *_dst++ = (uint8_t)(_offset >> 8);
+            token |= (uint8_t)min<size_t>(_match - MIN_MATCH, 15);
+            if (_match - MIN_MATCH >= 15) {
+                put_length(_dst, _match - MIN_MATCH - 15);
+            }
+        }
+    }
+}  // namespace
+
+auto qcstudio::lz::compress(const uint8_t* _src, size_t _size, uint8_t* _dst) -> size_t {
+    const auto dst    = _dst;
+    auto       anchor = size_t{0};  // first literal not written yet
+
+    if (_size > MATCH_LIMIT) {
+        // Last position of every hashed 4 byte sequence. Misses speed up over incompressible data
+
+        auto       table = make_unique<uint32_t[]>(size_t{1} << HASH_BITS);
+        const auto limit = _size - MATCH_LIMIT;
+        for (auto pos = size_t{0}; pos < limit;) {
+            const auto sequence  = read32(_src + pos);
+            auto&      slot      = table[hash_of(sequence)];
+            const auto candidate = (size_t)slot;
+            slot                 = (uint32_t)pos;
+            if (candidate >= pos || pos - candidate > MAX_OFFSET || read32(_src + candidate) != sequence) {
+                pos += 1 + ((pos - anchor) >> 6);
+                continue;
+            }
+
+            auto length = MIN_MATCH;
+            while (pos + length < _size - LAST_LITERALS && _src[candidate + length] == _src[pos + length]) {
+                ++length;
+            }
+            put_sequence(_dst, _src + anchor, pos - anchor, pos - candidate, length);
+            pos += length;
+            anchor = pos;
+            if (pos < limit) {
+                table[hash_of(read32(_src + pos - 2))] = (uint32_t)(pos - 2);
+            }
+        }
+    }
+
+    put_sequence(_dst, _src + anchor, _size - anchor, 0, 0);
+    return _dst - dst;
+}
+
+auto qcstudio::lz::decompress(const uint8_t* _src, size_t _size, uint8_t* _dst, size_t _dst_size) -> bool {
+    const auto end     = _src + _size;
+    auto       written = size_t{0};
+    while (_src < end) {
+        const auto token = *_src++;
+
+        // Literals
+
+        auto num_literals = (size_t)(token >> 4);
+        if (num_literals == 15 && !get_length(_src, end, num_literals)) {
+            return false;
+        }
+        if (num_literals > (size_t)(end - _src) || num_literals > _dst_size - written) {
+            return false;
+        }
+        memcpy(_dst + written, _src, num_literals);
+        _src += num_literals;
+        written += num_literals;
+        if (_src == end) {
+            break;  // the last sequence
+        }
+
+        // Match (it may overlap what it produces, hence, forwards byte by byte when it is that close)
+
+        if (end - _src < 2) {
+            return false;
+        }
+        const auto offset = (size_t)(_src[0] | _src[1] << 8);
+        _src += 2;
+        auto length = (size_t)(token & 15);
+        if (length == 15 && !get_length(_src, end, length)) {
+            return false;
+        }
+        length += MIN_MATCH;
+        if (!offset || offset > written || length > _dst_size - written) {
+            return false;
+        }
+        auto       to   = _dst + written;
+        const auto from = to - offset;
+        if (offset >= length) {
+            memcpy(to, from, length);
+        } else {
+            for (auto i = size_t{0}; i < length; ++i) {
+                to[i] = from[i];
+            }
+        }
+        written += length;
+    }
+    return written == _dst_size;
+}
@@ -0,0 +1,54 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+    Small LZ77 block codec (LZ4 like) used to compress the chunks of the recordings (see callstack-format.h).
+    Blocks are independent: a compressed block is a series of sequences |token|literals|offset|match| where the
+    token carries the length of the literals (high 4 bits) and of the match minus 4 (low 4 bits), either one
+    being extended by extra bytes (255 each plus the last one) when it reads 15. Offsets are 2 bytes (little
+    endian) back from the current position. The last sequence has just literals
+*/
+
+namespace qcstudio::lz {
+
+    // Worst case compressed size of '_size' bytes
+
+    constexpr auto bound(size_t _size) -> size_t {
+        return _size + _size / 255 + 16;
+    }
+
+    // '_dst' must hold 'bound(_size)' bytes; returns the compressed size
+
+    auto compress(const uint8_t* _src, size_t _size, uint8_t* _dst) -> size_t;
+
+    // Decompresses exactly '_dst_size' bytes; false if the block is corrupt or does not have that size
+
+    auto decompress(const uint8_t* _src, size_t _size, uint8_t* _dst, size_t _dst_size) -> bool;
+
+}  // namespace qcstudio::lz
@@ -0,0 +1,128 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Own
+
+#include "mapped-file.h"
+#include "unicode.h"
+
+// Linux
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+qcstudio::misc::mapped_file_t::~mapped_file_t() {
+    close();
+}
+
+auto qcstudio::misc::mapped_file_t::open(const wchar_t* _filename) -> bool {
+    close();
+
+    const auto fd = ::open(unicode::native_path(_filename).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info {};
+    if (fstat(fd, &info) || !info.st_size) {
+        ::close(fd);
+        return false;
+    }
+    const auto memory = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        ::close(fd);
+        return false;
+    }
+    madvise(memory, info.st_size, MADV_SEQUENTIAL);
+
+    file_     = fd;
+    size_     = info.st_size;
+    writable_ = false;
+    regions_.push_back({(uint8_t*)memory, size_});
+    return true;
+}
+
+auto qcstudio::misc::mapped_file_t::create(const wchar_t* _filename) -> bool {
+    close();
+
+    const auto fd = ::open(unicode::native_path(_filename).c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    file_     = fd;
+    size_     = 0;
+    writable_ = true;
+    return true;
+}
+
+void qcstudio::misc::mapped_file_t::close(size_t _final_size) {
+    for (auto& region : regions_) {
+        munmap(region.data, region.size);
+    }
+    regions_.clear();
+    if (file_ >= 0) {
+        if (writable_ && _final_size < size_) {
+            (void)!ftruncate((int)file_, _final_size);
+        }
+        ::close((int)file_);
+    }
+    file_ = -1;
+    size_ = 0;
+}
+
+auto qcstudio::misc::mapped_file_t::data() const -> const uint8_t* {
+    return regions_.empty() ? nullptr : regions_.front().data;
+}
+
+auto qcstudio::misc::mapped_file_t::size() const -> size_t {
+    return size_;
+}
+
+auto qcstudio::misc::mapped_file_t::grow(size_t _size) -> uint8_t* {
+    if (file_ < 0 || !writable_ || ftruncate((int)file_, size_ + _size)) {
+        return nullptr;
+    }
+    const auto memory = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, (int)file_, size_);
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+    size_ += _size;
+    regions_.push_back({(uint8_t*)memory, _size});
+    return (uint8_t*)memory;
+}
+
+auto qcstudio::misc::mapped_file_t::sync() -> bool {
+    auto ok = true;
+    for (auto& region : regions_) {
+        ok &= !msync(region.data, region.size, MS_SYNC);
+    }
+    return ok;
+}
+
+auto qcstudio::misc::mapped_file_t::granularity() -> size_t {
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
@@ -0,0 +1,148 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Own
+
+#include "mapped-file.h"
+
+// Windows
+
+#undef WIN32_LEAN_AND_MEAN
+#undef NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+using namespace std;
+
+/*
+    A file mapping object has a fixed maximum size, hence, growing means creating a new one for the new size
+    and mapping only the new region through it (views keep their mapping object alive)
+*/
+
+qcstudio::misc::mapped_file_t::~mapped_file_t() {
+    close();
+}
+
+auto qcstudio::misc::mapped_file_t::open(const wchar_t* _filename) -> bool {
+    close();
+
+    const auto file = CreateFileW(_filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    auto size = LARGE_INTEGER{};
+    if (!GetFileSizeEx(file, &size) || !size.QuadPart) {
+        CloseHandle(file);
+        return false;
+    }
+    auto mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    auto memory  = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (mapping) {
+        CloseHandle(mapping);
+    }
+    if (!memory) {
+        CloseHandle(file);
+        return false;
+    }
+
+    file_     = (intptr_t)file;
+    size_     = (size_t)size.QuadPart;
+    writable_ = false;
+    regions_.push_back({(uint8_t*)memory, size_});
+    return true;
+}
+
+auto qcstudio::misc::mapped_file_t::create(const wchar_t* _filename) -> bool {
+    close();
+
+    const auto file = CreateFileW(_filename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    file_     = (intptr_t)file;
+    size_     = 0;
+    writable_ = true;
+    return true;
+}
+
+void qcstudio::misc::mapped_file_t::close(size_t _final_size) {
+    for (auto& region : regions_) {
+        UnmapViewOfFile(region.data);
+    }
+    regions_.clear();
+    if (file_ != -1) {
+        if (writable_ && _final_size < size_) {
+            auto end = LARGE_INTEGER{};
+            end.QuadPart = (LONGLONG)_final_size;
+            if (SetFilePointerEx((HANDLE)file_, end, NULL, FILE_BEGIN)) {
+                SetEndOfFile((HANDLE)file_);
+            }
+        }
+        CloseHandle((HANDLE)file_);
+    }
+    file_ = -1;
+    size_ = 0;
+}
+
+auto qcstudio::misc::mapped_file_t::data() const -> const uint8_t* {
+    return regions_.empty() ? nullptr : regions_.front().data;
+}
+
+auto qcstudio::misc::mapped_file_t::size() const -> size_t {
+    return size_;
+}
+
+auto qcstudio::misc::mapped_file_t::grow(size_t _size) -> uint8_t* {
+    if (file_ == -1 || !writable_) {
+        return nullptr;
+    }
+    const auto new_size = (uint64_t)(size_ + _size);
+    auto       mapping  = CreateFileMappingW((HANDLE)file_, NULL, PAGE_READWRITE, (DWORD)(new_size >> 32), (DWORD)new_size, NULL);
+    if (!mapping) {
+        return nullptr;
+    }
+    auto memory = MapViewOfFile(mapping, FILE_MAP_WRITE, (DWORD)((uint64_t)size_ >> 32), (DWORD)size_, _size);
+    CloseHandle(mapping);
+    if (!memory) {
+        return nullptr;
+    }
+    size_ += _size;
+    regions_.push_back({(uint8_t*)memory, _size});
+    return (uint8_t*)memory;
+}
+
+auto qcstudio::misc::mapped_file_t::sync() -> bool {
+    auto ok = true;
+    for (auto& region : regions_) {
+        ok &= FlushViewOfFile(region.data, region.size) != FALSE;
+    }
+    return ok && (!writable_ || FlushFileBuffers((HANDLE)file_));
+}
+
+auto qcstudio::misc::mapped_file_t::granularity() -> size_t {
+    auto info = SYSTEM_INFO{};
+    GetSystemInfo(&info);
+    return info.dwAllocationGranularity;
+}
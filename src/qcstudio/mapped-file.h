@@ -0,0 +1,74 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/*
+    Memory mapped files.
+    - Read only: the whole file in a single view
+    - Read/write: the file is created empty and grows in regions that are mapped independently so that the
+      memory already handed out never moves
+    Platform specific parts in mapped-file-<platform>.cpp
+*/
+
+namespace qcstudio::misc {
+
+    using namespace std;
+
+    class mapped_file_t {
+    public:
+        mapped_file_t() = default;
+        mapped_file_t(const mapped_file_t&) = delete;
+        auto operator=(const mapped_file_t&) -> mapped_file_t& = delete;
+        ~mapped_file_t();
+
+        auto open(const wchar_t* _filename) -> bool;    // read only
+        auto create(const wchar_t* _filename) -> bool;  // read/write, truncates
+        void close(size_t _final_size = SIZE_MAX);      // optionally truncating the file (read/write only)
+
+        auto data() const -> const uint8_t*;  // read only
+        auto size() const -> size_t;          // read only: whole file; read/write: mapped so far
+
+        auto grow(size_t _size) -> uint8_t*;  // read/write: appends '_size' zeroed bytes (a multiple of 'granularity')
+        auto sync() -> bool;                  // read/write: flush the dirty pages
+
+        static auto granularity() -> size_t;
+
+    private:
+        struct region_t {
+            uint8_t* data;
+            size_t   size;
+        };
+
+        vector<region_t> regions_;
+        size_t           size_     = 0;
+        intptr_t         file_     = -1;
+        bool             writable_ = false;
+    };
+
+}  // namespace qcstudio::misc
@@ -0,0 +1,117 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Own
+
+#include "module-timeline.h"
+
+// C++
+
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+void qcstudio::callstack::module_timeline_t::add(uint64_t _base, uint64_t _size, uint64_t _time, uint32_t _module) {
+    // Modules come in recording order, so this is an append most of the time
+
+    auto it  = upper_bound(intervals_.begin(), intervals_.end(), make_pair(_base, _time), [](const pair<uint64_t, uint64_t>& _value, const interval_t& _interval) {
+        return _value.first < _interval.base || (_value.first == _interval.base && _value.second < _interval.load);
+    });
+    auto pos = (size_t)(it - intervals_.begin());
+    intervals_.insert(it, {_base, _base + _size, _time, ~0ull, _module});
+
+    reach_.resize(intervals_.size());
+    for (auto i = pos; i < intervals_.size(); ++i) {
+        reach_[i] = max(i ? reach_[i - 1] : 0, intervals_[i].end);
+    }
+}
+
+void qcstudio::callstack::module_timeline_t::remove(uint64_t _base, uint32_t _module, uint64_t _time) {
+    auto it = lower_bound(intervals_.begin(), intervals_.end(), _base, [](const interval_t& _interval, uint64_t _value) {
+        return _interval.base < _value;
+    });
+    for (; it != intervals_.end() && it->base == _base; ++it) {
+        if (it->module == _module && it->unload == ~0ull) {
+            it->unload = _time;
+            return;
+        }
+    }
+}
+
+void qcstudio::callstack::module_timeline_t::clear() {
+    intervals_.clear();
+    reach_.clear();
+}
+
+auto qcstudio::callstack::module_timeline_t::locate(uint64_t _addr, uint64_t _time) const -> size_t {
+    const auto begin = intervals_.begin();
+
+    // Runs of intervals sharing a base, from the highest base not above the address down
+
+    auto last = (size_t)(upper_bound(begin, intervals_.end(), _addr, [](uint64_t _value, const interval_t& _interval) {
+        return _value < _interval.base;
+    }) - begin);
+    while (last) {
+        const auto base  = intervals_[last - 1].base;
+        const auto first = (size_t)(lower_bound(begin, begin + last, base, [](const interval_t& _interval, uint64_t _value) {
+            return _interval.base < _value;
+        }) - begin);
+
+        // Latest one loaded at or before the time
+
+        const auto loaded = (size_t)(upper_bound(begin + first, begin + last, _time, [](uint64_t _value, const interval_t& _interval) {
+            return _value < _interval.load;
+        }) - begin);
+        if (loaded != first) {
+            const auto& candidate = intervals_[loaded - 1];
+            if (_addr < candidate.end && _time < candidate.unload) {
+                return loaded - 1;
+            }
+        }
+
+        last = first;
+        if (!last || reach_[last - 1] <= _addr) {
+            break;
+        }
+    }
+    return SIZE_MAX;
+}
+
+auto qcstudio::callstack::module_timeline_t::find(uint64_t _addr, uint64_t _time) const -> uint32_t {
+    const auto pos = locate(_addr, _time);
+    return pos != SIZE_MAX ? intervals_[pos].module : none;
+}
+
+void qcstudio::callstack::module_timeline_t::find(const uint64_t* _addrs, size_t _count, uint64_t _time, uint32_t* _modules) const {
+    // Consecutive frames tend to be in the same module
+
+    auto last = SIZE_MAX;
+    for (auto i = 0u; i < _count; ++i) {
+        if (last == SIZE_MAX || _addrs[i] < intervals_[last].base || _addrs[i] >= intervals_[last].end) {
+            last = locate(_addrs[i], _time);
+        }
+        _modules[i] = last != SIZE_MAX ? intervals_[last].module : none;
+    }
+}
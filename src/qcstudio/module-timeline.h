@@ -0,0 +1,71 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/*
+    Module timeline.
+    Which module owned an address at a given time. Every load of a module is an interval of addresses
+    [base, end) alive during [load, unload). All of them live in a flat array sorted by (base, load), hence:
+    - Modules alive at the same time never overlap, so among the intervals sharing a base only the latest one
+      loaded before the time asked for can be the answer (binary search by load time)
+    - The highest end reached by the intervals up to each position tells when no interval with a lower base
+      can contain the address any more, which stops the search right away unless modules of different sizes
+      took turns at overlapping addresses
+    Lookups of whole stacks reuse the interval of the previous frame while it still contains the address
+*/
+
+namespace qcstudio::callstack {
+
+    using namespace std;
+
+    class module_timeline_t {
+    public:
+        static constexpr auto none = ~uint32_t{0};
+
+        void add(uint64_t _base, uint64_t _size, uint64_t _time, uint32_t _module);
+        void remove(uint64_t _base, uint32_t _module, uint64_t _time);  // ends the interval of a module
+        void clear();
+
+        auto find(uint64_t _addr, uint64_t _time) const -> uint32_t;  // module or 'none'
+        void find(const uint64_t* _addrs, size_t _count, uint64_t _time, uint32_t* _modules) const;
+
+    private:
+        struct interval_t {
+            uint64_t base, end;
+            uint64_t load, unload;  // unload is ~0 while alive
+            uint32_t module;
+        };
+
+        vector<interval_t> intervals_;  // sorted by (base, load)
+        vector<uint64_t>   reach_;      // highest end of the intervals up to each position
+
+        auto locate(uint64_t _addr, uint64_t _time) const -> size_t;  // interval position or SIZE_MAX
+    };
+
+}  // namespace qcstudio::callstack
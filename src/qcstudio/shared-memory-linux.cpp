@@ -0,0 +1,133 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Own
+
+#include "shared-memory.h"
+#include "unicode.h"
+
+// Linux
+
+#include <cerrno>
+#include <cwchar>
+#include <string>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+    // One level under /dev/shm: the name in UTF-8 without slashes
+
+    auto object_name(const wchar_t* _name) -> string {
+        const auto name = qcstudio::unicode::to_utf8(_name, wcslen(_name));
+        if (name.empty() || name.find('/') != string::npos) {
+            return {};
+        }
+        return "/qcstudio-" + name;
+    }
+}  // namespace
+
+qcstudio::misc::shared_memory_t::~shared_memory_t() {
+    close();
+}
+
+auto qcstudio::misc::shared_memory_t::create(const wchar_t* _name, size_t _size) -> uint8_t* {
+    close();
+
+    const auto name = object_name(_name);
+    if (name.empty()) {
+        return nullptr;
+    }
+    shm_unlink(name.c_str());  // left by a previous run
+    const auto fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return nullptr;
+    }
+    const auto memory = ftruncate(fd, _size) ? MAP_FAILED : mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);  // the mapping keeps the object alive
+    if (memory == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+    data_ = (uint8_t*)memory;
+    size_ = _size;
+    return data_;
+}
+
+auto qcstudio::misc::shared_memory_t::open(const wchar_t* _name) -> uint8_t* {
+    close();
+
+    const auto name = object_name(_name);
+    if (name.empty()) {
+        return nullptr;
+    }
+    const auto fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat info {};
+    const auto  memory = fstat(fd, &info) || !info.st_size ? MAP_FAILED : mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+    data_ = (uint8_t*)memory;
+    size_ = info.st_size;
+    return data_;
+}
+
+void qcstudio::misc::shared_memory_t::close() {
+    if (data_) {
+        munmap(data_, size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+}
+
+auto qcstudio::misc::shared_memory_t::data() const -> uint8_t* {
+    return data_;
+}
+
+auto qcstudio::misc::shared_memory_t::size() const -> size_t {
+    return size_;
+}
+
+void qcstudio::misc::shared_memory_t::remove(const wchar_t* _name) {
+    if (const auto name = object_name(_name); !name.empty()) {
+        shm_unlink(name.c_str());
+    }
+}
+
+auto qcstudio::misc::current_process() -> uint32_t {
+    return (uint32_t)getpid();
+}
+
+auto qcstudio::misc::process_alive(uint32_t _id) -> bool {
+    return !kill((pid_t)_id, 0) || errno == EPERM;  // EPERM: it exists, only someone else's
+}
@@ -0,0 +1,138 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Own
+
+#include "shared-memory.h"
+
+// Windows
+
+#undef WIN32_LEAN_AND_MEAN
+#undef NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+// C++
+
+#include <string>
+
+using namespace std;
+
+/*
+    A file mapping object backed by the paging file, in the session namespace. It cannot be replaced while another
+    process has it open, hence, 'create' fails if the name is taken
+*/
+
+namespace {
+    auto object_name(const wchar_t* _name) -> wstring {
+        return L"Local\\qcstudio-" + wstring(_name);
+    }
+}  // namespace
+
+qcstudio::misc::shared_memory_t::~shared_memory_t() {
+    close();
+}
+
+auto qcstudio::misc::shared_memory_t::create(const wchar_t* _name, size_t _size) -> uint8_t* {
+    close();
+
+    const auto size    = (uint64_t)_size;
+    const auto mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, object_name(_name).c_str());
+    if (!mapping) {
+        return nullptr;
+    }
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(mapping);
+        return nullptr;
+    }
+    const auto memory = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, _size);
+    if (!memory) {
+        CloseHandle(mapping);
+        return nullptr;
+    }
+    data_   = (uint8_t*)memory;
+    size_   = _size;
+    handle_ = (intptr_t)mapping;
+    return data_;
+}
+
+auto qcstudio::misc::shared_memory_t::open(const wchar_t* _name) -> uint8_t* {
+    close();
+
+    const auto mapping = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, object_name(_name).c_str());
+    if (!mapping) {
+        return nullptr;
+    }
+    const auto memory = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    auto       info   = MEMORY_BASIC_INFORMATION{};
+    if (!memory || !VirtualQuery(memory, &info, sizeof(info))) {
+        if (memory) {
+            UnmapViewOfFile(memory);
+        }
+        CloseHandle(mapping);
+        return nullptr;
+    }
+    data_   = (uint8_t*)memory;
+    size_   = info.RegionSize;  // the size of the object rounded up to pages
+    handle_ = (intptr_t)mapping;
+    return data_;
+}
+
+void qcstudio::misc::shared_memory_t::close() {
+    if (data_) {
+        UnmapViewOfFile(data_);
+    }
+    if (handle_ != -1) {
+        CloseHandle((HANDLE)handle_);
+    }
+    data_   = nullptr;
+    size_   = 0;
+    handle_ = -1;
+}
+
+auto qcstudio::misc::shared_memory_t::data() const -> uint8_t* {
+    return data_;
+}
+
+auto qcstudio::misc::shared_memory_t::size() const -> size_t {
+    return size_;
+}
+
+void qcstudio::misc::shared_memory_t::remove(const wchar_t*) {
+}
+
+auto qcstudio::misc::current_process() -> uint32_t {
+    return (uint32_t)GetCurrentProcessId();
+}
+
+auto qcstudio::misc::process_alive(uint32_t _id) -> bool {
+    const auto process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)_id);
+    if (!process) {
+        return GetLastError() == ERROR_ACCESS_DENIED;  // it exists, only someone else's
+    }
+    const auto alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return alive;
+}
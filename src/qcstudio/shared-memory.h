@@ -0,0 +1,66 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+    Named shared memory, read/write for every process that maps it: a POSIX shared memory object on Linux
+    (/dev/shm/qcstudio-<name>, which outlives its creator until it is removed) and a file mapping object backed by
+    the paging file on Windows (Local\qcstudio-<name>, gone with the last process that has it open). Fresh memory
+    is zeroed. Platform specific parts in shared-memory-<platform>.cpp
+*/
+
+namespace qcstudio::misc {
+
+    class shared_memory_t {
+    public:
+        shared_memory_t() = default;
+        shared_memory_t(const shared_memory_t&) = delete;
+        auto operator=(const shared_memory_t&) -> shared_memory_t& = delete;
+        ~shared_memory_t();
+
+        auto create(const wchar_t* _name, size_t _size) -> uint8_t*;  // replaces a stale one of the same name (Linux)
+        auto open(const wchar_t* _name) -> uint8_t*;                   // an existing one, all of it
+        void close();                                                  // unmaps it (the name stays, see 'remove')
+
+        auto data() const -> uint8_t*;
+        auto size() const -> size_t;
+
+        static void remove(const wchar_t* _name);  // the name only, the mappings stay valid (nothing to do on Windows)
+
+    private:
+        uint8_t* data_   = nullptr;
+        size_t   size_   = 0;
+        intptr_t handle_ = -1;  // of the mapping object (Windows only, it lives as long as a handle does)
+    };
+
+    // Processes sharing memory tell whether the other end is still there by its id
+
+    auto current_process() -> uint32_t;
+    auto process_alive(uint32_t _id) -> bool;
+
+}  // namespace qcstudio::misc
@@ -0,0 +1,669 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Own
+
+#include "symbol-index.h"
+#include "mapped-file.h"
+#include "unicode.h"
+#include "crc32.h"
+
+// C++
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Linux
+
+#include <elf.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/*
+    ELF/DWARF index builder.
+    - Symbols from .symtab and .dynsym (functions only)
+    - Lines from the .debug_line programs (DWARF 2 to 5)
+    - Compilation directories from the compile unit entries in .debug_info (relative file names of DWARF < 5)
+    If the module has no debug information we look for a separate debug file through its build-id
+    (/usr/lib/debug/.build-id/xx/yyyy.debug). Compressed sections are not supported
+*/
+
+namespace {
+
+    // Bounds checked reader; once it runs out of data every read returns zero and 'ok' turns false
+
+    struct cursor_t {
+        const uint8_t* pos;
+        const uint8_t* end;
+        bool           failed = false;
+
+        auto ok() const -> bool {
+            return !failed;
+        }
+        auto left() const -> size_t {
+            return failed ? 0 : end - pos;
+        }
+        auto skip(size_t _size) -> bool {
+            if (left() < _size) {
+                failed = true;
+                return false;
+            }
+            pos += _size;
+            return true;
+        }
+        template<typename T>
+        auto get() -> T {
+            auto ret = T{};
+            if (left() >= sizeof(T)) {
+                memcpy(&ret, pos, sizeof(T));
+            }
+            skip(sizeof(T));
+            return ret;
+        }
+        auto get(size_t _size) -> uint64_t {  // little endian, up to 8 bytes
+            auto ret = uint64_t{0};
+            if (left() >= _size && _size <= sizeof(ret)) {
+                memcpy(&ret, pos, _size);
+            }
+            skip(_size);
+            return ret;
+        }
+        auto uleb() -> uint64_t {
+            auto ret = uint64_t{0};
+            for (auto shift = 0u; !failed; shift += 7) {
+                const auto byte = get<uint8_t>();
+                if (shift < 64) {
+                    ret |= (uint64_t)(byte & 0x7f) << shift;
+                }
+                if (!(byte & 0x80)) {
+                    break;
+                }
+            }
+            return ret;
+        }
+        auto sleb() -> int64_t {
+            auto ret   = int64_t{0};
+            auto shift = 0u;
+            auto byte  = uint8_t{0};
+            do {
+                byte = get<uint8_t>();
+                if (shift < 64) {
+                    ret |= (int64_t)(byte & 0x7f) << shift;
+                }
+                shift += 7;
+            } while ((byte & 0x80) && !failed);
+            if (shift < 64 && (byte & 0x40)) {
+                ret |= -((int64_t)1 << shift);
+            }
+            return ret;
+        }
+        auto str() -> const char* {
+            const auto ret = (const char*)pos;
+            const auto nul = failed ? nullptr : memchr(pos, 0, end - pos);
+            if (!nul) {
+                failed = true;
+                return "";
+            }
+            pos = (const uint8_t*)nul + 1;
+            return ret;
+        }
+    };
+
+    struct section_t {
+        const uint8_t* data = nullptr;
+        size_t         size = 0;
+
+        auto str(uint64_t _offset) const -> const char* {
+            if (_offset < size && memchr(data + _offset, 0, size - _offset)) {
+                return (const char*)data + _offset;
+            }
+            return nullptr;
+        }
+    };
+
+    // Mapped ELF file (64 bits, little endian)
+
+    struct elf_t {
+        qcstudio::misc::mapped_file_t file;
+        const Elf64_Ehdr*             header   = nullptr;
+        const Elf64_Shdr*             sections = nullptr;
+        const char*                   names    = nullptr;  // section names
+        uint64_t                      base     = ~0ull;    // lowest loaded address
+
+        auto open(const wchar_t* _path) -> bool {
+            if (!file.open(_path) || file.size() < sizeof(Elf64_Ehdr)) {
+                return false;
+            }
+            header = (const Elf64_Ehdr*)file.data();
+            if (memcmp(header->e_ident, ELFMAG, SELFMAG) || header->e_ident[EI_CLASS] != ELFCLASS64 || header->e_ident[EI_DATA] != ELFDATA2LSB) {
+                return false;
+            }
+            if (header->e_shoff + (uint64_t)header->e_shnum * sizeof(Elf64_Shdr) > file.size() || header->e_shstrndx >= header->e_shnum) {
+                return false;
+            }
+            sections = (const Elf64_Shdr*)(file.data() + header->e_shoff);
+            names    = (const char*)file.data() + sections[header->e_shstrndx].sh_offset;
+
+            if (header->e_phoff + (uint64_t)header->e_phnum * sizeof(Elf64_Phdr) <= file.size()) {
+                const auto segments = (const Elf64_Phdr*)(file.data() + header->e_phoff);
+                for (auto i = 0u; i < header->e_phnum; ++i) {
+                    if (segments[i].p_type == PT_LOAD) {
+                        base = min<uint64_t>(base, segments[i].p_vaddr);
+                    }
+                }
+            }
+            return true;
+        }
+
+        auto section(const Elf64_Shdr& _section) const -> section_t {
+            if (_section.sh_type == SHT_NOBITS || (_section.sh_flags & SHF_COMPRESSED) || _section.sh_offset + _section.sh_size > file.size()) {
+                return {};
+            }
+            return {file.data() + _section.sh_offset, _section.sh_size};
+        }
+
+        auto section(const char* _name) const -> section_t {
+            for (auto i = 0u; i < header->e_shnum; ++i) {
+                if (sections[i].sh_name < sections[header->e_shstrndx].sh_size && !strcmp(names + sections[i].sh_name, _name)) {
+                    return section(sections[i]);
+                }
+            }
+            return {};
+        }
+    };
+
+    // DWARF form of an attribute value: numbers and strings is all we care about
+
+    struct unit_t {
+        uint16_t version;
+        uint8_t  address_size;
+        bool     dwarf64;
+    };
+
+    struct value_t {
+        uint64_t    num = 0;
+        const char* str = nullptr;
+    };
+
+    auto read_form(cursor_t& _cursor, uint64_t _form, const unit_t& _unit, const section_t& _str, const section_t& _line_str, int64_t _implicit) -> value_t {
+        const auto offset_size = _unit.dwarf64 ? 8u : 4u;
+        auto       ret         = value_t{};
+        switch (_form) {
+            case 0x01: ret.num = _cursor.get(_unit.address_size); break;                                     // addr
+            case 0x03: _cursor.skip(_cursor.get<uint16_t>()); break;                                         // block2
+            case 0x04: _cursor.skip(_cursor.get<uint32_t>()); break;                                         // block4
+            case 0x05: ret.num = _cursor.get<uint16_t>(); break;                                             // data2
+            case 0x06: ret.num = _cursor.get<uint32_t>(); break;                                             // data4
+            case 0x07: ret.num = _cursor.get<uint64_t>(); break;                                             // data8
+            case 0x08: ret.str = _cursor.str(); break;                                                       // string
+            case 0x09: _cursor.skip(_cursor.uleb()); break;                                                  // block
+            case 0x0a: _cursor.skip(_cursor.get<uint8_t>()); break;                                          // block1
+            case 0x0b: ret.num = _cursor.get<uint8_t>(); break;                                              // data1
+            case 0x0c: ret.num = _cursor.get<uint8_t>(); break;                                              // flag
+            case 0x0d: ret.num = (uint64_t)_cursor.sleb(); break;                                            // sdata
+            case 0x0e: ret.str = _str.str(_cursor.get(offset_size)); break;                                  // strp
+            case 0x0f: ret.num = _cursor.uleb(); break;                                                      // udata
+            case 0x10: ret.num = _cursor.get(_unit.version <= 2 ? _unit.address_size : offset_size); break;  // ref_addr
+            case 0x11: ret.num = _cursor.get<uint8_t>(); break;                                              // ref1
+            case 0x12: ret.num = _cursor.get<uint16_t>(); break;                                             // ref2
+            case 0x13: ret.num = _cursor.get<uint32_t>(); break;                                             // ref4
+            case 0x14: ret.num = _cursor.get<uint64_t>(); break;                                             // ref8
+            case 0x15: ret.num = _cursor.uleb(); break;                                                      // ref_udata
+            case 0x16: return read_form(_cursor, _cursor.uleb(), _unit, _str, _line_str, _implicit);         // indirect
+            case 0x17: ret.num = _cursor.get(offset_size); break;                                            // sec_offset
+            case 0x18: _cursor.skip(_cursor.uleb()); break;                                                  // exprloc
+            case 0x19: ret.num = 1; break;                                                                   // flag_present
+            case 0x1a: ret.num = _cursor.uleb(); break;                                                      // strx (unsupported)
+            case 0x1b: ret.num = _cursor.uleb(); break;                                                      // addrx
+            case 0x1c: ret.num = _cursor.get<uint32_t>(); break;                                             // ref_sup4
+            case 0x1d: ret.num = _cursor.get(offset_size); break;                                            // strp_sup
+            case 0x1e: _cursor.skip(16); break;                                                              // data16
+            case 0x1f: ret.str = _line_str.str(_cursor.get(offset_size)); break;                             // line_strp
+            case 0x20: ret.num = _cursor.get<uint64_t>(); break;                                             // ref_sig8
+            case 0x21: ret.num = (uint64_t)_implicit; break;                                                 // implicit_const
+            case 0x22: ret.num = _cursor.uleb(); break;                                                      // loclistx
+            case 0x23: ret.num = _cursor.uleb(); break;                                                      // rnglistx
+            case 0x24: ret.num = _cursor.get<uint64_t>(); break;                                             // ref_sup8
+            case 0x25: ret.num = _cursor.get<uint8_t>(); break;                                              // strx1
+            case 0x26: ret.num = _cursor.get<uint16_t>(); break;                                             // strx2
+            case 0x27: ret.num = _cursor.get(3); break;                                                      // strx3
+            case 0x28: ret.num = _cursor.get<uint32_t>(); break;                                             // strx4
+            case 0x29: ret.num = _cursor.get<uint8_t>(); break;                                              // addrx1
+            case 0x2a: ret.num = _cursor.get<uint16_t>(); break;                                             // addrx2
+            case 0x2b: ret.num = _cursor.get(3); break;                                                      // addrx3
+            case 0x2c: ret.num = _cursor.get<uint32_t>(); break;                                             // addrx4
+            case 0x1f01: ret.num = _cursor.uleb(); break;                                                    // GNU_addr_index
+            case 0x1f02: ret.num = _cursor.uleb(); break;                                                    // GNU_str_index
+            case 0x1f20: ret.num = _cursor.get(offset_size); break;                                          // GNU_ref_alt
+            case 0x1f21: ret.num = _cursor.get(offset_size); break;                                          // GNU_strp_alt
+            default: _cursor.failed = true; break;
+        }
+        return ret;
+    }
+
+    // |unit_length(4 or 12 bytes)|version(2 bytes)|... returns the unit contents
+
+    auto read_unit_header(cursor_t& _cursor, unit_t& _unit) -> cursor_t {
+        auto length    = (uint64_t)_cursor.get<uint32_t>();
+        _unit.dwarf64  = length == 0xffffffff;
+        if (_unit.dwarf64) {
+            length = _cursor.get<uint64_t>();
+        }
+        auto unit = cursor_t{_cursor.pos, _cursor.pos + min<uint64_t>(length, _cursor.left())};
+        _cursor.skip(unit.end - unit.pos);
+        _unit.version = unit.get<uint16_t>();
+        return unit;
+    }
+
+}  // namespace
+
+/*
+    The loader
+*/
+
+namespace qcstudio::symbols {
+
+    struct elf_loader_t {
+        module_index_t&                  index;
+        uint64_t                         base = 0;
+        unordered_map<string, uint32_t>  pool;
+        unordered_map<uint64_t, string>  comp_dirs;  // by .debug_line offset
+
+        auto intern(string_view _str) -> uint32_t {
+            if (_str.empty()) {
+                return 0;
+            }
+            auto [it, inserted] = pool.try_emplace(string(_str), (uint32_t)index.strings_.size());
+            if (inserted) {
+                index.strings_.insert(index.strings_.end(), _str.begin(), _str.end());
+                index.strings_.push_back(0);
+            }
+            return it->second;
+        }
+
+        void load_symbols(const elf_t& _elf) {
+            for (auto i = 0u; i < _elf.header->e_shnum; ++i) {
+                const auto& section = _elf.sections[i];
+                if ((section.sh_type != SHT_SYMTAB && section.sh_type != SHT_DYNSYM) || section.sh_link >= _elf.header->e_shnum) {
+                    continue;
+                }
+                const auto symbols = _elf.section(section);
+                const auto names   = _elf.section(_elf.sections[section.sh_link]);
+                for (auto sym = (const Elf64_Sym*)symbols.data; sym && (const uint8_t*)(sym + 1) <= symbols.data + symbols.size; ++sym) {
+                    const auto type = ELF64_ST_TYPE(sym->st_info);
+                    if ((type != STT_FUNC && type != STT_GNU_IFUNC) || sym->st_shndx == SHN_UNDEF || sym->st_value < base) {
+                        continue;
+                    }
+                    if (auto name = names.str(sym->st_name); name && *name) {
+                        index.symbols_.push_back({sym->st_value - base, sym->st_size, intern(name)});
+                    }
+                }
+            }
+        }
+
+        void load_comp_dirs(const elf_t& _elf) {
+            const auto info     = _elf.section(".debug_info");
+            const auto abbrev   = _elf.section(".debug_abbrev");
+            const auto str      = _elf.section(".debug_str");
+            const auto line_str = _elf.section(".debug_line_str");
+
+            for (auto cursor = cursor_t{info.data, info.data + info.size}; cursor.ok() && cursor.left();) {
+                auto unit_info = unit_t{};
+                auto unit      = read_unit_header(cursor, unit_info);
+                auto abbrevs   = uint64_t{0};
+                if (unit_info.version >= 5) {
+                    const auto type        = unit.get<uint8_t>();
+                    unit_info.address_size = unit.get<uint8_t>();
+                    abbrevs                = unit.get(unit_info.dwarf64 ? 8 : 4);
+                    if (type != 0x01 /* DW_UT_compile */ && type != 0x03 /* DW_UT_partial */) {
+                        continue;
+                    }
+                } else {
+                    abbrevs                = unit.get(unit_info.dwarf64 ? 8 : 4);
+                    unit_info.address_size = unit.get<uint8_t>();
+                }
+
+                // Abbreviation of the first entry (the compile unit itself)
+
+                const auto code = unit.uleb();
+                if (!unit.ok() || abbrevs >= abbrev.size) {
+                    continue;
+                }
+                auto decl = cursor_t{abbrev.data + abbrevs, abbrev.data + abbrev.size};
+                while (decl.ok() && decl.left()) {
+                    const auto decl_code = decl.uleb();
+                    if (!decl_code || decl_code == code) {
+                        break;
+                    }
+                    decl.uleb();            // tag
+                    decl.get<uint8_t>();    // children
+                    for (;;) {
+                        const auto attr = decl.uleb(), form = decl.uleb();
+                        if (form == 0x21) {
+                            decl.sleb();
+                        }
+                        if ((!attr && !form) || !decl.ok()) {
+                            break;
+                        }
+                    }
+                }
+                const auto tag = decl.uleb();
+                decl.get<uint8_t>();
+                if (tag != 0x11 /* DW_TAG_compile_unit */ && tag != 0x3c /* DW_TAG_partial_unit */) {
+                    continue;
+                }
+
+                auto comp_dir  = (const char*)nullptr;
+                auto stmt_list = ~0ull;
+                while (decl.ok() && unit.ok()) {
+                    const auto attr = decl.uleb(), form = decl.uleb();
+                    const auto implicit = form == 0x21 ? decl.sleb() : 0;
+                    if (!attr && !form) {
+                        break;
+                    }
+                    const auto value = read_form(unit, form, unit_info, str, line_str, implicit);
+                    if (attr == 0x1b /* DW_AT_comp_dir */) {
+                        comp_dir = value.str;
+                    } else if (attr == 0x10 /* DW_AT_stmt_list */) {
+                        stmt_list = value.num;
+                    }
+                }
+                if (comp_dir && stmt_list != ~0ull) {
+                    comp_dirs[stmt_list] = comp_dir;
+                }
+            }
+        }
+
+        void load_lines(const elf_t& _elf) {
+            const auto lines    = _elf.section(".debug_line");
+            const auto str      = _elf.section(".debug_str");
+            const auto line_str = _elf.section(".debug_line_str");
+
+            auto sequence = vector<module_index_t::line_t>{};
+            for (auto cursor = cursor_t{lines.data, lines.data + lines.size}; cursor.ok() && cursor.left();) {
+                const auto unit_offset = (uint64_t)(cursor.pos - lines.data);
+                auto       unit_info   = unit_t{};
+                auto       unit        = read_unit_header(cursor, unit_info);
+                if (unit_info.version < 2 || unit_info.version > 5) {
+                    continue;
+                }
+                unit_info.address_size = 8;
+                if (unit_info.version >= 5) {
+                    unit_info.address_size = unit.get<uint8_t>();
+                    unit.get<uint8_t>();  // segment selector size
+                }
+                const auto header_length = unit.get(unit_info.dwarf64 ? 8 : 4);
+                auto       program       = cursor_t{unit.pos + min<uint64_t>(header_length, unit.left()), unit.end};
+
+                const auto min_inst_length = unit.get<uint8_t>();
+                if (unit_info.version >= 4) {
+                    unit.get<uint8_t>();  // maximum operations per instruction (VLIW only)
+                }
+                const auto default_is_stmt = unit.get<uint8_t>();
+                const auto line_base       = unit.get<int8_t>();
+                const auto line_range      = unit.get<uint8_t>();
+                const auto opcode_base     = unit.get<uint8_t>();
+                const auto opcode_lengths  = unit.pos;
+                unit.skip(opcode_base ? opcode_base - 1 : 0);
+                if (!unit.ok() || !line_range) {
+                    continue;
+                }
+
+                // Directories and files
+
+                const auto comp_dir = comp_dirs.count(unit_offset) ? comp_dirs[unit_offset] : string{};
+                auto       dirs     = vector<string>{};
+                auto       files    = vector<pair<string, uint64_t>>{};  // name, directory index
+                if (unit_info.version >= 5) {
+                    const auto read_entries = [&](auto _add) {
+                        auto formats = vector<pair<uint64_t, uint64_t>>(unit.get<uint8_t>());
+                        for (auto& [type, form] : formats) {
+                            type = unit.uleb();
+                            form = unit.uleb();
+                        }
+                        for (auto count = unit.uleb(); count && unit.ok(); --count) {
+                            auto name = string{};
+                            auto dir  = uint64_t{0};
+                            for (auto& [type, form] : formats) {
+                                const auto value = read_form(unit, form, unit_info, str, line_str, 0);
+                                if (type == 1 /* DW_LNCT_path */ && value.str) {
+                                    name = value.str;
+                                } else if (type == 2 /* DW_LNCT_directory_index */) {
+                                    dir = value.num;
+                                }
+                            }
+                            _add(move(name), dir);
+                        }
+                    };
+                    read_entries([&](string&& _name, uint64_t) { dirs.push_back(move(_name)); });
+                    read_entries([&](string&& _name, uint64_t _dir) { files.emplace_back(move(_name), _dir); });
+                } else {
+                    dirs.push_back(comp_dir);
+                    for (auto dir = unit.str(); *dir && unit.ok(); dir = unit.str()) {
+                        dirs.push_back(dir);
+                    }
+                    files.emplace_back();  // 1 based
+                    for (auto name = unit.str(); *name && unit.ok(); name = unit.str()) {
+                        const auto dir = unit.uleb();
+                        unit.uleb();  // modification time
+                        unit.uleb();  // length
+                        files.emplace_back(name, dir);
+                    }
+                }
+
+                auto file_ids = vector<uint32_t>(files.size(), ~0u);
+                const auto file_id = [&](uint64_t _file) -> uint32_t {
+                    if (_file >= files.size()) {
+                        return 0;
+                    }
+                    if (file_ids[_file] == ~0u) {
+                        auto& [name, dir] = files[_file];
+                        auto path         = name;
+                        if (!name.empty() && name[0] != '/' && dir < dirs.size() && !dirs[dir].empty()) {
+                            path = dirs[dir] + "/" + name;
+                            if (dirs[dir][0] != '/' && !comp_dir.empty()) {
+                                path = comp_dir + "/" + path;
+                            }
+                        }
+                        file_ids[_file] = intern(path);
+                    }
+                    return file_ids[_file];
+                };
+
+                // Run the line program. Rows are only kept for sequences starting inside the module (the ones at
+                // address 0 belong to code discarded by the linker)
+
+                auto       address = uint64_t{0};
+                auto       file    = uint64_t{1};
+                auto       line    = int64_t{1};
+                const auto reset   = [&] {
+                    address = 0;
+                    file    = 1;
+                    line    = 1;
+                    sequence.clear();
+                };
+                const auto emit = [&] {
+                    sequence.push_back({address, file_id(file), (uint32_t)max<int64_t>(line, 0)});
+                };
+                const auto end_sequence = [&] {
+                    if (!sequence.empty() && sequence.front().addr >= base && sequence.front().addr) {
+                        sequence.push_back({address, 0, 0});
+                        for (auto& row : sequence) {
+                            index.lines_.push_back({row.addr - base, row.file, row.line});
+                        }
+                    }
+                    reset();
+                };
+
+                (void)default_is_stmt;
+                while (program.ok() && program.left()) {
+                    const auto opcode = program.get<uint8_t>();
+                    if (opcode >= opcode_base) {
+                        const auto adjusted = opcode - opcode_base;
+                        address += (adjusted / line_range) * min_inst_length;
+                        line += line_base + (adjusted % line_range);
+                        emit();
+                        continue;
+                    }
+                    switch (opcode) {
+                        case 0: {  // extended
+                            const auto length = program.uleb();
+                            auto       op     = cursor_t{program.pos, program.pos + min<uint64_t>(length, program.left())};
+                            program.skip(length);
+                            switch (op.get<uint8_t>()) {
+                                case 1: end_sequence(); break;                    // DW_LNE_end_sequence
+                                case 2: address = op.get(op.left()); break;       // DW_LNE_set_address
+                                default: break;                                   // define_file, set_discriminator...
+                            }
+                            break;
+                        }
+                        case 1: emit(); break;                                                   // DW_LNS_copy
+                        case 2: address += program.uleb() * min_inst_length; break;              // DW_LNS_advance_pc
+                        case 3: line += program.sleb(); break;                                   // DW_LNS_advance_line
+                        case 4: file = program.uleb(); break;                                    // DW_LNS_set_file
+                        case 8: address += ((255 - opcode_base) / line_range) * min_inst_length; break;  // DW_LNS_const_add_pc
+                        case 9: address += program.get<uint16_t>(); break;                       // DW_LNS_fixed_advance_pc
+                        default: {                                                               // operands are ulebs
+                            for (auto i = 0; i < opcode_lengths[opcode - 1]; ++i) {
+                                program.uleb();
+                            }
+                            break;
+                        }
+                    }
+                }
+                reset();
+            }
+        }
+
+        static auto build_id(const elf_t& _elf) -> string {
+            for (auto i = 0u; i < _elf.header->e_shnum; ++i) {
+                if (_elf.sections[i].sh_type != SHT_NOTE) {
+                    continue;
+                }
+                const auto note = _elf.section(_elf.sections[i]);
+                auto       cursor = cursor_t{note.data, note.data + note.size};
+                while (cursor.ok() && cursor.left() >= sizeof(Elf64_Nhdr)) {
+                    const auto header = cursor.get<Elf64_Nhdr>();
+                    const auto name   = cursor.pos;
+                    cursor.skip((header.n_namesz + 3) & ~3u);
+                    const auto desc = cursor.pos;
+                    cursor.skip((header.n_descsz + 3) & ~3u);
+                    if (cursor.ok() && header.n_type == NT_GNU_BUILD_ID && header.n_namesz == 4 && !memcmp(name, "GNU", 4)) {
+                        auto ret = string{};
+                        for (auto j = 0u; j < header.n_descsz; ++j) {
+                            static constexpr char digits[] = "0123456789abcdef";
+                            ret += digits[desc[j] >> 4];
+                            ret += digits[desc[j] & 15];
+                        }
+                        return ret;
+                    }
+                }
+            }
+            return {};
+        }
+    };
+
+}  // namespace qcstudio::symbols
+
+auto qcstudio::symbols::module_index_t::load(const wchar_t* _path, const wchar_t* _cache_dir) -> bool {
+    reset();
+
+    auto elf = elf_t{};
+    if (!elf.open(_path)) {
+        return false;
+    }
+
+    // Cached already? The build id identifies the contents of the module; without one we settle for its path,
+    // size and modification time
+
+    auto cache_key  = string{};
+    auto cache_file = wstring{};
+    if (_cache_dir && *_cache_dir) {
+        auto name = elf_loader_t::build_id(elf);
+        if (!name.empty()) {
+            cache_key = "build-id:" + name;
+        } else {
+            struct stat info {};
+            stat(unicode::native_path(_path).c_str(), &info);
+            cache_key = "file:" + unicode::to_utf8(_path, char_traits<wchar_t>::length(_path)) + ":" + to_string(info.st_size) + ":" +
+                        to_string(info.st_mtim.tv_sec) + "." + to_string(info.st_mtim.tv_nsec);
+            char crc[16];
+            snprintf(crc, sizeof(crc), "%08x", (uint32_t)crc32::from_string(cache_key.c_str()));
+            name = crc;
+        }
+        cache_file = wstring(_cache_dir) + L"/" + unicode::to_wide(name.c_str()) + L".qcsidx";
+        if (read_cache(cache_file, cache_key)) {
+            return true;
+        }
+    }
+
+    auto loader = elf_loader_t{*this, elf.base == ~0ull ? 0 : elf.base, {}, {}};
+    loader.load_symbols(elf);
+
+    // Debug information either in the module or in a separate file
+
+    auto debug = &elf;
+    auto separate = elf_t{};
+    if (!elf.section(".debug_line").size) {
+        if (const auto id = elf_loader_t::build_id(elf); id.size() > 2) {
+            const auto path = "/usr/lib/debug/.build-id/" + id.substr(0, 2) + "/" + id.substr(2) + ".debug";
+            wchar_t    wpath[4096];
+            unicode::to_wide(path.c_str(), wpath, sizeof(wpath) / sizeof(wpath[0]));
+            if (separate.open(wpath)) {
+                debug = &separate;
+                if (symbols_.empty()) {
+                    loader.load_symbols(separate);
+                }
+            }
+        }
+    }
+    loader.load_comp_dirs(*debug);
+    loader.load_lines(*debug);
+
+    // Sort the tables (symbols: the first one at an address wins; lines: end of sequence rows go first so that
+    // a sequence starting right where another one ends is the one found)
+
+    stable_sort(symbols_.begin(), symbols_.end(), [](const symbol_t& _left, const symbol_t& _right) {
+        return _left.addr < _right.addr;
+    });
+    symbols_.erase(unique(symbols_.begin(), symbols_.end(), [](const symbol_t& _left, const symbol_t& _right) {
+        return _left.addr == _right.addr;
+    }), symbols_.end());
+    stable_sort(lines_.begin(), lines_.end(), [](const line_t& _left, const line_t& _right) {
+        return _left.addr < _right.addr || (_left.addr == _right.addr && !_left.line && _right.line);
+    });
+    symbols_.shrink_to_fit();
+    lines_.shrink_to_fit();
+    publish();
+
+    if (!cache_file.empty()) {
+        write_cache(cache_file, cache_key);
+    }
+    return true;
+}
@@ -0,0 +1,196 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Own
+
+#include "symbol-index.h"
+#include "unicode.h"
+#include "uuid.h"
+
+// C++
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+using namespace std;
+
+namespace {
+    constexpr auto align8(size_t _size) -> size_t {
+        return (_size + 7) & ~size_t{7};
+    }
+}  // namespace
+
+auto qcstudio::symbols::module_index_t::lookup(uint64_t _addr) const -> tuple<const char*, uint32_t, const char*> {
+    auto file = (const char*)nullptr;
+    auto line = uint32_t{0};
+    auto name = (const char*)nullptr;
+
+    // Last symbol starting at or before the address
+
+    const auto symbols_end = symbol_table_ + num_symbols_;
+    auto       sym         = upper_bound(symbol_table_, symbols_end, _addr, [](uint64_t _value, const symbol_t& _symbol) {
+        return _value < _symbol.addr;
+    });
+    if (sym != symbol_table_) {
+        --sym;
+        if (!sym->size || _addr < sym->addr + sym->size) {
+            name = string_pool_ + sym->name;
+        }
+    }
+
+    // Last line row starting at or before the address
+
+    const auto lines_end = line_table_ + num_lines_;
+    auto       row       = upper_bound(line_table_, lines_end, _addr, [](uint64_t _value, const line_t& _line) {
+        return _value < _line.addr;
+    });
+    if (row != line_table_) {
+        --row;
+        if (row->line) {
+            file = string_pool_ + row->file;
+            line = row->line;
+        }
+    }
+
+    return {file, line, name};
+}
+
+auto qcstudio::symbols::module_index_t::empty() const -> bool {
+    return !num_symbols_ && !num_lines_;
+}
+
+auto qcstudio::symbols::module_index_t::cached() const -> bool {
+    return cache_.size() != 0;
+}
+
+void qcstudio::symbols::module_index_t::reset() {
+    cache_.close();
+    symbols_.clear();
+    lines_.clear();
+    strings_.assign(1, 0);
+    publish();
+}
+
+void qcstudio::symbols::module_index_t::publish() {
+    symbol_table_ = symbols_.data();
+    line_table_   = lines_.data();
+    string_pool_  = strings_.data();
+    num_symbols_  = symbols_.size();
+    num_lines_    = lines_.size();
+}
+
+/*
+    Cache files
+*/
+
+auto qcstudio::symbols::module_index_t::read_cache(const wstring& _filename, const string& _key) -> bool {
+    if (!cache_.open(_filename.c_str())) {
+        return false;
+    }
+
+    // Validate everything before pointing the tables to the mapping: the file may be truncated, of another
+    // version or (unlikely) belong to another module whose key got the same file name
+
+    const auto data   = cache_.data();
+    const auto size   = cache_.size();
+    auto       header = cache_header_t{};
+    auto       offset = sizeof(cache_magic) + sizeof(header);
+    if (size < offset || memcmp(data, cache_magic, sizeof(cache_magic))) {
+        cache_.close();
+        return false;
+    }
+    memcpy(&header, data + sizeof(cache_magic), sizeof(header));
+
+    const auto key_offset     = offset;
+    const auto symbols_offset = key_offset + align8(header.key_size);
+    const auto lines_offset   = symbols_offset + header.num_symbols * sizeof(symbol_t);
+    const auto strings_offset = lines_offset + header.num_lines * sizeof(line_t);
+    if (header.key_size != _key.size() || header.num_symbols > size / sizeof(symbol_t) || header.num_lines > size / sizeof(line_t) ||
+        strings_offset + header.strings_size != size || !header.strings_size || data[size - 1] != 0 ||
+        memcmp(data + key_offset, _key.data(), _key.size())) {
+        cache_.close();
+        return false;
+    }
+
+    const auto symbols = (const symbol_t*)(data + symbols_offset);
+    const auto lines   = (const line_t*)(data + lines_offset);
+    const auto invalid = any_of(symbols, symbols + header.num_symbols, [&](const symbol_t& _symbol) { return _symbol.name >= header.strings_size; }) ||
+                         any_of(lines, lines + header.num_lines, [&](const line_t& _line) { return _line.file >= header.strings_size; });
+    if (invalid) {
+        cache_.close();
+        return false;
+    }
+
+    symbols_.clear();
+    lines_.clear();
+    strings_.clear();
+    symbol_table_ = symbols;
+    line_table_   = lines;
+    string_pool_  = (const char*)(data + strings_offset);
+    num_symbols_  = header.num_symbols;
+    num_lines_    = header.num_lines;
+    return true;
+}
+
+auto qcstudio::symbols::module_index_t::write_cache(const wstring& _filename, const string& _key) const -> bool {
+    // Written aside and renamed into place so that readers (other viewers included) never see a partial file
+
+    const auto target = unicode::native_path(_filename.c_str());
+    auto       error  = error_code{};
+    filesystem::create_directories(target.parent_path(), error);
+
+    auto temp = target;
+    temp += "." + misc::uuid().str() + ".tmp";
+    {
+        auto file = ofstream(temp, ios::binary);
+        if (!file) {
+            return false;
+        }
+
+        static constexpr char padding[8] = {};
+
+        const auto header = cache_header_t{(uint32_t)_key.size(), 0, num_symbols_, num_lines_, strings_.size()};
+        file.write(cache_magic, sizeof(cache_magic));
+        file.write((const char*)&header, sizeof(header));
+        file.write(_key.data(), _key.size());
+        file.write(padding, align8(_key.size()) - _key.size());
+        file.write((const char*)symbol_table_, num_symbols_ * sizeof(symbol_t));
+        file.write((const char*)line_table_, num_lines_ * sizeof(line_t));
+        file.write(strings_.data(), strings_.size());
+        if (!file) {
+            file.close();
+            filesystem::remove(temp, error);
+            return false;
+        }
+    }
+
+    filesystem::rename(temp, target, error);
+    if (error) {
+        filesystem::remove(temp, error);
+        return false;
+    }
+    return true;
+}
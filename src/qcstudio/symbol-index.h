@@ -0,0 +1,112 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "mapped-file.h"
+
+/*
+    Symbol index of a module.
+    Flat tables sorted by address (relative to the lowest loaded address of the module, i.e. what the recorder
+    stores as base address) answering lookups by binary search:
+    - symbols: address range -> name
+    - lines:   address -> file/line (a row holds until the next one; line 0 means no information)
+    All the strings live in a single pool and are referenced by offset. Building the index is platform specific
+    (see symbol-index-<platform>.cpp).
+    As the tables are plain arrays they can be saved as they are into a cache file, keyed by the build id of the
+    module (or its path, size and modification time when it has none), which later runs map instead of parsing
+    the debug information again:
+    |magic(8 bytes)|cache_header_t|key|symbols|lines|strings| (every part aligned to 8 bytes)
+*/
+
+namespace qcstudio::symbols {
+
+    using namespace std;
+
+    class module_index_t {
+    public:
+        struct symbol_t {
+            uint64_t addr;
+            uint64_t size;  // 0 if unknown (it then extends up to the next symbol)
+            uint32_t name;
+        };
+
+        struct line_t {
+            uint64_t addr;
+            uint32_t file;
+            uint32_t line;
+        };
+
+        // '_cache_dir': directory of the cache files (nullptr: no cache)
+
+        auto load(const wchar_t* _path, const wchar_t* _cache_dir = nullptr) -> bool;
+
+        // file, line and symbol of a module relative address (nullptr/0 when unknown)
+
+        auto lookup(uint64_t _addr) const -> tuple<const char*, uint32_t, const char*>;
+
+        auto empty() const -> bool;
+        auto cached() const -> bool;  // mapped from the cache instead of built
+
+        static constexpr char cache_magic[8] = {'Q', 'C', 'S', 'I', 'D', 'X', '0', '1'};
+
+    private:
+        struct cache_header_t {
+            uint32_t key_size;
+            uint32_t reserved;
+            uint64_t num_symbols;
+            uint64_t num_lines;
+            uint64_t strings_size;
+        };
+
+        // tables being built (empty when mapped from the cache)
+
+        vector<symbol_t> symbols_;
+        vector<line_t>   lines_;
+        vector<char>     strings_;  // zero terminated strings, offset 0 is the empty one
+
+        // what lookups use: the tables above or the mapped cache file
+
+        const symbol_t*     symbol_table_ = nullptr;
+        const line_t*       line_table_   = nullptr;
+        const char*         string_pool_  = nullptr;
+        size_t              num_symbols_  = 0;
+        size_t              num_lines_    = 0;
+        misc::mapped_file_t cache_;
+
+        void reset();
+        void publish();
+        auto read_cache(const wstring& _filename, const string& _key) -> bool;
+        auto write_cache(const wstring& _filename, const string& _key) const -> bool;
+
+        friend struct elf_loader_t;
+    };
+
+}  // namespace qcstudio::symbols
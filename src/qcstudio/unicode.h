@@ -0,0 +1,118 @@
+﻿/*
+    MIT License
+
+    Copyright (c) 2017-2023 Raúl Ramos
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sub-license, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <filesystem>
+
+/*
+    Minimal utf-8 <-> wchar_t helpers.
+    Recordings store paths as wchar_t (utf-16 on Windows, utf-32 elsewhere) whereas Linux speaks utf-8. The standard
+    conversions depend on the global locale (and throw when they fail) so we do it by hand
+*/
+
+namespace qcstudio::unicode {
+
+    using namespace std;
+
+    // utf-8 to wchar_t into a caller provided buffer (no allocations); returns the number of characters written
+
+    inline auto to_wide(const char* _src, wchar_t* _dst, size_t _capacity) -> size_t {
+        auto len = size_t{0};
+        auto src = (const uint8_t*)_src;
+        while (*src && len + 1 < _capacity) {
+            auto code  = uint32_t{*src++};
+            auto extra = code >= 0xF0 ? 3 : code >= 0xE0 ? 2 : code >= 0xC0 ? 1 : 0;
+            code &= extra == 3 ? 0x07 : extra == 2 ? 0x0F : extra == 1 ? 0x1F : 0x7F;
+            for (; extra && (*src & 0xC0) == 0x80; --extra) {
+                code = (code << 6) | (*src++ & 0x3F);
+            }
+            if constexpr (sizeof(wchar_t) == 2) {
+                if (code >= 0x10000 && len + 2 < _capacity) {
+                    code -= 0x10000;
+                    _dst[len++] = (wchar_t)(0xD800 + (code >> 10));
+                    code        = 0xDC00 + (code & 0x3FF);
+                }
+            }
+            _dst[len++] = (wchar_t)code;
+        }
+        _dst[len] = 0;
+        return len;
+    }
+
+    inline auto to_wide(const char* _src) -> wstring {
+        auto ret = wstring(char_traits<char>::length(_src) + 1, 0);  // never more characters than bytes
+        ret.resize(to_wide(_src, ret.data(), ret.size()));
+        return ret;
+    }
+
+    // wchar_t to utf-8
+
+    inline auto to_utf8(const wchar_t* _src, size_t _len) -> string {
+        auto ret = string{};
+        ret.reserve(_len);
+        for (auto i = 0u; i < _len; ++i) {
+            auto code = (uint32_t)_src[i];
+            if constexpr (sizeof(wchar_t) == 2) {
+                if (code >= 0xD800 && code < 0xDC00 && i + 1 < _len) {
+                    code = 0x10000 + ((code - 0xD800) << 10) + ((uint32_t)_src[++i] - 0xDC00);
+                }
+            }
+            if (code < 0x80) {
+                ret += (char)code;
+            } else if (code < 0x800) {
+                ret += (char)(0xC0 | (code >> 6));
+                ret += (char)(0x80 | (code & 0x3F));
+            } else if (code < 0x10000) {
+                ret += (char)(0xE0 | (code >> 12));
+                ret += (char)(0x80 | ((code >> 6) & 0x3F));
+                ret += (char)(0x80 | (code & 0x3F));
+            } else {
+                ret += (char)(0xF0 | (code >> 18));
+                ret += (char)(0x80 | ((code >> 12) & 0x3F));
+                ret += (char)(0x80 | ((code >> 6) & 0x3F));
+                ret += (char)(0x80 | (code & 0x3F));
+            }
+        }
+        return ret;
+    }
+
+    inline auto to_utf8(const wstring& _src) -> string {
+        return to_utf8(_src.data(), _src.size());
+    }
+
+    // Path usable by the standard streams (only MSVC accepts wchar_t file names natively)
+
+    inline auto native_path(const wchar_t* _path) -> filesystem::path {
+#if defined(_WIN32)
+        return filesystem::path(_path);
+#else
+        return filesystem::path(to_utf8(_path, char_traits<wchar_t>::length(_path)));
+#endif
+    }
+
+}  // namespace qcstudio::unicode
@@ -36,6 +36,7 @@
 #include <sstream>
 #include <cmath>
 #include <cstdint>
+#include <climits>
 
 // Platform
 
@@ -28,6 +28,8 @@
 // Own
 
 #include "qcstudio/callstack-player.h"
+#include "qcstudio/callstack-profile.h"
+#include "qcstudio/callstack-reader.h"
 #include "qcstudio/callstack-recorder.h"
 
 // C++
@@ -39,26 +41,104 @@
 #include <map>
 #include <tuple>
 #include <sstream>
-#include <io.h>
-#include <fcntl.h>
-
-#undef WIN32_LEAN_AND_MEAN
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
-#include <dbghelp.h>
+#include <iomanip>
+#include <clocale>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+
+#if defined(_WIN32)
+#    include <io.h>
+#    include <fcntl.h>
+#    undef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#    include <dbghelp.h>
+#endif
 
 using namespace std;
 using namespace std::chrono;
 using namespace qcstudio::callstack;
 
-int main() {
+/*
+    Usage: viewer [--folded | --top N | --stats | --live NAME | --shared NAME]
+    - no arguments: every capture with its resolved call stack
+    - --live NAME: the same, as they come from a host streaming to NAME (host --live NAME)
+    - --shared NAME: the same, collected from a host sharing as NAME (host --shared NAME)
+    - --folded: the captures aggregated by call path, as folded stacks (flamegraph.pl input)
+    - --top N: the N call paths with the most captures
+    - --stats: the telemetry of the recorder at the end of the recording
+*/
+
+int main(int argc, char** argv) {
     // Setup the output console so that it can handle unicode
 
+#if defined(_WIN32)
     _setmode(_fileno(stdout), _O_U8TEXT);
+#else
+    setlocale(LC_ALL, "");
+#endif
+
+    // Telemetry
+
+    if (argc > 1 && !strcmp(argv[1], "--stats")) {
+        auto reader = qcstudio::callstack::reader_t{};
+        auto stats  = optional<recorder_t::stats_t>{};
+        if (!reader.open(L"callstack_data★.json")) {
+            return 1;
+        }
+        for (auto event = event_t{}; reader.next(event);) {
+            if (event.type == recorder_t::event::telemetry) {
+                stats = *event.stats;
+            }
+        }
+        if (!stats) {
+            wcerr << L"no telemetry in the recording" << endl;
+            return 1;
+        }
+        wcout << dec << stats->captures << L" captures, " << stats->dropped << L" dropped events, " << stats->bytes << L" bytes, " << stats->threads << L" threads" << endl;
+        wcout << L"waited for segments: " << stats->lock_wait / 1'000'000 << L" ms" << endl;
+        wcout << L"written whole for lack of room in the interning table: " << stats->uninterned << L" captures" << endl;
+        wcout << L"capture latency (ns): p50 " << stats->percentile(0.5) << L", p90 " << stats->percentile(0.9) << L", p99 " << stats->percentile(0.99) << L", p99.9 " << stats->percentile(0.999) << L", max " << stats->percentile(1.0) << endl;
+        return 0;
+    }
+
+    // Aggregated modes
+
+    const auto live   = argc > 2 && !strcmp(argv[1], "--live");
+    const auto shared = argc > 2 && !strcmp(argv[1], "--shared");
+    const auto name   = argc > 2 ? wstring(argv[2], argv[2] + strlen(argv[2])) : wstring{};
+    if (argc > 1 && !live && !shared) {
+        const auto folded = !strcmp(argv[1], "--folded");
+        const auto top    = !strcmp(argv[1], "--top") && argc > 2 ? strtoul(argv[2], nullptr, 10) : 0ul;
+        if (!folded && !top) {
+            wcerr << L"usage: viewer [--folded | --top N | --stats | --live NAME | --shared NAME]" << endl;
+            return 1;
+        }
+
+        auto player  = qcstudio::callstack::player_t{};
+        auto profile = qcstudio::callstack::profile_t{};
+        if (!player.aggregate(L"callstack_data★.json", profile, thread::hardware_concurrency())) {
+            return 1;
+        }
+        player.end();
+
+        if (folded) {
+            profile.write_folded(wcout);
+        } else {
+            for (auto& path : profile.hottest(top)) {
+                wcout << dec << path.exclusive << L" (" << fixed << setprecision(1) << 100.0 * path.exclusive / profile.total() << L"%)" << endl;
+                for (auto it = path.frames.rbegin(); it != path.frames.rend(); ++it) {
+                    wcout << L"    " << *it << endl;
+                }
+            }
+        }
+        return 0;
+    }
 
     // Instantiate the resolver
 
-    const auto callstack_processor = [](uint64_t _timestamp, const vector<tuple<const wchar_t*, wstring, int, wstring, uintptr_t>>& _lines) {
+    const auto callstack_processor = [](uint64_t _timestamp, qcstudio::callstack::player_t::resolved_frames_t _frames) {
         auto ms   = _timestamp % 1'000'000'000 / 1'000'000;
         auto time = system_clock::to_time_t(system_clock::time_point(milliseconds(_timestamp / 1'000'000)));
         auto bt   = *gmtime(&time);
@@ -67,7 +147,7 @@ int main() {
         wcout << L'.' << setfill(L'0') << setw(3) << dec << ms;
         wcout << L": {" << endl;
 
-        for (auto& [mod, file, line, sym, addr] : _lines) {
+        for (auto& [mod, file, line, sym, addr] : _frames) {
             wcout << "    " << filesystem::path(mod).filename() << "! ";
             if (file.empty()) {
                 wcout << hex << "0x" << addr << ": ";
@@ -80,8 +160,22 @@ int main() {
     };
 
     auto player = qcstudio::callstack::player_t{};
-    player.start(L"callstack_data★.json", callstack_processor);
+    if (live) {
+        if (!player.start_live(name.c_str(), callstack_processor)) {
+            return 1;
+        }
+    } else if (shared) {
+        if (!player.start_shared(name.c_str(), callstack_processor)) {
+            wcerr << L"no host sharing as " << name << endl;
+            return 1;
+        }
+    } else {
+        player.start(L"callstack_data★.json", callstack_processor);
+    }
     player.end();
 
+    const auto stats = player.cache_stats();
+    wcout << dec << stats.misses << L" unique addresses resolved, " << stats.hits << L" cache hits" << endl;
+
     return 0;
 }
\ No newline at end of file